@@ -0,0 +1,345 @@
+#include "../include/scene_mesh.hpp"
+#include "../include/cursor_image.hpp"
+#include "../include/config.hpp"
+#include "../include/spsc_queue.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+
+/*
+    Benchmarks of the code that runs on the cpu when the scene or the cursor changes, and of the
+    queues between the main thread and the mpv thread. Prints one JSON object to stdout:
+
+        {"benchmarks":[{"name":"...","iterations":N,"ns_per_op":X,"allocs_per_op":Y,"bytes_per_op":Z},...]}
+
+    Benchmarks are sorted by name and the keys are always in the same order, so two runs can be
+    compared with a plain diff or a script. ns_per_op is the fastest of several runs, which is the
+    most stable number on a machine that is doing other things. Allocations are counted by replacing
+    the global operator new.
+
+    Usage: vr-video-player-bench [--filter <substring>] [--min-time <seconds>]
+*/
+
+static std::atomic<uint64_t> num_allocations{0};
+static std::atomic<uint64_t> num_allocated_bytes{0};
+
+void* operator new(size_t size) {
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    num_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    void *ptr = malloc(size == 0 ? 1 : size);
+    if(!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+// The array and nothrow versions call this one
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+// Keeps the compiler from removing the work of a benchmark whose result isn't used
+template <typename T>
+static inline void keep(const T &value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+static int64_t get_monotonic_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Runs the operation |iterations| times. Returns how many operations were done, which is more than
+// |iterations| for benchmarks that do a batch of operations per call
+using BenchmarkFunc = uint64_t(*)(uint64_t iterations);
+
+struct Benchmark {
+    const char *name;
+    BenchmarkFunc func;
+};
+
+struct BenchmarkResult {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    double allocs_per_op;
+    double bytes_per_op;
+};
+
+static const int num_runs = 5;
+
+static BenchmarkResult run_benchmark(const Benchmark &benchmark, double min_time_seconds) {
+    // Warms up the caches and finds how many iterations take at least |min_time_seconds|
+    uint64_t iterations = 1;
+    while(true) {
+        const int64_t start = get_monotonic_time_ns();
+        benchmark.func(iterations);
+        const int64_t elapsed = get_monotonic_time_ns() - start;
+        if(elapsed >= min_time_seconds * 1000000000.0 || iterations >= (1ULL << 40))
+            break;
+        iterations *= 2;
+    }
+
+    BenchmarkResult result;
+    result.name = benchmark.name;
+    result.iterations = iterations;
+    result.ns_per_op = 0.0;
+    result.allocs_per_op = 0.0;
+    result.bytes_per_op = 0.0;
+
+    for(int i = 0; i < num_runs; ++i) {
+        const uint64_t allocations_start = num_allocations.load(std::memory_order_relaxed);
+        const uint64_t bytes_start = num_allocated_bytes.load(std::memory_order_relaxed);
+        const int64_t start = get_monotonic_time_ns();
+        const uint64_t num_ops = benchmark.func(iterations);
+        const int64_t elapsed = get_monotonic_time_ns() - start;
+        const uint64_t allocations = num_allocations.load(std::memory_order_relaxed) - allocations_start;
+        const uint64_t bytes = num_allocated_bytes.load(std::memory_order_relaxed) - bytes_start;
+
+        const double ns_per_op = (double)elapsed / (double)num_ops;
+        if(i == 0 || ns_per_op < result.ns_per_op)
+            result.ns_per_op = ns_per_op;
+        // The allocations are the same in every run
+        result.allocs_per_op = (double)allocations / (double)num_ops;
+        result.bytes_per_op = (double)bytes / (double)num_ops;
+    }
+    return result;
+}
+
+static double bench_width_ratio = 16.0 / 9.0;
+
+static uint64_t bench_scene_mesh_sphere(uint64_t iterations) {
+    const glm::mat4 mat = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+    for(uint64_t i = 0; i < iterations; ++i) {
+        std::vector<float> vertdata;
+        scene_mesh_add_sphere(vertdata, mat, bench_width_ratio, 0.0);
+        keep(vertdata.data());
+    }
+    return iterations;
+}
+
+static uint64_t bench_scene_mesh_cylinder(uint64_t iterations) {
+    for(uint64_t i = 0; i < iterations; ++i) {
+        std::vector<float> vertdata;
+        scene_mesh_add_cylinder(vertdata, bench_width_ratio, 0.0);
+        keep(vertdata.data());
+    }
+    return iterations;
+}
+
+static uint64_t bench_scene_mesh_flat(uint64_t iterations) {
+    for(uint64_t i = 0; i < iterations; ++i) {
+        std::vector<float> vertdata;
+        scene_mesh_add_flat(vertdata, bench_width_ratio, 0.0, false);
+        keep(vertdata.data());
+    }
+    return iterations;
+}
+
+static uint64_t bench_scene_mesh_sphere360(uint64_t iterations) {
+    for(uint64_t i = 0; i < iterations; ++i) {
+        std::vector<float> vertdata;
+        scene_mesh_add_sphere360(vertdata, 2.0 / 3840.0, 2.0 / 1920.0, 0.0);
+        keep(vertdata.data());
+    }
+    return iterations;
+}
+
+static uint64_t bench_create_segmented_plane(uint64_t iterations) {
+    // Kept between calls so that its allocation is done in the warm up and not counted
+    static std::vector<float> vertdata;
+    for(uint64_t i = 0; i < iterations; ++i) {
+        vertdata.clear();
+        create_segmented_plane(vertdata, 1.0f, 1.0f, 1.0f, 0.33f, 0.5f, 0.0f, 0.0f, 32, 32);
+        keep(vertdata.data());
+    }
+    return iterations;
+}
+
+// The plane the sphere360 mesh is made of, which is what plane_normalize_depth and vertices_rotate are called on.
+// The buffers are static so that the benchmarks only count the allocations of the code they measure
+static const std::vector<float>& get_bench_plane() {
+    static const std::vector<float> plane = [] {
+        std::vector<float> vertdata;
+        create_segmented_plane(vertdata, 1.0f, 1.0f, 1.0f, 0.33f, 0.5f, 0.0f, 0.0f, 32, 32);
+        return vertdata;
+    }();
+    return plane;
+}
+
+static uint64_t bench_plane_normalize_depth(uint64_t iterations) {
+    const std::vector<float> &plane = get_bench_plane();
+    static std::vector<float> vertdata = plane;
+    for(uint64_t i = 0; i < iterations; ++i) {
+        memcpy(vertdata.data(), plane.data(), plane.size() * sizeof(float));
+        plane_normalize_depth(vertdata.data(), vertdata.size() / 5, 1.0f);
+        keep(vertdata.data());
+    }
+    return iterations;
+}
+
+static uint64_t bench_vertices_rotate(uint64_t iterations) {
+    const std::vector<float> &plane = get_bench_plane();
+    static std::vector<float> vertdata = plane;
+    for(uint64_t i = 0; i < iterations; ++i) {
+        memcpy(vertdata.data(), plane.data(), plane.size() * sizeof(float));
+        vertices_rotate(vertdata.data(), vertdata.size() / 5, -glm::half_pi<float>(), glm::vec3(0.0f, 1.0f, 0.0f));
+        keep(vertdata.data());
+    }
+    return iterations;
+}
+
+// Cursor images are usually 24x24 to 64x64
+static const int max_cursor_size = 64;
+
+static uint64_t bench_cursor_unpremultiply(int size, uint64_t iterations) {
+    static unsigned long pixels[max_cursor_size * max_cursor_size];
+    static uint8_t out[max_cursor_size * max_cursor_size * 4];
+    for(int i = 0; i < size * size; ++i) {
+        const uint32_t alpha = (i * 7) & 0xff;
+        const uint32_t color = alpha / 2;
+        pixels[i] = (alpha << 24) | (color << 16) | (color << 8) | color;
+    }
+
+    for(uint64_t i = 0; i < iterations; ++i) {
+        cursor_unpremultiply_alpha(pixels, size, size, out);
+        keep(out[0]);
+    }
+    return iterations;
+}
+
+static uint64_t bench_cursor_unpremultiply_24(uint64_t iterations) {
+    return bench_cursor_unpremultiply(24, iterations);
+}
+
+static uint64_t bench_cursor_unpremultiply_64(uint64_t iterations) {
+    return bench_cursor_unpremultiply(64, iterations);
+}
+
+// A config file as saved by save_config
+static const char *bench_config_content =
+    "sphere.position 0.000000|0.000000|0.000000\n"
+    "sphere.rotation 0.000000|0.000000|0.000000|1.000000\n"
+    "sphere.zoom 0.000000\n"
+    "sphere360.position 0.000000|0.000000|0.000000\n"
+    "sphere360.rotation 0.000000|0.000000|0.000000|1.000000\n"
+    "sphere360.zoom 0.000000\n"
+    "flat.position 0.120000|-0.050000|0.300000\n"
+    "flat.rotation 0.000000|0.382683|0.000000|0.923880\n"
+    "flat.zoom 0.250000\n"
+    "plane.position 0.000000|1.200000|-2.000000\n"
+    "plane.rotation 0.000000|0.000000|0.000000|1.000000\n"
+    "plane.zoom -0.500000\n"
+    "cache.size auto\n"
+    "cache.on_disk no\n";
+
+static uint64_t bench_parse_config(uint64_t iterations) {
+    const std::string content = bench_config_content;
+    for(uint64_t i = 0; i < iterations; ++i) {
+        Config config;
+        parse_config(content, config);
+        keep(config);
+    }
+    return iterations;
+}
+
+// Items are passed from a producer thread to a consumer thread like the mpv thread commands and events.
+// Each operation is one item going through the queue. A side that has to wait yields, like the real
+// threads do by waiting for something else, so that this also works on a single core
+static uint64_t bench_spsc_queue_throughput(uint64_t iterations) {
+    static SpscQueue<uint64_t, 64> queue;
+    const uint64_t num_items = iterations * 1024;
+
+    std::thread producer([num_items] {
+        for(uint64_t i = 0; i < num_items; ++i) {
+            while(!queue.push(i)) { std::this_thread::yield(); }
+        }
+    });
+
+    uint64_t sum = 0;
+    uint64_t item;
+    for(uint64_t i = 0; i < num_items; ++i) {
+        while(!queue.pop(item)) { std::this_thread::yield(); }
+        sum += item;
+    }
+    producer.join();
+    keep(sum);
+    return num_items;
+}
+
+static const Benchmark benchmarks[] = {
+    { "create_segmented_plane", bench_create_segmented_plane },
+    { "cursor_unpremultiply_24x24", bench_cursor_unpremultiply_24 },
+    { "cursor_unpremultiply_64x64", bench_cursor_unpremultiply_64 },
+    { "parse_config", bench_parse_config },
+    { "plane_normalize_depth", bench_plane_normalize_depth },
+    { "scene_mesh_cylinder", bench_scene_mesh_cylinder },
+    { "scene_mesh_flat", bench_scene_mesh_flat },
+    { "scene_mesh_sphere", bench_scene_mesh_sphere },
+    { "scene_mesh_sphere360", bench_scene_mesh_sphere360 },
+    { "spsc_queue_throughput", bench_spsc_queue_throughput },
+    { "vertices_rotate", bench_vertices_rotate }
+};
+
+static void usage() {
+    fprintf(stderr, "usage: vr-video-player-bench [--filter <substring>] [--min-time <seconds>]\n");
+    fprintf(stderr, "OPTIONS\n");
+    fprintf(stderr, "  --filter <substring>  Only run the benchmarks whose name contains <substring>\n");
+    fprintf(stderr, "  --min-time <seconds>  Minimum time of each of the runs of a benchmark. The default is 0.1\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *filter = nullptr;
+    double min_time_seconds = 0.1;
+
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if(strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            min_time_seconds = atof(argv[++i]);
+            if(min_time_seconds <= 0.0) {
+                fprintf(stderr, "Error: --min-time has to be greater than 0\n");
+                usage();
+            }
+        } else {
+            usage();
+        }
+    }
+
+    // Numbers are printed with a '.' and parse_config expects the "C" locale
+    setlocale(LC_ALL, "C");
+
+    std::vector<BenchmarkResult> results;
+    for(const Benchmark &benchmark : benchmarks) {
+        if(filter && !strstr(benchmark.name, filter))
+            continue;
+        fprintf(stderr, "Running %s\n", benchmark.name);
+        results.push_back(run_benchmark(benchmark, min_time_seconds));
+    }
+
+    std::sort(results.begin(), results.end(), [](const BenchmarkResult &a, const BenchmarkResult &b) {
+        return a.name < b.name;
+    });
+
+    printf("{\"benchmarks\":[");
+    for(size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult &result = results[i];
+        printf("%s\n  {\"name\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,\"bytes_per_op\":%.1f}",
+            i == 0 ? "" : ",", result.name.c_str(), (unsigned long long)result.iterations, result.ns_per_op, result.allocs_per_op, result.bytes_per_op);
+    }
+    printf("\n]}\n");
+    return 0;
+}
@@ -1,9 +1,128 @@
 #!/bin/sh -e
 
-dependencies="glm glew sdl2 openvr x11 xcomposite xfixes mpv"
-includes=$(pkg-config --cflags $dependencies)
-libs=$(pkg-config --libs $dependencies)
-gcc -c src/window_texture.c -O2 -DNDEBUG $includes
-g++ -c src/mpv.cpp -O2 -DNDEBUG $includes
-g++ -c src/main.cpp -O2 -DNDEBUG $includes
-g++ -o vr-video-player -O2 window_texture.o mpv.o main.o -s $libs
+# ./build.sh bench builds vr-video-player-bench, which only needs glm
+if [ "$1" = "bench" ]; then
+    g++ -o vr-video-player-bench -O2 -DNDEBUG bench/bench.cpp src/scene_mesh.cpp src/cursor_image.cpp $(pkg-config --cflags glm) -pthread
+    exit 0
+fi
+
+# ./build.sh test builds and runs the tests in tests/ with ThreadSanitizer
+if [ "$1" = "test" ]; then
+    mkdir -p tests/bin
+    for test in tests/*.cpp; do
+        name=$(basename "${test%.*}")
+        # The sources under test besides the headers
+        case "$name" in
+            notification_test) test_sources="src/notification.cpp" ;;
+            *) test_sources="" ;;
+        esac
+        g++ -o "tests/bin/$name" -O1 -g -fsanitize=thread "$test" $test_sources -pthread
+        TSAN_OPTIONS="halt_on_error=1" "./tests/bin/$name"
+    done
+    exit 0
+fi
+
+dependencies="glm glew sdl2 openvr x11 xcomposite xfixes egl"
+# libmpv is loaded with dlopen when --video is used, so only its headers are needed
+includes=$(pkg-config --cflags $dependencies mpv)
+libs="$(pkg-config --libs $dependencies) -ldl"
+sources="src/window_texture.c src/mpv.cpp src/mpv_quality.cpp src/keyframe_index.cpp src/program_cache.cpp src/startup_trace.cpp src/event_loop.cpp src/notification.cpp src/control_socket.cpp src/metrics.cpp src/session_trace.cpp src/scene_mesh.cpp src/cursor_image.cpp src/headless_gl.cpp src/latency_probe.cpp src/pose_sampler.cpp src/main.cpp"
+
+# Compiles the sources into the directory $1 with the extra flags $2 and links $1/vr-video-player
+build() {
+    objects=""
+    for source in $sources; do
+        object="$1/$(basename "${source%.*}").o"
+        case "$source" in
+            *.c) gcc -c "$source" -o "$object" -O2 -DNDEBUG $2 $includes ;;
+            *) g++ -c "$source" -o "$object" -O2 -DNDEBUG $2 $includes ;;
+        esac
+        objects="$objects $object"
+    done
+    g++ -o "$1/vr-video-player" -O2 $2 $objects -s $libs
+}
+
+if [ "$1" != "pgo" ]; then
+    build .
+    exit 0
+fi
+
+# ./build.sh pgo [session-file] builds vr-video-player with link time and profile guided optimization.
+# The profile comes from an instrumented build running the headless render benchmark and, if a session
+# recorded with --record is given, a replay of the session (which needs an X server, Xvfb works).
+# A plain build is made as well, and both are compared on the same workloads in pgo/report.txt.
+# Code the workloads don't reach (mpv playback) is optimized like in the plain build
+replay_file="$2"
+if [ -n "$replay_file" ] && [ ! -f "$replay_file" ]; then
+    echo "Error: $replay_file doesn't exist" >&2
+    exit 1
+fi
+
+rm -rf pgo
+mkdir -p pgo/baseline pgo/obj
+
+build pgo/baseline ""
+
+# The profile of each object file is written next to it and read back when the same object is compiled again,
+# so the instrumented and the optimized build use the same directory
+build pgo/obj "-fprofile-generate -fprofile-update=atomic"
+mv pgo/obj/vr-video-player pgo/vr-video-player-instrumented
+
+echo "Training with the render benchmark" >&2
+./pgo/vr-video-player-instrumented --render-bench --render-bench-frames 30 > /dev/null
+if [ -n "$replay_file" ]; then
+    echo "Training with a replay of $replay_file" >&2
+    ./pgo/vr-video-player-instrumented --replay "$replay_file" > /dev/null
+fi
+
+build pgo/obj "-flto=auto -fprofile-use -fprofile-partial-training -Wno-missing-profile"
+cp pgo/obj/vr-video-player vr-video-player
+
+# Prints "<startup ms> <frame ms>" of the fastest of 3 runs of the render benchmark with the binary $1. The startup is
+# a run with one frame per mode, which is mostly the context, shader and scene setup. The frame time is the sum of the mean
+# frame times of all the modes
+render_bench_times() {
+    for run in 1 2 3; do
+        start_ns=$(date +%s%N)
+        "$1" --render-bench --render-bench-frames 1 > /dev/null 2>&1
+        end_ns=$(date +%s%N)
+        frame_ms=$("$1" --render-bench 2> /dev/null | sed -n 's/.*"frame_ms_mean":\([0-9.]*\).*/\1/p' | awk '{ sum += $1 } END { print sum }')
+        echo "$(( (end_ns - start_ns) / 1000000 )) $frame_ms"
+    done | sort -n -k2 | head -n 1
+}
+
+# Prints "<mean frame ms> <p99 frame ms> <total s>" of the fastest of 3 replays with the binary $1
+replay_times() {
+    for run in 1 2 3; do
+        "$1" --replay "$replay_file" 2>&1 > /dev/null | awk '
+            /^Replayed/ { total = $(NF - 1) }
+            /^Frame time:/ { mean = $4; p99 = $10 }
+            END { print mean, p99, total }'
+    done | sort -n -k1 | head -n 1
+}
+
+# Prints a line of the report, the change is from the baseline to the optimized build
+report_line() {
+    awk -v name="$1" -v baseline="$2" -v optimized="$3" 'BEGIN {
+        change = baseline > 0 ? (optimized - baseline) * 100.0 / baseline : 0
+        printf "%-34s %12.3f %12.3f %+9.1f%%\n", name, baseline, optimized, change
+    }'
+}
+
+echo "Comparing the builds" >&2
+{
+    printf "%-34s %12s %12s %10s\n" "" "baseline" "lto+pgo" "change"
+    report_line "binary size (KiB)" "$(( $(stat -c %s pgo/baseline/vr-video-player) / 1024 ))" "$(( $(stat -c %s vr-video-player) / 1024 ))"
+
+    set -- $(render_bench_times pgo/baseline/vr-video-player) $(render_bench_times ./vr-video-player)
+    report_line "render bench startup (ms)" "$1" "$3"
+    report_line "render bench frame, all modes (ms)" "$2" "$4"
+
+    if [ -n "$replay_file" ]; then
+        set -- $(replay_times pgo/baseline/vr-video-player) $(replay_times ./vr-video-player)
+        report_line "replay frame mean (ms)" "$1" "$4"
+        report_line "replay frame p99 (ms)" "$2" "$5"
+        report_line "replay total (s)" "$3" "$6"
+    fi
+} > pgo/report.txt
+cat pgo/report.txt
@@ -2,7 +2,10 @@
 
 #include <string>
 #include <string.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <locale.h>
 #include <limits.h>
 #include <unistd.h>
 #include <libgen.h>
@@ -36,11 +39,19 @@ struct PlaneConfig {
     float zoom = 0.0f;
 };
 
+// Demuxer cache used when playing videos with --video
+struct CacheConfig {
+    // "auto", "no" or the size in MiB
+    std::string size = "auto";
+    bool on_disk = false;
+};
+
 struct Config {
     SphereConfig sphere;
     Sphere360Config sphere360;
     FlatConfig flat;
     PlaneConfig plane;
+    CacheConfig cache;
 };
 
 static std::string get_home_dir() {
@@ -204,19 +215,8 @@ static bool string_to_quat(std::string str, glm::quat &value, const StringView k
     return true;
 }
 
-static Config read_config(bool &exists) {
-    setlocale(LC_ALL, "C");
-
-    Config config;
-
-    const std::string config_path = get_config_dir() + "/config";
-    std::string file_content;
-    if(!file_get_content(config_path.c_str(), file_content)) {
-        fprintf(stderr, "Warning: Failed to read config file: %s\n", config_path.c_str());
-        exists = false;
-        return config;
-    }
-
+// Options in |file_content| override the ones in |config|. Expects the "C" locale
+static void parse_config(const std::string &file_content, Config &config) {
     string_split_char(file_content, '\n', [&](StringView line) {
         StringView key, value;
         if(!config_split_key_value(line, key, value)) {
@@ -248,13 +248,32 @@ static Config read_config(bool &exists) {
             string_to_quat(std::string(value.str, value.size), config.plane.rotation, key);
         } else if(key == "plane.zoom") {
             string_to_float(std::string(value.str, value.size), config.plane.zoom, key);
+        } else if(key == "cache.size") {
+            config.cache.size = std::string(value.str, value.size);
+        } else if(key == "cache.on_disk") {
+            config.cache.on_disk = value == "yes";
         } else {
             fprintf(stderr, "Warning: Invalid config option: %.*s\n", (int)line.size, line.str);
         }
 
         return true;
     });
+}
+
+static Config read_config(bool &exists) {
+    setlocale(LC_ALL, "C");
 
+    Config config;
+
+    const std::string config_path = get_config_dir() + "/config";
+    std::string file_content;
+    if(!file_get_content(config_path.c_str(), file_content)) {
+        fprintf(stderr, "Warning: Failed to read config file: %s\n", config_path.c_str());
+        exists = false;
+        return config;
+    }
+
+    parse_config(file_content, config);
     exists = true;
     return config;
 }
@@ -295,5 +314,8 @@ static void save_config(const Config &config) {
     fprintf(file, "plane.rotation %f|%f|%f|%f\n", config.plane.rotation.x, config.plane.rotation.y, config.plane.rotation.z, config.plane.rotation.w);
     fprintf(file, "plane.zoom %f\n", config.plane.zoom);
 
+    fprintf(file, "cache.size %s\n", config.cache.size.c_str());
+    fprintf(file, "cache.on_disk %s\n", config.cache.on_disk ? "yes" : "no");
+
     fclose(file);
 }
\ No newline at end of file
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class EventLoop;
+
+enum class ControlCommandType {
+    SEEK,
+    PAUSE,
+    RESUME,
+    TOGGLE_PAUSE,
+    ZOOM_IN,
+    ZOOM_OUT,
+    ZOOM,
+    RESET,
+    LOAD,
+    NEXT,
+    PREV,
+    STATE
+};
+
+struct ControlCommand {
+    ControlCommandType type;
+    // Seconds for SEEK, the zoom level for ZOOM
+    double value = 0.0;
+    // The file for LOAD
+    std::string path;
+
+    uint64_t client_id = 0;
+    int64_t receive_time_us = 0;
+};
+
+/*
+    Unix domain socket that scripts (and hardware buttons, through a small script) can send commands to,
+    one command per line:
+
+        seek <seconds>      relative seek, can be negative
+        pause, resume, toggle-pause
+        zoom-in, zoom-out
+        zoom <level>        set the zoom, has to be a positive number
+        reset               reset the position of the video in front of the headset
+        load <path>         replace the playlist with <path>
+        next, prev          go to the next or previous playlist entry
+        state               query the playback state
+
+    Every command gets a single line reply, "ok [<key>=<value> ...] latency=<ms>" or "error <message>".
+    The latency is the time from when the command was read from the socket to when it was applied.
+    A client can close its end right after sending its commands, it's closed after the last reply.
+
+    Commands are read as soon as they arrive, but only applied once per frame by the main loop with
+    |take_commands| and |reply|.
+*/
+class ControlSocket {
+public:
+    ControlSocket() = default;
+    ~ControlSocket();
+    ControlSocket(const ControlSocket&) = delete;
+    ControlSocket& operator=(const ControlSocket&) = delete;
+
+    // Listens on |path| and registers the socket and its clients with |event_loop|, which has to outlive the control socket.
+    // Fails if another instance is already listening on |path|
+    bool create(const std::string &path, EventLoop &event_loop);
+    void destroy();
+
+    // Moves the commands received since the last call to |commands|, in the order they were received
+    void take_commands(std::vector<ControlCommand> &commands);
+    // |result| is appended to "ok" (can be empty). Each command should be replied to once
+    void reply_ok(const ControlCommand &command, const std::string &result);
+    void reply_error(const ControlCommand &command, const char *message);
+
+    const std::string& get_path() const { return path; }
+    // Percentile of the command latency in milliseconds, 0 if there have been no commands
+    double get_latency_percentile_ms(double percentile) const;
+    int64_t get_command_count() const { return command_count; }
+private:
+    struct Client {
+        uint64_t id;
+        int fd;
+        std::string buffer;
+        // Commands that haven't been replied to yet
+        int pending_replies;
+        // The client closed its end. It's closed once its pending commands have been replied to
+        bool read_closed;
+    };
+
+    void accept_clients();
+    void read_client(uint64_t client_id);
+    void close_client(uint64_t client_id);
+    void command_replied(uint64_t client_id);
+    void parse_line(Client &client, const std::string &line, int64_t receive_time_us);
+    void write_line(uint64_t client_id, const std::string &line);
+    Client* get_client(uint64_t client_id);
+private:
+    EventLoop *event_loop = nullptr;
+    std::string path;
+    int listen_fd = -1;
+    std::vector<Client> clients;
+    uint64_t next_client_id = 1;
+    std::vector<ControlCommand> pending_commands;
+    // The latest command latencies, used as a ring buffer
+    std::vector<double> latencies_ms;
+    size_t latency_index = 0;
+    int64_t command_count = 0;
+};
+
+// $XDG_RUNTIME_DIR/vr-video-player.sock, or /tmp/vr-video-player-<uid>.sock if XDG_RUNTIME_DIR isn't set
+std::string control_socket_get_default_path();
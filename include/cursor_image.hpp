@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+    Converts a cursor image from XFixesGetCursorImage, premultiplied ARGB with one pixel per unsigned long,
+    to straight alpha RGBA bytes in |out|, which has to fit |width|*|height|*4 bytes.
+*/
+void cursor_unpremultiply_alpha(const unsigned long *pixels, int width, int height, uint8_t *out);
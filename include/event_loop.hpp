@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+#include <signal.h>
+#include <functional>
+#include <vector>
+
+/*
+    epoll based event loop for the main thread. |wait| sleeps until one of the registered fds is
+    readable and then calls the callback of each readable fd once, so nothing is polled while idle.
+
+    Also keeps wake-to-handle latency samples (for example from when a timer expired to when its
+    callback ran) and logs them together with the cpu time used by the thread in |update_stats|.
+*/
+class EventLoop {
+public:
+    using Callback = std::function<void()>;
+
+    EventLoop() = default;
+    ~EventLoop();
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool create();
+    // |callback| is called from |wait| when |fd| is readable. |fd| is not closed by the event loop
+    bool add_fd(int fd, Callback callback);
+    void remove_fd(int fd);
+    // Waits until an fd is readable or |timeout_ms| has passed (-1 waits forever) and calls the callbacks
+    // of the readable fds. Returns false on error
+    bool wait(int timeout_ms);
+
+    void add_latency_sample(double latency_ms);
+    // Logs the latency percentiles and the cpu usage of the calling thread every minute. Can be called every iteration
+    void update_stats();
+private:
+    struct Source {
+        int fd;
+        Callback callback;
+    };
+
+    int epoll_fd = -1;
+    std::vector<Source> sources;
+    std::vector<double> latencies_ms;
+    int64_t stats_start_time_us = 0;
+    int64_t stats_start_cpu_time_us = 0;
+    int64_t num_wakeups = 0;
+};
+
+// Periodic timer that starts expiring |interval_us| from now. Returns -1 on error
+int event_loop_create_timer(int64_t interval_us);
+// Changes the interval of a timer created with |event_loop_create_timer|
+bool event_loop_set_timer_interval(int timer_fd, int64_t interval_us);
+// Reads a readable timer. Returns the number of expirations since the last read (0 if it wasn't readable)
+// and sets |latency_ms| to the time since the last expiration
+uint64_t event_loop_read_timer(int timer_fd, double &latency_ms);
+// The signals in |mask| have to be blocked in all threads (with pthread_sigmask before any thread is started)
+// for them to be delivered to the fd instead. Returns -1 on error
+int event_loop_create_signalfd(const sigset_t &mask);
@@ -0,0 +1,23 @@
+#pragma once
+
+/*
+    OpenGL context without a window or a display server, made with EGL on the surfaceless platform
+    (EGL_MESA_platform_surfaceless). Rendering goes to framebuffer objects only. Works with Mesa's
+    llvmpipe on machines without a gpu, which is what the render benchmark runs on in a build box.
+*/
+class HeadlessGlContext {
+public:
+    HeadlessGlContext() = default;
+    ~HeadlessGlContext();
+    HeadlessGlContext(const HeadlessGlContext&) = delete;
+    HeadlessGlContext& operator=(const HeadlessGlContext&) = delete;
+
+    // Creates a core profile context of at least |major|.|minor| and makes it current on the calling thread
+    bool create(int major, int minor);
+    void destroy();
+    bool is_created() const { return context != nullptr; }
+private:
+    // EGLDisplay and EGLContext, so that egl.h isn't included everywhere
+    void *display = nullptr;
+    void *context = nullptr;
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*
+    Keyframe positions of a video file, learned from where keyframe seeks land and stored under
+    get_config_dir()/keyframe-cache so that later sessions can seek straight to a known keyframe.
+    Entries are keyed by a hash of the file path, size and modification time, so a replaced file
+    gets a new index.
+*/
+class KeyframeIndex {
+public:
+    // Loads the index of |filepath|, saving the index of the previous file first
+    void open(const char *filepath);
+    // Saves the index if it has changed since it was loaded
+    void save();
+
+    // Keyframe positions are in seconds
+    void add(double position);
+    // Finds the known keyframe closest to |target| that is at most |max_distance| away. Returns false if there is none
+    bool find_nearest(double target, double max_distance, double &keyframe) const;
+    size_t size() const { return keyframes.size(); }
+private:
+    std::string cache_path;
+    // Sorted
+    std::vector<double> keyframes;
+    bool dirty = false;
+};
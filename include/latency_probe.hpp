@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <X11/Xlib.h>
+
+/*
+    Test window for measuring the time from a change in the captured window to the frame that is
+    submitted with it. A thread redraws the window at a fixed rate with a pattern in its top left corner
+    that encodes a frame counter and the CLOCK_MONOTONIC time the frame was drawn at. The player reads
+    the pattern back from the captured texture when it submits a frame, and the latency is the time of
+    the readback minus the decoded time. The window is resized every few seconds so that the pixmap
+    rebinding after a resize is measured as well.
+
+    The pattern is a row of LATENCY_PROBE_NUM_CELLS black or white squares of LATENCY_PROBE_CELL_SIZE pixels,
+    least significant bit first: 32 bits of frame counter, 64 bits of time in microseconds and 32 bits
+    of check value, so that a texture that is read while the window is being drawn isn't decoded.
+*/
+
+#define LATENCY_PROBE_CELL_SIZE 4
+#define LATENCY_PROBE_NUM_CELLS 128
+
+struct LatencyProbeFrame {
+    uint32_t frame;
+    // When the frame was drawn, in latency_probe_time_us
+    int64_t time_us;
+};
+
+struct LatencyProbeSample {
+    LatencyProbeFrame frame;
+    // When the frame was first read back from the captured texture
+    int64_t submit_time_us;
+};
+
+// Decodes the pattern from a row of |width| RGBA pixels through the middle of the squares.
+// Returns false if the row doesn't contain the pattern
+bool latency_probe_decode(const uint8_t *rgba_row, int width, LatencyProbeFrame &frame);
+// The clock the frame times are in
+int64_t latency_probe_time_us();
+
+class LatencyProbeWindow {
+public:
+    LatencyProbeWindow() = default;
+    ~LatencyProbeWindow();
+    LatencyProbeWindow(const LatencyProbeWindow&) = delete;
+    LatencyProbeWindow& operator=(const LatencyProbeWindow&) = delete;
+
+    // Opens its own connection to the X server, maps the window and starts redrawing it |frames_per_second| times a second
+    bool create(int frames_per_second);
+    void destroy();
+
+    Window get_window() const { return window; }
+    uint32_t get_num_frames_drawn() const { return num_frames_drawn; }
+    // The first frame that was drawn after each resize
+    std::vector<LatencyProbeFrame> get_resize_frames();
+private:
+    void run();
+    // Returns the time that was drawn in the pattern
+    int64_t draw_frame(uint32_t frame);
+private:
+    Display *display = nullptr;
+    Window window = None;
+    GC gc = None;
+    unsigned long black_pixel = 0;
+    unsigned long white_pixel = 0;
+    int frames_per_second = 60;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<uint32_t> num_frames_drawn{0};
+    std::mutex resize_frames_mutex;
+    std::vector<LatencyProbeFrame> resize_frames;
+};
@@ -0,0 +1,50 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    Process wide registry of counters, gauges and histograms. Updating a metric is a few atomic
+    operations and can be done from any thread. Registering is slower (it takes a lock), so metrics
+    should be registered once and the returned pointer kept. Registering a name again returns the
+    existing metric. Metrics live until the process exits.
+
+    Names follow the prometheus conventions: vrvp_<what>_<unit>, with _total for counters.
+*/
+
+typedef struct MetricsCounter MetricsCounter;
+typedef struct MetricsGauge MetricsGauge;
+typedef struct MetricsHistogram MetricsHistogram;
+
+MetricsCounter* metrics_counter(const char *name, const char *help);
+MetricsGauge* metrics_gauge(const char *name, const char *help);
+/* |bounds| are the upper bounds of the buckets in increasing order, a +Inf bucket is added after them */
+MetricsHistogram* metrics_histogram(const char *name, const char *help, const double *bounds, int num_bounds);
+/* Bounds from 0.1ms to 1s, for latencies and durations in seconds */
+MetricsHistogram* metrics_latency_histogram(const char *name, const char *help);
+
+void metrics_counter_add(MetricsCounter *counter, uint64_t value);
+void metrics_gauge_set(MetricsGauge *gauge, double value);
+void metrics_histogram_observe(MetricsHistogram *histogram, double value);
+
+/* Monotonic time in seconds, for timing with metrics_histogram_observe */
+double metrics_time_seconds(void);
+
+/*
+    Serves the metrics over http on 127.0.0.1:|port| from a separate thread:
+        GET /metrics   prometheus text format
+        GET /snapshot  binary snapshot, see write_snapshot in metrics.cpp for the format
+    Returns 0 on success.
+*/
+int metrics_server_start(int port);
+void metrics_server_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* METRICS_H */
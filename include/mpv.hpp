@@ -1,31 +1,133 @@
 #pragma once
 
+#include "keyframe_index.hpp"
 #include <stdint.h>
-#include <SDL.h>
+#include <vector>
+#include <atomic>
 
 typedef struct mpv_handle mpv_handle;
 typedef struct mpv_render_context mpv_render_context;
 
+enum class MpvSeekMode {
+    // Seek to the closest keyframe. Fast, but doesn't land exactly on the target
+    KEYFRAME,
+    // Decode from the previous keyframe up to the target
+    EXACT
+};
+
+struct MpvCacheSettings {
+    enum class Mode {
+        // Sized from the bitrate of the file and the available memory (or disk space)
+        AUTO,
+        FIXED,
+        DISABLED
+    };
+
+    Mode mode = Mode::AUTO;
+    // Only used with Mode::FIXED
+    int64_t size_mib = 0;
+    bool on_disk = false;
+};
+
+// Parses "auto", "no" or a size in MiB. Returns false if |str| is invalid
+bool mpv_cache_settings_parse_size(const char *str, MpvCacheSettings &settings);
+
 class Mpv {
 public:
+    enum WakeupReason : uint32_t {
+        WAKEUP_EVENTS = 1 << 0,
+        WAKEUP_RENDER_UPDATE = 1 << 1
+    };
+
     Mpv() = default;
     ~Mpv();
 
+    // Creates the eventfd returned by |get_wakeup_fd|. Has to be called before |create_render_context|,
+    // and can be called before |create| so that the fd can be polled from the start
+    bool create_wakeup_fd();
+    // Readable when mpv has events or a new frame, |process_wakeups| should be called then
+    int get_wakeup_fd() const { return wakeup_fd; }
+    // Called from mpv's threads
+    void wakeup(uint32_t reason);
+
+    // Creates and initializes the mpv handle. This doesn't need an opengl context and can be done
+    // in parallel with the rest of the startup
     bool create(bool use_system_mpv_config);
+    // Needs to be called after |create| with the opengl context that mpv should render with made current
+    bool create_render_context();
     bool destroy();
 
+    // Replaces the playlist with |path|
     bool load_file(const char *path);
-    // |width| and |ħeight| are set to 0 unless there is an event to reconfigure video size
-    void on_event(SDL_Event &event, bool *render_update, int64_t *width, int64_t *height, bool *quit, int *error);
+    // Adds |path| to the end of the playlist. The next entry is opened before the current one ends
+    bool append_file(const char *path);
+    void playlist_next();
+    void playlist_prev();
+    // Handles the events and render updates since the last call.
+    // |width| and |ħeight| are set to 0 unless there is an event to reconfigure video size.
+    // |quit| is set when the end of the playlist has been reached.
+    // |file_ended| is set when a file stops playing, for example at the end of the file or when switching to another playlist entry
+    void process_wakeups(bool *render_update, int64_t *width, int64_t *height, bool *quit, int *error, bool *file_ended);
+    // Relative seek. Seeks requested while a seek is in progress are combined into a single seek
     void seek(double seconds);
     void toggle_pause();
+    void set_paused(bool pause);
+    // Reads the pause property, so unlike |paused| it can be called from any thread
+    bool get_paused();
+    // In seconds, -1 if there is no file playing (or its duration is unknown)
+    double get_position();
+    double get_duration();
+    void set_property(const char *name, const char *value);
+    // Renders without blocking until the frame's target time, use |next_frame_due| to schedule the call
     void draw(unsigned int framebuffer_id, int width, int height);
+    // Returns true if the next video frame should be rendered now to be displayed at the vsync at |next_vsync_time_us|.
+    // The times are in the |get_time_us| clock. |next_vsync_time_us| can be 0 if the vsync time is unknown.
+    // Sets |next_frame_target_time_us|
+    bool next_frame_due(int64_t next_vsync_time_us, int64_t vsync_interval_us);
+    int64_t get_time_us();
+    // Frames dropped by the video output (frame-drop-count) plus frames dropped by the decoder
+    // (decoder-frame-drop-count) since the start of playback
+    int64_t get_dropped_frame_count();
+    // Should be called when the last rendered frame is displayed
+    void report_swap();
+    // Logs the demuxer cache fill, input rate and underruns every 10 seconds. Can be called every frame
+    void update_cache_stats();
 
-    bool created = false;
-    uint32_t wakeup_on_mpv_render_update = -1;
-    uint32_t wakeup_on_mpv_events = -1;
+    // Set by |create_render_context| on the mpv thread and read on the main thread. |mpv| and |mpv_gl|
+    // are only used after this has been seen as true
+    std::atomic<bool> created{false};
+    // Time from the first wakeup to |process_wakeups|, set by |process_wakeups|
+    double wakeup_latency_ms = 0.0;
 
     mpv_handle *mpv = nullptr;
     mpv_render_context *mpv_gl = nullptr;
     bool paused = false;
+    bool file_started = false;
+    bool last_file_failed = false;
+    MpvSeekMode seek_mode = MpvSeekMode::KEYFRAME;
+    // Has to be set before |create|
+    MpvCacheSettings cache_settings;
+    int64_t cache_fill_bytes = 0;
+    double cache_duration_secs = 0.0;
+    int64_t cache_input_bytes_per_second = 0;
+    int64_t cache_underruns = 0;
+    int64_t next_frame_target_time_us = 0;
+private:
+    void issue_seek();
+    void configure_cache();
+    void log_seek_latency_percentiles();
+private:
+    KeyframeIndex keyframe_index;
+    double seek_target = 0.0;
+    bool seek_in_flight = false;
+    bool seek_pending = false;
+    bool seek_learn_keyframe = false;
+    bool seek_awaiting_frame = false;
+    int64_t seek_request_time_us = 0;
+    std::vector<double> seek_latencies_ms;
+    int64_t cache_stats_time_us = 0;
+
+    int wakeup_fd = -1;
+    std::atomic<uint32_t> pending_wakeups{0};
+    std::atomic<int64_t> wakeup_time_us{0};
 };
\ No newline at end of file
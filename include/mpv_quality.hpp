@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+class Mpv;
+
+/*
+    Steps mpv's scaler, debanding and linear light settings down when rendering a video frame costs
+    too much of the headset frame budget (or frames are dropped) and back up when there is room again.
+    Tier 0 is the cheapest tier and the highest tier matches profile=gpu-hq, which is what mpv starts with.
+
+    Decisions are made over windows of frames, and a tier has to be consistently too expensive (or
+    consistently cheap) for several windows before it changes, so the quality doesn't oscillate.
+*/
+class MpvQualityGovernor {
+public:
+    MpvQualityGovernor();
+
+    // Adds the gpu time of one Mpv::draw. Returns true when a window of samples is complete and |update| should be called
+    bool add_sample(double gpu_time_ms);
+    // |dropped_frames| is the total number of dropped frames (Mpv::get_dropped_frame_count).
+    // Applies the new settings to |mpv| and returns true if the tier changed
+    bool update(Mpv &mpv, int64_t dropped_frames, double frame_budget_ms);
+    // Forgets the measured costs, for example when a different video is loaded
+    void reset();
+
+    int get_tier() const { return tier; }
+    int get_num_tiers() const;
+    const char* get_tier_name() const;
+    int64_t get_transition_count() const { return transition_count; }
+private:
+    void set_tier(Mpv &mpv, int new_tier);
+private:
+    // These can be read from other threads
+    std::atomic<int> tier;
+    std::atomic<int64_t> transition_count{0};
+
+    double window_gpu_time_sum_ms = 0.0;
+    int window_num_samples = 0;
+    int64_t window_dropped_frames_start = -1;
+    int num_bad_windows = 0;
+    int num_good_windows = 0;
+    // The average cost of each tier when it was last stepped down from, 0 if unknown
+    double tier_cost_ms[8] = {};
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+/*
+    Desktop notifications are shown by a small helper process that is forked at startup, while the
+    process is still small (before opengl, libmpv and the vr runtime are loaded). The helper reads
+    messages from a pipe and runs notify-send, which delivers them over the notification bus.
+    Forking from the render process later would have to copy its page tables and stall it.
+*/
+
+// Should be called before any other thread is started. Returns false if the helper couldn't be started,
+// notifications are then dropped
+bool notification_helper_start();
+// Closes the pipe and waits for the helper to show the remaining notifications and exit
+void notification_helper_stop();
+// Never blocks. The notification is dropped if the helper isn't running or it's behind
+void show_notification(const char *title, const char *msg, const char *urgency);
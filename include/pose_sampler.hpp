@@ -0,0 +1,46 @@
+#pragma once
+
+#include "seqlock.hpp"
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <openvr.h>
+
+struct PoseSample {
+    vr::TrackedDevicePose_t poses[vr::k_unMaxTrackedDeviceCount];
+    // How far ahead of the sample time the poses were predicted
+    float predicted_seconds;
+    // CLOCK_MONOTONIC time of the sample in microseconds
+    int64_t sample_time_us;
+};
+
+/*
+    Samples the device poses on its own thread, a few times per headset frame, predicted for the time
+    the next frame reaches the display (the next vsync plus the vsync to photons time of the headset).
+    The latest sample is published through a seqlock, so the render loop gets the freshest prediction
+    without waiting for the compositor and the sampling thread never waits for the render loop.
+*/
+class PoseSampler {
+public:
+    PoseSampler() = default;
+    ~PoseSampler();
+    PoseSampler(const PoseSampler&) = delete;
+    PoseSampler& operator=(const PoseSampler&) = delete;
+
+    // The poses are in |tracking_origin|. |vr_system| has to stay valid until |stop|
+    bool start(vr::IVRSystem *vr_system, vr::ETrackingUniverseOrigin tracking_origin);
+    void stop();
+
+    // Returns false if there hasn't been a sample yet
+    bool get_latest(PoseSample &sample) const { return latest_sample.load(sample); }
+private:
+    void run();
+private:
+    vr::IVRSystem *vr_system = nullptr;
+    vr::ETrackingUniverseOrigin tracking_origin = vr::TrackingUniverseStanding;
+    float frame_duration_seconds = 0.0f;
+    float vsync_to_photons_seconds = 0.0f;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    SeqLock<PoseSample> latest_sample;
+};
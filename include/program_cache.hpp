@@ -0,0 +1,21 @@
+#pragma once
+
+#include <GL/glew.h>
+
+/*
+    On-disk cache of linked shader program binaries (GL_ARB_get_program_binary), stored under
+    get_config_dir()/shader-cache. Entries are keyed by a hash of the shader sources and the GL
+    vendor, renderer and version strings, so a driver update or a changed shader invalidates them.
+*/
+
+/* Returns true if the current context supports program binaries */
+bool program_cache_supported();
+
+/*
+    Returns a linked program created from the cached binary for |name|, or 0 if there is no
+    cache entry, it doesn't match the sources/driver or the driver rejected it.
+*/
+GLuint program_cache_load(const char *name, const char *vertex_source, const char *fragment_source);
+
+/* |program| should have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set */
+void program_cache_save(const char *name, GLuint program, const char *vertex_source, const char *fragment_source);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+/*
+    The meshes the video is drawn on when the projection pass isn't used. They only depend on the
+    video aspect ratio and placement, so they're built on the cpu whenever those change.
+
+    Vertices are appended to |vertdata| as 5 floats each: position x, y, z and texture coordinate u, v.
+    Every 3 vertices are a triangle.
+*/
+
+// Half sphere in front of the viewer with the video stretched over it. |mat| is applied to the positions
+void scene_mesh_add_sphere(std::vector<float> &vertdata, const glm::mat4 &mat, double width_ratio, double zoom);
+void scene_mesh_add_cylinder(std::vector<float> &vertdata, double width_ratio, double zoom);
+void scene_mesh_add_flat(std::vector<float> &vertdata, double width_ratio, double zoom, bool stretch);
+// Six faces of a cube map stored as two rows of three in the video, pushed out to a sphere.
+// |texture_border_x| and |texture_border_y| are the size of the border around the faces in texture coordinates,
+// |texture_zoom| is how much of the top of each face is cut off
+void scene_mesh_add_sphere360(std::vector<float> &vertdata, double texture_border_x, double texture_border_y, double texture_zoom);
+
+// A plane of |num_columns|*|num_rows| quads from (width, height) to (-width, -height) at |depth|
+void create_segmented_plane(std::vector<float> &vertdata, float width, float height, float depth, float texture_width, float texture_height, float texture_offset_x, float texture_offset_y, int num_columns, int num_rows);
+// Moves each vertex to |depth| distance from the origin
+void plane_normalize_depth(float *vertices, size_t num_vertices, float depth);
+// Rotates each triangle around its own center
+void vertices_rotate(float *vertices, size_t num_vertices, float angle, glm::vec3 rotation_axis);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+/*
+    Latest value published by exactly one writer thread to any number of reader threads.
+    The writer never waits for the readers. A reader copies the value and retries if the writer
+    changed it in the meantime, which it can tell from |sequence| being odd (a write is in progress)
+    or different from before the copy.
+
+    The value is stored as atomic words so that a copy that races with a write is well defined,
+    it's only thrown away.
+*/
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock values are copied with memcpy");
+public:
+    // Writer only
+    void store(const T &value) {
+        uint64_t buffer[num_words] = {};
+        memcpy(buffer, &value, sizeof(T));
+
+        const uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for(size_t i = 0; i < num_words; ++i)
+            words[i].store(buffer[i], std::memory_order_relaxed);
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    // Returns false if nothing has been stored yet, |value| is unchanged then
+    bool load(T &value) const {
+        uint64_t buffer[num_words];
+        for(;;) {
+            const uint32_t seq = sequence.load(std::memory_order_acquire);
+            if(seq == 0)
+                return false;
+            if(seq & 1)
+                continue;
+
+            for(size_t i = 0; i < num_words; ++i)
+                buffer[i] = words[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(sequence.load(std::memory_order_relaxed) == seq)
+                break;
+        }
+        memcpy(&value, buffer, sizeof(T));
+        return true;
+    }
+private:
+    static constexpr size_t num_words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::atomic<uint32_t> sequence{0};
+    std::atomic<uint64_t> words[num_words] = {};
+};
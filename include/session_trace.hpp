@@ -0,0 +1,149 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+    Recording of everything the window capture main loop reads from X and the VR runtime: X events,
+    the replies of the X requests it makes (pointer position, window size, focused window, cursor image),
+    the device poses and the time of each frame. A recorded session can be replayed without the captured
+    window or a headset, to reproduce performance problems and to benchmark the main loop.
+
+    The file is a SessionTraceHeader followed by records. Each record is a SessionTraceRecordHeader
+    followed by its data, padded to 8 bytes, so the whole file can be mmapped and read in place.
+    Values are stored in the native byte order, a trace is meant to be replayed on the machine type it was
+    recorded on.
+*/
+
+enum class SessionTraceRecordType : uint32_t {
+    FRAME = 1,          // SessionTraceFrame. Ends a frame, the records since the previous FRAME belong to it
+    X_EVENT = 2,        // A raw XEvent
+    POINTER = 3,        // SessionTracePointer, the reply of XQueryPointer
+    WINDOW_SIZE = 4,    // SessionTraceWindowSize, the reply of XGetWindowAttributes
+    FOCUSED_WINDOW = 5, // uint64_t window id, 0 if no window is focused
+    CURSOR_IMAGE = 6,   // SessionTraceCursorImage followed by width*height ARGB pixels (uint32_t)
+    POSES = 7           // uint32_t number of poses, uint32_t padding, followed by the SessionTracePose of each valid pose
+};
+
+// Headset properties the renderer needs, recorded once at the start so that a replay renders the same views
+struct SessionTraceHmdInfo {
+    uint32_t render_width;
+    uint32_t render_height;
+    float display_frequency;
+    // Left, right, top, bottom tangents of the left eye (IVRSystem::GetProjectionRaw)
+    float projection_raw_left[4];
+    // Per eye, row major like vr::HmdMatrix44_t and vr::HmdMatrix34_t
+    float projection[2][4][4];
+    float eye_to_head[2][3][4];
+    float seated_to_standing[3][4];
+};
+
+struct SessionTraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t x_event_size;
+    uint64_t src_window_id;
+    int64_t start_time_us;
+    SessionTraceHmdInfo hmd_info;
+};
+
+struct SessionTraceRecordHeader {
+    SessionTraceRecordType type;
+    // Size of the data, without the padding
+    uint32_t size;
+    // Microseconds since the start of the recording
+    int64_t time_us;
+};
+
+struct SessionTraceFrame {
+    uint64_t frame_index;
+    // SESSION_TRACE_FRAME_* flags
+    uint32_t flags;
+    uint32_t padding;
+};
+
+// The reset rotation action was triggered with a controller in this frame
+#define SESSION_TRACE_FRAME_RESET_ROTATION 0x1
+
+struct SessionTracePointer {
+    int32_t x;
+    int32_t y;
+};
+
+struct SessionTraceWindowSize {
+    int32_t width;
+    int32_t height;
+    // 0 if XGetWindowAttributes failed
+    int32_t valid;
+    int32_t padding;
+};
+
+struct SessionTraceCursorImage {
+    uint32_t width;
+    uint32_t height;
+    int32_t xhot;
+    int32_t yhot;
+};
+
+struct SessionTracePose {
+    uint32_t device_index;
+    // vr::ETrackedDeviceClass
+    uint32_t device_class;
+    float device_to_absolute_tracking[3][4];
+};
+
+class SessionTraceWriter {
+public:
+    SessionTraceWriter() = default;
+    ~SessionTraceWriter();
+    SessionTraceWriter(const SessionTraceWriter&) = delete;
+    SessionTraceWriter& operator=(const SessionTraceWriter&) = delete;
+
+    bool open(const char *filepath, uint64_t src_window_id, uint32_t x_event_size, const SessionTraceHmdInfo &hmd_info);
+    // Flushes the trace. Returns false if any write failed
+    bool close();
+    bool is_open() const { return file != nullptr; }
+
+    // Should be called at the end of each frame, after everything that was read for it has been written
+    void end_frame(uint32_t flags);
+    // |extra_data| is appended to |data| in the same record, for records with a header and an array
+    void write(SessionTraceRecordType type, const void *data, size_t size, const void *extra_data = nullptr, size_t extra_size = 0);
+private:
+    FILE *file = nullptr;
+    std::string filepath;
+    int64_t start_time_us = 0;
+    uint64_t frame_index = 0;
+    bool write_failed = false;
+};
+
+class SessionTraceReader {
+public:
+    SessionTraceReader() = default;
+    ~SessionTraceReader();
+    SessionTraceReader(const SessionTraceReader&) = delete;
+    SessionTraceReader& operator=(const SessionTraceReader&) = delete;
+
+    // |x_event_size| has to match the size the trace was recorded with
+    bool open(const char *filepath, uint32_t x_event_size);
+    void close();
+
+    const SessionTraceHeader& get_header() const { return *header; }
+    // Moves to the next frame. Returns false at the end of the trace. |time_us| is when the frame ended in the recording
+    bool next_frame(SessionTraceFrame &frame, int64_t &time_us);
+    // Returns the data of the next record of |type| in the current frame that hasn't been taken yet,
+    // or nullptr if there is none. Records of a type are returned in the order they were recorded
+    const void* take(SessionTraceRecordType type, size_t &size);
+    uint64_t get_num_frames() const { return num_frames; }
+private:
+    const uint8_t *data = nullptr;
+    size_t data_size = 0;
+    // The end of the last complete record
+    size_t records_end = 0;
+    const SessionTraceHeader *header = nullptr;
+    size_t next_offset = 0;
+    uint64_t num_frames = 0;
+    std::vector<const SessionTraceRecordHeader*> frame_records;
+};
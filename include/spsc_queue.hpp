@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+
+/*
+    Bounded lock-free queue for exactly one producer thread and one consumer thread.
+    |push| is only called by the producer and |pop| only by the consumer. Neither blocks;
+    they return false when the queue is full or empty.
+
+    The producer owns |tail| and the consumer owns |head|. Each side only reads the other
+    side's index to check for space (or items), and both are on their own cache line so the
+    two threads don't invalidate each other's line on every operation.
+*/
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "SpscQueue capacity has to be a power of two");
+public:
+    // Producer only
+    bool push(const T &item) {
+        const size_t tail_index = tail.load(std::memory_order_relaxed);
+        if(tail_index - cached_head >= Capacity) {
+            cached_head = head.load(std::memory_order_acquire);
+            if(tail_index - cached_head >= Capacity)
+                return false;
+        }
+
+        items[tail_index & (Capacity - 1)] = item;
+        tail.store(tail_index + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only
+    bool pop(T &item) {
+        const size_t head_index = head.load(std::memory_order_relaxed);
+        if(head_index == cached_tail) {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if(head_index == cached_tail)
+                return false;
+        }
+
+        item = items[head_index & (Capacity - 1)];
+        head.store(head_index + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer only. The number of items that haven't been popped yet, which can be higher than
+    // the real number if the consumer has popped items since the last call
+    size_t size_for_producer() const {
+        return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+private:
+    alignas(64) std::atomic<size_t> head{0};
+    // The consumer's copy of |tail|, so it only has to read |tail| when the queue looks empty
+    size_t cached_tail = 0;
+
+    alignas(64) std::atomic<size_t> tail{0};
+    // The producer's copy of |head|, so it only has to read |head| when the queue looks full
+    size_t cached_head = 0;
+
+    alignas(64) T items[Capacity];
+};
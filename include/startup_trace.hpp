@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+    Records the phases of the startup sequence from any thread, so that it's visible which phases
+    run in parallel and which ones are on the critical path to the first submitted frame.
+    The recording can be written in the chrome trace event format, which can be opened in
+    chrome://tracing or https://ui.perfetto.dev.
+*/
+
+/* Should be called once at the start of main. All timestamps are relative to this call */
+void startup_trace_init();
+/* Microseconds since startup_trace_init */
+int64_t startup_trace_now_us();
+/* Milliseconds since startup_trace_init */
+double startup_trace_elapsed_ms();
+
+/* Records a phase on the calling thread that started at |start_us| and ends now */
+void startup_trace_add(const char *name, int64_t start_us);
+/* Records an instant event on the calling thread */
+void startup_trace_mark(const char *name);
+/* Names the calling thread in the trace */
+void startup_trace_set_thread_name(const char *name);
+
+/* Returns false if the file could not be written */
+bool startup_trace_write(const char *filepath);
+
+class StartupTraceScope {
+public:
+    StartupTraceScope(const char *name) : name(name), start_us(startup_trace_now_us()) {}
+    ~StartupTraceScope() { startup_trace_add(name, start_us); }
+    StartupTraceScope(const StartupTraceScope&) = delete;
+    StartupTraceScope& operator=(const StartupTraceScope&) = delete;
+private:
+    const char *name;
+    int64_t start_us;
+};
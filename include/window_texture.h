@@ -23,12 +23,25 @@ typedef struct {
 int window_texture_init(WindowTexture *window_texture, Display *display, Window window);
 void window_texture_deinit(WindowTexture *self);
 
+/*
+    Creates a gray texture of the given size that isn't bound to a window, for replaying a recorded
+    session after the window is gone. Deinit with window_texture_deinit. Returns 0 on success.
+*/
+int window_texture_init_placeholder(WindowTexture *window_texture, int width, int height);
+
 /*
     This should ONLY be called when the target window is resized.
     Returns 0 on success.
 */
 int window_texture_on_resize(WindowTexture *self);
 
+/*
+    Binds the window pixmap to the texture again. Some opengl implementations copy the pixmap when it's
+    bound instead of sharing it (Mesa without a gpu, for example under Xvfb), the texture only shows
+    later changes to the window after this. Returns 0 on success.
+*/
+int window_texture_refresh(WindowTexture *self);
+
 GLuint window_texture_get_opengl_texture_id(WindowTexture *self);
 
 #ifdef __cplusplus
@@ -0,0 +1,329 @@
+#include "../include/control_socket.hpp"
+#include "../include/event_loop.hpp"
+#include "../include/metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <algorithm>
+
+// A client that sends a longer line than this is disconnected
+static const size_t max_line_size = 4096;
+// At most this much is read from a client per callback. Its fd is level-triggered, so the rest is read in the next callback
+static const size_t max_read_size = 16 * max_line_size;
+static const size_t max_latency_samples = 1000;
+
+static int64_t get_monotonic_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
+}
+
+static bool socket_address_from_path(const std::string &path, struct sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: control socket path is too long: %s\n", path.c_str());
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// A socket file without a process listening on it is left behind when the player is killed
+static bool is_socket_in_use(const struct sockaddr_un &addr) {
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd == -1)
+        return false;
+    const bool in_use = connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == 0;
+    close(fd);
+    return in_use;
+}
+
+std::string control_socket_get_default_path() {
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if(runtime_dir && runtime_dir[0] != '\0')
+        return std::string(runtime_dir) + "/vr-video-player.sock";
+    return "/tmp/vr-video-player-" + std::to_string(getuid()) + ".sock";
+}
+
+ControlSocket::~ControlSocket() {
+    destroy();
+}
+
+bool ControlSocket::create(const std::string &path, EventLoop &event_loop) {
+    if(listen_fd != -1)
+        return false;
+
+    struct sockaddr_un addr;
+    if(!socket_address_from_path(path, addr))
+        return false;
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(listen_fd == -1) {
+        fprintf(stderr, "Error: failed to create control socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    int bind_result = bind(listen_fd, (const struct sockaddr*)&addr, sizeof(addr));
+    if(bind_result == -1 && errno == EADDRINUSE) {
+        if(is_socket_in_use(addr)) {
+            fprintf(stderr, "Error: another vr-video-player is already listening on %s\n", path.c_str());
+            close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        unlink(path.c_str());
+        bind_result = bind(listen_fd, (const struct sockaddr*)&addr, sizeof(addr));
+    }
+
+    if(bind_result == -1 || listen(listen_fd, 8) == -1) {
+        fprintf(stderr, "Error: failed to listen on control socket %s: %s\n", path.c_str(), strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    // Only the user running the player can send it commands
+    chmod(path.c_str(), 0600);
+
+    this->event_loop = &event_loop;
+    this->path = path;
+    if(!event_loop.add_fd(listen_fd, [this]{ accept_clients(); })) {
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+void ControlSocket::destroy() {
+    while(!clients.empty()) {
+        close_client(clients.back().id);
+    }
+
+    if(listen_fd != -1) {
+        if(event_loop)
+            event_loop->remove_fd(listen_fd);
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(path.c_str());
+    }
+
+    pending_commands.clear();
+    event_loop = nullptr;
+}
+
+void ControlSocket::take_commands(std::vector<ControlCommand> &commands) {
+    commands.clear();
+    std::swap(commands, pending_commands);
+}
+
+void ControlSocket::reply_ok(const ControlCommand &command, const std::string &result) {
+    const double latency_ms = (get_monotonic_time_us() - command.receive_time_us) / 1000.0;
+    if(latencies_ms.size() < max_latency_samples) {
+        latencies_ms.push_back(latency_ms);
+    } else {
+        latencies_ms[latency_index] = latency_ms;
+        latency_index = (latency_index + 1) % max_latency_samples;
+    }
+    ++command_count;
+
+    static MetricsHistogram *latency_metric = metrics_latency_histogram("vrvp_control_command_latency_seconds", "Time from when a control socket command was received to when it was applied");
+    metrics_histogram_observe(latency_metric, latency_ms / 1000.0);
+
+    char latency_str[64];
+    snprintf(latency_str, sizeof(latency_str), "latency=%.3f", latency_ms);
+    if(result.empty())
+        write_line(command.client_id, std::string("ok ") + latency_str);
+    else
+        write_line(command.client_id, "ok " + result + " " + latency_str);
+    command_replied(command.client_id);
+}
+
+void ControlSocket::reply_error(const ControlCommand &command, const char *message) {
+    write_line(command.client_id, std::string("error ") + message);
+    command_replied(command.client_id);
+}
+
+void ControlSocket::command_replied(uint64_t client_id) {
+    Client *client = get_client(client_id);
+    if(!client)
+        return;
+
+    --client->pending_replies;
+    if(client->read_closed && client->pending_replies <= 0)
+        close_client(client_id);
+}
+
+double ControlSocket::get_latency_percentile_ms(double percentile) const {
+    if(latencies_ms.empty())
+        return 0.0;
+
+    std::vector<double> sorted_latencies = latencies_ms;
+    std::sort(sorted_latencies.begin(), sorted_latencies.end());
+    return sorted_latencies[std::min(sorted_latencies.size() - 1, (size_t)(percentile * sorted_latencies.size()))];
+}
+
+void ControlSocket::accept_clients() {
+    while(true) {
+        const int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(client_fd == -1)
+            break;
+
+        const uint64_t client_id = next_client_id++;
+        if(!event_loop->add_fd(client_fd, [this, client_id]{ read_client(client_id); })) {
+            close(client_fd);
+            continue;
+        }
+        clients.push_back({ client_id, client_fd, std::string(), 0, false });
+    }
+}
+
+void ControlSocket::read_client(uint64_t client_id) {
+    Client *client = get_client(client_id);
+    if(!client)
+        return;
+
+    const int64_t receive_time_us = get_monotonic_time_us();
+    // Scripts often send a command and close their end right away (echo seek 10 | socat - UNIX-CONNECT:...),
+    // so the commands that were received before the end are still run and replied to
+    bool disconnected = false;
+    char buffer[4096];
+    size_t total_bytes_read = 0;
+    while(total_bytes_read < max_read_size) {
+        const ssize_t bytes_read = read(client->fd, buffer, sizeof(buffer));
+        if(bytes_read == -1 && errno == EINTR)
+            continue;
+        if(bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if(bytes_read <= 0) {
+            disconnected = true;
+            if(!client->buffer.empty() && client->buffer.back() != '\n')
+                client->buffer += '\n';
+            break;
+        }
+        client->buffer.append(buffer, bytes_read);
+        total_bytes_read += bytes_read;
+
+        // Checked as the data arrives, so a client can't make the buffer grow without a bound by never sending a newline
+        const size_t last_newline = client->buffer.rfind('\n');
+        const size_t partial_line_size = last_newline == std::string::npos ? client->buffer.size() : client->buffer.size() - last_newline - 1;
+        if(partial_line_size > max_line_size) {
+            write_line(client_id, "error line too long");
+            close_client(client_id);
+            return;
+        }
+    }
+
+    size_t line_start = 0;
+    while(true) {
+        const size_t line_end = client->buffer.find('\n', line_start);
+        if(line_end == std::string::npos)
+            break;
+        parse_line(*client, client->buffer.substr(line_start, line_end - line_start), receive_time_us);
+        line_start = line_end + 1;
+    }
+    client->buffer.erase(0, line_start);
+
+    if(disconnected) {
+        // The socket stays readable at the end, so it's only kept open to write the replies
+        client->read_closed = true;
+        event_loop->remove_fd(client->fd);
+        if(client->pending_replies <= 0)
+            close_client(client_id);
+    }
+}
+
+void ControlSocket::close_client(uint64_t client_id) {
+    auto it = std::find_if(clients.begin(), clients.end(), [client_id](const Client &client) { return client.id == client_id; });
+    if(it == clients.end())
+        return;
+
+    event_loop->remove_fd(it->fd);
+    close(it->fd);
+    clients.erase(it);
+}
+
+void ControlSocket::parse_line(Client &client, const std::string &line, int64_t receive_time_us) {
+    std::string name = line;
+    if(!name.empty() && name.back() == '\r')
+        name.pop_back();
+
+    std::string argument;
+    const size_t space_index = name.find(' ');
+    if(space_index != std::string::npos) {
+        argument = name.substr(space_index + 1);
+        name.erase(space_index);
+    }
+
+    if(name.empty())
+        return;
+
+    ControlCommand command;
+    command.client_id = client.id;
+    command.receive_time_us = receive_time_us;
+
+    const bool has_argument = !argument.empty();
+    char *endptr = nullptr;
+    const double number = has_argument ? strtod(argument.c_str(), &endptr) : 0.0;
+    const bool valid_number = has_argument && endptr && *endptr == '\0';
+
+    if(name == "seek" && valid_number) {
+        command.type = ControlCommandType::SEEK;
+        command.value = number;
+    } else if(name == "zoom" && valid_number) {
+        command.type = ControlCommandType::ZOOM;
+        command.value = number;
+    } else if(name == "load" && !argument.empty()) {
+        command.type = ControlCommandType::LOAD;
+        command.path = argument;
+    } else if(name == "pause" && !has_argument) {
+        command.type = ControlCommandType::PAUSE;
+    } else if(name == "resume" && !has_argument) {
+        command.type = ControlCommandType::RESUME;
+    } else if(name == "toggle-pause" && !has_argument) {
+        command.type = ControlCommandType::TOGGLE_PAUSE;
+    } else if(name == "zoom-in" && !has_argument) {
+        command.type = ControlCommandType::ZOOM_IN;
+    } else if(name == "zoom-out" && !has_argument) {
+        command.type = ControlCommandType::ZOOM_OUT;
+    } else if(name == "reset" && !has_argument) {
+        command.type = ControlCommandType::RESET;
+    } else if(name == "next" && !has_argument) {
+        command.type = ControlCommandType::NEXT;
+    } else if(name == "prev" && !has_argument) {
+        command.type = ControlCommandType::PREV;
+    } else if(name == "state" && !has_argument) {
+        command.type = ControlCommandType::STATE;
+    } else {
+        write_line(client.id, "error invalid command: " + line);
+        return;
+    }
+
+    ++client.pending_replies;
+    pending_commands.push_back(std::move(command));
+}
+
+void ControlSocket::write_line(uint64_t client_id, const std::string &line) {
+    Client *client = get_client(client_id);
+    if(!client)
+        return;
+
+    // Replies are small, a client that doesn't read them doesn't get them. A client that has gone away
+    // is closed when reading from it fails, or after its last reply if it only closed its end
+    const std::string data = line + "\n";
+    ssize_t bytes_written = send(client->fd, data.data(), data.size(), MSG_NOSIGNAL);
+    (void)bytes_written;
+}
+
+ControlSocket::Client* ControlSocket::get_client(uint64_t client_id) {
+    for(Client &client : clients) {
+        if(client.id == client_id)
+            return &client;
+    }
+    return nullptr;
+}
@@ -0,0 +1,18 @@
+#include "../include/cursor_image.hpp"
+
+void cursor_unpremultiply_alpha(const unsigned long *pixels, int width, int height, uint8_t *out) {
+    for(int y = 0; y < height; ++y) {
+        for(int x = 0; x < width; ++x) {
+            uint32_t pixel = *pixels++;
+            uint8_t *in = (uint8_t*)&pixel;
+            uint8_t alpha = in[3];
+            if(alpha == 0)
+                alpha = 1;
+
+            *out++ = (unsigned)*in++ * 255/alpha;
+            *out++ = (unsigned)*in++ * 255/alpha;
+            *out++ = (unsigned)*in++ * 255/alpha;
+            *out++ = *in++;
+        }
+    }
+}
@@ -0,0 +1,184 @@
+#include "../include/event_loop.hpp"
+#include "../include/metrics.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <algorithm>
+
+static const int64_t stats_interval_us = 60 * 1000000LL;
+
+static int64_t get_monotonic_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
+}
+
+static int64_t get_thread_cpu_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
+}
+
+static struct timespec us_to_timespec(int64_t time_us) {
+    struct timespec ts;
+    ts.tv_sec = time_us / 1000000LL;
+    ts.tv_nsec = (time_us % 1000000LL) * 1000LL;
+    return ts;
+}
+
+EventLoop::~EventLoop() {
+    if(epoll_fd != -1)
+        close(epoll_fd);
+}
+
+bool EventLoop::create() {
+    if(epoll_fd != -1)
+        return false;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd == -1) {
+        fprintf(stderr, "Error: epoll_create1 failed: %s\n", strerror(errno));
+        return false;
+    }
+
+    stats_start_time_us = get_monotonic_time_us();
+    stats_start_cpu_time_us = get_thread_cpu_time_us();
+    return true;
+}
+
+bool EventLoop::add_fd(int fd, Callback callback) {
+    if(epoll_fd == -1 || fd == -1)
+        return false;
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        fprintf(stderr, "Error: failed to add fd %d to epoll: %s\n", fd, strerror(errno));
+        return false;
+    }
+
+    sources.push_back({ fd, std::move(callback) });
+    return true;
+}
+
+void EventLoop::remove_fd(int fd) {
+    auto it = std::find_if(sources.begin(), sources.end(), [fd](const Source &source) { return source.fd == fd; });
+    if(it == sources.end())
+        return;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    sources.erase(it);
+}
+
+bool EventLoop::wait(int timeout_ms) {
+    if(epoll_fd == -1)
+        return false;
+
+    struct epoll_event events[16];
+    const int num_events = epoll_wait(epoll_fd, events, 16, timeout_ms);
+    if(num_events == -1) {
+        if(errno == EINTR)
+            return true;
+        fprintf(stderr, "Error: epoll_wait failed: %s\n", strerror(errno));
+        return false;
+    }
+
+    ++num_wakeups;
+    for(int i = 0; i < num_events; ++i) {
+        // Looked up for every event since a callback can remove sources
+        const int fd = events[i].data.fd;
+        auto it = std::find_if(sources.begin(), sources.end(), [fd](const Source &source) { return source.fd == fd; });
+        if(it != sources.end()) {
+            Callback callback = it->callback;
+            callback();
+        }
+    }
+    return true;
+}
+
+void EventLoop::add_latency_sample(double latency_ms) {
+    static MetricsHistogram *latency_metric = metrics_latency_histogram("vrvp_event_loop_wake_latency_seconds", "Time from when a timer expired or mpv signaled the main thread to when it was handled");
+    metrics_histogram_observe(latency_metric, latency_ms / 1000.0);
+    latencies_ms.push_back(latency_ms);
+}
+
+void EventLoop::update_stats() {
+    const int64_t now_us = get_monotonic_time_us();
+    const int64_t elapsed_us = now_us - stats_start_time_us;
+    if(epoll_fd == -1 || elapsed_us < stats_interval_us)
+        return;
+
+    const int64_t cpu_time_us = get_thread_cpu_time_us();
+    const double cpu_percent = 100.0 * (double)(cpu_time_us - stats_start_cpu_time_us) / (double)elapsed_us;
+    if(latencies_ms.empty()) {
+        fprintf(stderr, "Event loop: %.1f%% cpu, %.1f wakeups per second\n", cpu_percent, num_wakeups / (elapsed_us / 1000000.0));
+    } else {
+        std::sort(latencies_ms.begin(), latencies_ms.end());
+        auto percentile = [this](double p) {
+            return latencies_ms[std::min(latencies_ms.size() - 1, (size_t)(p * latencies_ms.size()))];
+        };
+        fprintf(stderr, "Event loop: %.1f%% cpu, %.1f wakeups per second, wake to handle latency p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+            cpu_percent, num_wakeups / (elapsed_us / 1000000.0), percentile(0.5), percentile(0.99), latencies_ms.back());
+    }
+
+    latencies_ms.clear();
+    num_wakeups = 0;
+    stats_start_time_us = now_us;
+    stats_start_cpu_time_us = cpu_time_us;
+}
+
+int event_loop_create_timer(int64_t interval_us) {
+    const int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(timer_fd == -1) {
+        fprintf(stderr, "Error: timerfd_create failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if(!event_loop_set_timer_interval(timer_fd, interval_us)) {
+        close(timer_fd);
+        return -1;
+    }
+    return timer_fd;
+}
+
+bool event_loop_set_timer_interval(int timer_fd, int64_t interval_us) {
+    struct itimerspec timer_spec;
+    timer_spec.it_interval = us_to_timespec(interval_us);
+    timer_spec.it_value = us_to_timespec(interval_us);
+    if(timerfd_settime(timer_fd, 0, &timer_spec, nullptr) == -1) {
+        fprintf(stderr, "Error: timerfd_settime failed: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+uint64_t event_loop_read_timer(int timer_fd, double &latency_ms) {
+    latency_ms = 0.0;
+
+    uint64_t expirations = 0;
+    if(read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return 0;
+
+    // The time since the last expiration is the interval minus the time left until the next one
+    struct itimerspec timer_spec;
+    if(timerfd_gettime(timer_fd, &timer_spec) == 0) {
+        const int64_t interval_us = timer_spec.it_interval.tv_sec * 1000000LL + timer_spec.it_interval.tv_nsec / 1000LL;
+        const int64_t remaining_us = timer_spec.it_value.tv_sec * 1000000LL + timer_spec.it_value.tv_nsec / 1000LL;
+        latency_ms = std::max((int64_t)0, interval_us - remaining_us) / 1000.0;
+    }
+    return expirations;
+}
+
+int event_loop_create_signalfd(const sigset_t &mask) {
+    const int signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(signal_fd == -1)
+        fprintf(stderr, "Error: signalfd failed: %s\n", strerror(errno));
+    return signal_fd;
+}
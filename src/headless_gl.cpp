@@ -0,0 +1,121 @@
+#include "../include/headless_gl.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+static bool has_extension(const char *extensions, const char *name) {
+    if(!extensions)
+        return false;
+
+    const size_t name_len = strlen(name);
+    const char *p = extensions;
+    while((p = strstr(p, name)) != nullptr) {
+        if((p == extensions || p[-1] == ' ') && (p[name_len] == ' ' || p[name_len] == '\0'))
+            return true;
+        p += name_len;
+    }
+    return false;
+}
+
+static EGLDisplay get_surfaceless_display() {
+    const char *client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if(!has_extension(client_extensions, "EGL_MESA_platform_surfaceless")) {
+        fprintf(stderr, "Error: EGL_MESA_platform_surfaceless is not supported, a mesa driver is needed\n");
+        return EGL_NO_DISPLAY;
+    }
+
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if(!get_platform_display) {
+        fprintf(stderr, "Error: eglGetPlatformDisplayEXT is not available\n");
+        return EGL_NO_DISPLAY;
+    }
+    return get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+}
+
+HeadlessGlContext::~HeadlessGlContext() {
+    destroy();
+}
+
+bool HeadlessGlContext::create(int major, int minor) {
+    if(context)
+        return false;
+
+    EGLDisplay egl_display = get_surfaceless_display();
+    if(egl_display == EGL_NO_DISPLAY)
+        return false;
+
+    EGLint egl_major = 0;
+    EGLint egl_minor = 0;
+    if(!eglInitialize(egl_display, &egl_major, &egl_minor)) {
+        fprintf(stderr, "Error: eglInitialize failed: 0x%x\n", eglGetError());
+        return false;
+    }
+    display = egl_display;
+
+    if(!has_extension(eglQueryString(egl_display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+        fprintf(stderr, "Error: EGL_KHR_surfaceless_context is not supported\n");
+        destroy();
+        return false;
+    }
+
+    if(!eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr, "Error: desktop opengl is not supported by egl\n");
+        destroy();
+        return false;
+    }
+
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint num_configs = 0;
+    if(!eglChooseConfig(egl_display, config_attribs, &config, 1, &num_configs) || num_configs == 0) {
+        fprintf(stderr, "Error: no egl config supports opengl\n");
+        destroy();
+        return false;
+    }
+
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, major,
+        EGL_CONTEXT_MINOR_VERSION, minor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext egl_context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, context_attribs);
+    if(egl_context == EGL_NO_CONTEXT) {
+        fprintf(stderr, "Error: failed to create an opengl %d.%d context: 0x%x\n", major, minor, eglGetError());
+        destroy();
+        return false;
+    }
+    context = egl_context;
+
+    if(!eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl_context)) {
+        fprintf(stderr, "Error: failed to make the headless context current: 0x%x\n", eglGetError());
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+void HeadlessGlContext::destroy() {
+    if(!display)
+        return;
+
+    eglMakeCurrent((EGLDisplay)display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if(context) {
+        eglDestroyContext((EGLDisplay)display, (EGLContext)context);
+        context = nullptr;
+    }
+    eglTerminate((EGLDisplay)display);
+    display = nullptr;
+}
@@ -0,0 +1,128 @@
+#include "../include/keyframe_index.hpp"
+#include "../include/config.hpp"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+// Keyframes closer than this are considered the same keyframe. Timestamps reported after a seek can be slightly off
+static const double same_keyframe_epsilon = 0.001;
+
+static uint64_t fnv1a_hash(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *p = (const unsigned char*)data;
+    for(size_t i = 0; i < size; ++i) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static std::string keyframe_index_get_path(const char *filepath) {
+    uint64_t hash = 14695981039346656037ULL;
+    hash = fnv1a_hash(hash, filepath, strlen(filepath));
+
+    // Urls and other non-files are only keyed by the path
+    struct stat st;
+    if(stat(filepath, &st) == 0) {
+        const int64_t size = st.st_size;
+        const int64_t mtime = st.st_mtime;
+        hash = fnv1a_hash(hash, &size, sizeof(size));
+        hash = fnv1a_hash(hash, &mtime, sizeof(mtime));
+    }
+
+    char filename[32];
+    snprintf(filename, sizeof(filename), "%016llx", (unsigned long long)hash);
+    return get_config_dir() + "/keyframe-cache/" + filename;
+}
+
+void KeyframeIndex::open(const char *filepath) {
+    save();
+
+    cache_path = keyframe_index_get_path(filepath);
+    keyframes.clear();
+    dirty = false;
+
+    std::string file_content;
+    if(!file_get_content(cache_path.c_str(), file_content))
+        return;
+
+    const char *p = file_content.c_str();
+    while(*p) {
+        char *end = nullptr;
+        const double position = strtod(p, &end);
+        if(end == p)
+            break;
+        if(position >= 0.0)
+            keyframes.push_back(position);
+        p = end;
+    }
+
+    std::sort(keyframes.begin(), keyframes.end());
+}
+
+void KeyframeIndex::save() {
+    if(!dirty || cache_path.empty())
+        return;
+    dirty = false;
+
+    char dir_tmp[PATH_MAX];
+    snprintf(dir_tmp, sizeof(dir_tmp), "%s", cache_path.c_str());
+    char *dir = dirname(dir_tmp);
+    if(create_directory_recursive(dir) != 0) {
+        fprintf(stderr, "Warning: Failed to create keyframe cache directory: %s\n", dir);
+        return;
+    }
+
+    // Write to a temporary file and rename it so that a crash never leaves a truncated index
+    const std::string tmp_path = cache_path + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if(!file) {
+        fprintf(stderr, "Warning: Failed to create keyframe cache file: %s\n", tmp_path.c_str());
+        return;
+    }
+
+    bool success = true;
+    for(double keyframe : keyframes) {
+        if(fprintf(file, "%.6f\n", keyframe) < 0)
+            success = false;
+    }
+    success = fclose(file) == 0 && success;
+
+    if(!success || rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+        fprintf(stderr, "Warning: Failed to write keyframe cache file: %s\n", cache_path.c_str());
+        remove(tmp_path.c_str());
+    }
+}
+
+void KeyframeIndex::add(double position) {
+    if(position < 0.0 || cache_path.empty())
+        return;
+
+    auto it = std::lower_bound(keyframes.begin(), keyframes.end(), position - same_keyframe_epsilon);
+    if(it != keyframes.end() && fabs(*it - position) <= same_keyframe_epsilon)
+        return;
+
+    keyframes.insert(it, position);
+    dirty = true;
+}
+
+bool KeyframeIndex::find_nearest(double target, double max_distance, double &keyframe) const {
+    auto it = std::lower_bound(keyframes.begin(), keyframes.end(), target);
+    double best_distance = max_distance;
+    bool found = false;
+
+    if(it != keyframes.end() && fabs(*it - target) <= best_distance) {
+        best_distance = fabs(*it - target);
+        keyframe = *it;
+        found = true;
+    }
+
+    if(it != keyframes.begin() && fabs(*(it - 1) - target) <= best_distance) {
+        keyframe = *(it - 1);
+        found = true;
+    }
+
+    return found;
+}
@@ -0,0 +1,166 @@
+#include "../include/latency_probe.hpp"
+#include <stdio.h>
+#include <time.h>
+
+// The window switches between these sizes
+static const int window_sizes[2][2] = { { 640, 360 }, { 800, 450 } };
+static const int64_t resize_interval_us = 4 * 1000000LL;
+
+static uint32_t latency_probe_check_value(uint32_t frame, int64_t time_us) {
+    return frame ^ (uint32_t)time_us ^ (uint32_t)((uint64_t)time_us >> 32) ^ 0xa5a5a5a5u;
+}
+
+int64_t latency_probe_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
+}
+
+bool latency_probe_decode(const uint8_t *rgba_row, int width, LatencyProbeFrame &frame) {
+    if(width < LATENCY_PROBE_NUM_CELLS * LATENCY_PROBE_CELL_SIZE)
+        return false;
+
+    uint64_t bits[2] = { 0, 0 };
+    for(int i = 0; i < LATENCY_PROBE_NUM_CELLS; ++i) {
+        const uint8_t *pixel = rgba_row + (i * LATENCY_PROBE_CELL_SIZE + LATENCY_PROBE_CELL_SIZE / 2) * 4;
+        // Anything between black and white means that the texture was filtered or read mid-draw
+        const int brightness = ((int)pixel[0] + (int)pixel[1] + (int)pixel[2]) / 3;
+        if(brightness > 64 && brightness < 192)
+            return false;
+        if(brightness >= 192)
+            bits[i / 64] |= 1ULL << (i % 64);
+    }
+
+    frame.frame = (uint32_t)bits[0];
+    frame.time_us = (int64_t)((bits[0] >> 32) | (bits[1] << 32));
+    return (uint32_t)(bits[1] >> 32) == latency_probe_check_value(frame.frame, frame.time_us);
+}
+
+LatencyProbeWindow::~LatencyProbeWindow() {
+    destroy();
+}
+
+bool LatencyProbeWindow::create(int frames_per_second) {
+    if(display)
+        return false;
+
+    display = XOpenDisplay(nullptr);
+    if(!display) {
+        fprintf(stderr, "Error: latency probe: failed to open x display\n");
+        return false;
+    }
+
+    const int screen = DefaultScreen(display);
+    black_pixel = BlackPixel(display, screen);
+    white_pixel = WhitePixel(display, screen);
+    window = XCreateSimpleWindow(display, DefaultRootWindow(display), 0, 0, window_sizes[0][0], window_sizes[0][1], 0, black_pixel, black_pixel);
+    if(!window) {
+        fprintf(stderr, "Error: latency probe: failed to create window\n");
+        destroy();
+        return false;
+    }
+    XStoreName(display, window, "vr-video-player latency probe");
+    gc = XCreateGC(display, window, 0, nullptr);
+
+    // The window can only be captured once it's mapped
+    XSelectInput(display, window, StructureNotifyMask);
+    XMapWindow(display, window);
+    XEvent xev;
+    do {
+        XWindowEvent(display, window, StructureNotifyMask, &xev);
+    } while(xev.type != MapNotify);
+    XSelectInput(display, window, NoEventMask);
+
+    this->frames_per_second = frames_per_second;
+    running = true;
+    thread = std::thread([this]{ run(); });
+    return true;
+}
+
+void LatencyProbeWindow::destroy() {
+    running = false;
+    if(thread.joinable())
+        thread.join();
+
+    if(gc) {
+        XFreeGC(display, gc);
+        gc = None;
+    }
+
+    if(window) {
+        XDestroyWindow(display, window);
+        window = None;
+    }
+
+    if(display) {
+        XCloseDisplay(display);
+        display = nullptr;
+    }
+}
+
+std::vector<LatencyProbeFrame> LatencyProbeWindow::get_resize_frames() {
+    std::lock_guard<std::mutex> lock(resize_frames_mutex);
+    return resize_frames;
+}
+
+void LatencyProbeWindow::run() {
+    const int64_t frame_interval_ns = 1000000000LL / frames_per_second;
+    struct timespec next_frame_time;
+    clock_gettime(CLOCK_MONOTONIC, &next_frame_time);
+
+    int64_t next_resize_time_us = latency_probe_time_us() + resize_interval_us;
+    int size_index = 0;
+    bool resized = false;
+    uint32_t frame = 0;
+    while(running) {
+        if(latency_probe_time_us() >= next_resize_time_us) {
+            size_index = (size_index + 1) % 2;
+            XResizeWindow(display, window, window_sizes[size_index][0], window_sizes[size_index][1]);
+            next_resize_time_us += resize_interval_us;
+            resized = true;
+        }
+
+        ++frame;
+        const int64_t time_us = draw_frame(frame);
+        num_frames_drawn = frame;
+        if(resized) {
+            std::lock_guard<std::mutex> lock(resize_frames_mutex);
+            resize_frames.push_back({ frame, time_us });
+            resized = false;
+        }
+
+        next_frame_time.tv_nsec += frame_interval_ns;
+        while(next_frame_time.tv_nsec >= 1000000000L) {
+            next_frame_time.tv_nsec -= 1000000000L;
+            ++next_frame_time.tv_sec;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_frame_time, nullptr);
+    }
+}
+
+int64_t LatencyProbeWindow::draw_frame(uint32_t frame) {
+    const int64_t time_us = latency_probe_time_us();
+    const uint64_t bits[2] = {
+        (uint64_t)frame | ((uint64_t)time_us << 32),
+        ((uint64_t)time_us >> 32) | ((uint64_t)latency_probe_check_value(frame, time_us) << 32)
+    };
+
+    XRectangle cells[2][LATENCY_PROBE_NUM_CELLS];
+    int num_cells[2] = { 0, 0 };
+    for(int i = 0; i < LATENCY_PROBE_NUM_CELLS; ++i) {
+        const int bit = (bits[i / 64] >> (i % 64)) & 1;
+        XRectangle &cell = cells[bit][num_cells[bit]++];
+        cell.x = i * LATENCY_PROBE_CELL_SIZE;
+        cell.y = 0;
+        cell.width = LATENCY_PROBE_CELL_SIZE;
+        cell.height = LATENCY_PROBE_CELL_SIZE;
+    }
+
+    XSetForeground(display, gc, black_pixel);
+    XFillRectangles(display, window, gc, cells[0], num_cells[0]);
+    XSetForeground(display, gc, white_pixel);
+    XFillRectangles(display, window, gc, cells[1], num_cells[1]);
+    // The frame counts as drawn once the X server has drawn it
+    XSync(display, False);
+    return time_us;
+}
@@ -34,10 +34,25 @@
 #include <GL/glew.h>
 #include "../include/window_texture.h"
 #include "../include/mpv.hpp"
+#include "../include/mpv_quality.hpp"
 #include "../include/config.hpp"
+#include "../include/program_cache.hpp"
+#include "../include/startup_trace.hpp"
+#include "../include/spsc_queue.hpp"
+#include "../include/event_loop.hpp"
+#include "../include/notification.hpp"
+#include "../include/control_socket.hpp"
+#include "../include/metrics.h"
+#include "../include/session_trace.hpp"
+#include "../include/scene_mesh.hpp"
+#include "../include/cursor_image.hpp"
+#include "../include/headless_gl.hpp"
+#include "../include/latency_probe.hpp"
+#include "../include/pose_sampler.hpp"
 
 #include <SDL.h>
 #include <SDL_opengl.h>
+#include <SDL_syswm.h>
 #include <openvr.h>
 #define GLX_GLXEXT_PROTOTYPES
 #include <GL/glx.h>
@@ -56,7 +71,10 @@
 
 #include <unistd.h>
 #include <signal.h>
+#include <sys/signalfd.h>
+#include <poll.h>
 #include <libgen.h>
+#include <time.h>
 
 #include <iostream>
 #include <fstream>
@@ -64,9 +82,26 @@
 
 #include <thread>
 #include <mutex>
+#include <future>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
 
 static bool g_bPrintf = true;
 
+static double get_monotonic_time_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// The overlay is placed in front of the user at the standing origin
+static const float g_fOverlayWidthMeters = 3.0f;
+static const float g_fOverlayDistanceMeters = 2.0f;
+// Half the field of view of the overlay that the sphere modes are rendered into, as tangents (120 by 100 degrees)
+static const float g_fOverlaySceneHalfTangentX = 1.732f;
+static const float g_fOverlaySceneHalfTangentY = 1.192f;
+
 enum class ViewMode {
 	LEFT_RIGHT,
 	RIGHT_LEFT,
@@ -93,6 +128,7 @@ public:
 	bool BInit();
 	bool BInitGL();
 	bool BInitCompositor();
+	void update_overlay_placement();
 
 	void Shutdown();
 
@@ -100,6 +136,8 @@ public:
 	bool HandleInput();
     void zoom_in();
     void zoom_out();
+    // Writes the zoom to the state file that is read at startup
+    void save_zoom();
 	void ProcessVREvent( const vr::VREvent_t & event );
 	void RenderFrame();
 
@@ -111,12 +149,19 @@ public:
 	void AddCubeToScene( const glm::mat4 &mat, std::vector<float> &vertdata );
 
 	bool SetupStereoRenderTargets();
+	void DeleteStereoRenderTargets();
 	void SetupCompanionWindow();
 	void SetupCameras();
 
 	void RenderStereoTargets();
+	void RenderStereoTargetsMultiview();
 	void RenderCompanionWindow();
 	void RenderScene( vr::Hmd_Eye nEye );
+	void RenderSceneMultiview();
+	bool UseProjectionPass() const;
+	void SetupProjectionPass( double width_ratio, unsigned int border_width );
+	void GetSceneEyeParams( vr::Hmd_Eye nEye, float &texture_offset, float &texture_scale, float cursor[2] );
+	void GetSceneTexture( GLuint &texture, float bounds[2] );
 
 	glm::mat4 GetHMDMatrixProjectionEye( vr::Hmd_Eye nEye );
 	glm::mat4 GetHMDMatrixPoseEye( vr::Hmd_Eye nEye );
@@ -133,6 +178,10 @@ public:
 	Window get_focused_window();
 
 	void save_config();
+	// A replayed session runs with the settings of the user, but doesn't change them
+	bool is_replaying() const { return replay_file != nullptr; }
+	bool is_render_benchmark() const { return render_bench; }
+	bool is_latency_probe() const { return latency_probe_seconds > 0.0; }
 
 	int exit_code = 0;
 	bool bQuit = false;
@@ -142,7 +191,11 @@ private:
 	bool m_bGlFinishHack;
 
 	vr::IVRSystem *m_pHMD;
-	vr::VROverlayHandle_t overlay;
+	vr::VROverlayHandle_t overlay = vr::k_ulOverlayHandleInvalid;
+	// Set by update_overlay_placement from the projection mode, the aspect ratio of the texture and the zoom
+	float overlay_width_meters = g_fOverlayWidthMeters;
+	float overlay_distance_meters = g_fOverlayDistanceMeters;
+	float overlay_curvature = 0.0f;
 	vr::Texture_t mpvTex;
 	vr::TrackedDevicePose_t m_rTrackedDevicePose[ vr::k_unMaxTrackedDeviceCount ];
 	glm::mat4 m_rmat4DevicePose[ vr::k_unMaxTrackedDeviceCount ];
@@ -164,6 +217,9 @@ private: // OpenGL bookkeeping
 
 	std::string m_strPoseClasses;                            // what classes we saw poses for this frame
 	char m_rDevClassChar[ vr::k_unMaxTrackedDeviceCount ];   // for each device, a character representing its class
+	// Kept up to date by ProcessVREvent, instead of asking the runtime for every device each frame
+	vr::ETrackedDeviceClass device_classes[ vr::k_unMaxTrackedDeviceCount ] = {};
+	PoseSampler pose_sampler;
 
 	int m_iSceneVolumeWidth;
 	int m_iSceneVolumeHeight;
@@ -214,16 +270,49 @@ private: // OpenGL bookkeeping
 	};
 
 	GLuint m_unSceneProgramID;
+	GLuint m_unSceneMultiviewProgramID = 0;
 	GLuint m_unCompanionWindowProgramID;
 
 	GLint m_nSceneMatrixLocation;
 	GLint m_nSceneTextureOffsetXLocation;
 	GLint m_nSceneTextureScaleXLocation;
+	GLint m_nSceneTextureBoundsLocation = -1;
 	GLint m_nCursorLocation;
 	GLint m_nArrowSizeLocation = -1;
 	GLint m_myTextureLocation = -1;
 	GLint m_arrowTextureLocation = -1;
 
+	GLint m_nMultiviewMatrixLocation = -1;
+	GLint m_nMultiviewTextureOffsetXLocation = -1;
+	GLint m_nMultiviewTextureScaleXLocation = -1;
+	GLint m_nMultiviewTextureBoundsLocation = -1;
+	GLint m_nMultiviewCursorLocation = -1;
+	GLint m_nMultiviewArrowSizeLocation = -1;
+
+	// Ray-cast projection pass for the sphere and sphere360 modes. Draws a single fullscreen triangle
+	// and computes the texture coordinate per pixel instead of rasterizing a tessellated mesh.
+	struct ProjectionProgramLocations
+	{
+		GLint m_nInverseMatrixLocation;
+		GLint m_nTextureOffsetXLocation;
+		GLint m_nTextureScaleXLocation;
+		GLint m_nTextureBoundsLocation;
+		GLint m_nCursorLocation;
+		GLint m_nArrowSizeLocation;
+		GLint m_nProjectionLocation;
+		GLint m_nSphereCenterLocation;
+		GLint m_nSphereRadiusLocation;
+		GLint m_nFaceRotationLocation;
+		GLint m_nFaceRectLocation;
+	};
+	GLuint m_unProjectionProgramID = 0;
+	GLuint m_unProjectionMultiviewProgramID = 0;
+	GLuint m_unProjectionVAO = 0;
+	ProjectionProgramLocations m_projectionLocations = {};
+	ProjectionProgramLocations m_projectionMultiviewLocations = {};
+
+	bool GetProjectionProgramLocations( GLuint unProgramID, ProjectionProgramLocations &locations );
+
 	struct FramebufferDesc
 	{
 		GLuint m_nDepthBufferId;
@@ -232,15 +321,126 @@ private: // OpenGL bookkeeping
 		GLuint m_nResolveTextureId;
 		GLuint m_nResolveFramebufferId;
 	};
-	FramebufferDesc leftEyeDesc;
-	FramebufferDesc rightEyeDesc;
+	FramebufferDesc leftEyeDesc = {};
+	FramebufferDesc rightEyeDesc = {};
 
-	FramebufferDesc mpvDesc;
+	// The video is rendered into a target from a pool of textures whose sizes are rounded up to
+	// a bucket size, so a video that changes resolution (adaptive streams, playlists, filters)
+	// can usually reuse a previous texture. Only the top left m_nWidth x m_nHeight is used
+	struct MpvRenderTarget
+	{
+		FramebufferDesc m_desc;
+		int m_nBucketWidth;
+		int m_nBucketHeight;
+		int m_nWidth;
+		int m_nHeight;
+	};
+	// All of these are owned by the mpv thread
+	std::vector<MpvRenderTarget*> mpv_render_targets;
+	std::vector<MpvRenderTarget*> mpv_free_render_targets;
+
+	// A rendered video frame. The mpv thread gives the target to the main thread with the frame and doesn't
+	// touch it again until the main thread sends it back through mpv_retired_targets. The sizes are copied
+	// because the mpv thread changes them when it reuses the target
+	struct MpvFrame
+	{
+		MpvRenderTarget *m_pTarget;
+		GLuint m_nTextureId;
+		int m_nBucketWidth;
+		int m_nBucketHeight;
+		int m_nWidth;
+		int m_nHeight;
+	};
+	// The latest video frame, and the frame last given to the overlay. Only used by the main thread
+	MpvFrame mpv_front_frame = {};
+	MpvFrame mpv_submitted_frame = {};
+	// The main thread holds at most the front and the submitted frame, one more can be on its way.
+	// The mpv thread waits for a target to be retired before rendering into another one
+	static constexpr int k_nMaxPublishedMpvTargets = 3;
+
+	// Sent from the main thread to the mpv thread
+	struct MpvThreadCommand
+	{
+		enum class Type
+		{
+			// Render at m_nWidth x m_nHeight from now on
+			RESIZE,
+			// Relative seek by m_fValue seconds
+			SEEK,
+			PAUSE,
+			RESUME,
+			TOGGLE_PAUSE,
+			// Replaces the playlist with m_path
+			LOAD,
+			PLAYLIST_NEXT,
+			PLAYLIST_PREV,
+			SHUTDOWN
+		};
+		Type m_eType;
+		int m_nWidth;
+		int m_nHeight;
+		double m_fValue;
+		std::string m_path;
+	};
+	// Sent from the mpv thread to the main thread
+	struct MpvThreadEvent
+	{
+		enum class Type
+		{
+			CREATE_FAILED,
+			// m_nFrameCount is the total number of frames rendered, so nothing is lost if an event doesn't fit in the queue
+			FRAME_RENDERED,
+			// The video size changed to m_nVideoWidth x m_nVideoHeight
+			VIDEO_RECONFIG,
+			// A file stopped playing, for example at its end or when switching to another playlist entry
+			FILE_ENDED,
+			// The end of the playlist has been reached or mpv failed. m_nError is the mpv error, if any
+			QUIT
+		};
+		Type m_eType;
+		int64_t m_nFrameCount;
+		// Only set for FRAME_RENDERED
+		MpvFrame m_frame;
+		int64_t m_nVideoWidth;
+		int64_t m_nVideoHeight;
+		int m_nError;
+	};
+	// Once the mpv thread is started it owns |mpv|, everything else goes through these queues.
+	// Commands other than shutdown are dropped when the queue is full, the last slot is kept for shutdown
+	SpscQueue<MpvThreadCommand, 64> mpv_commands;
+	bool mpv_shutdown_sent = false;
+	SpscQueue<MpvThreadEvent, 64> mpv_events;
+	// Targets of frames that the main thread doesn't show anymore, sent back to the mpv thread
+	SpscQueue<MpvRenderTarget*, 64> mpv_retired_targets;
+
+	MpvRenderTarget* AcquireMpvRenderTarget( int nWidth, int nHeight );
+	void ReleaseMpvRenderTarget( MpvRenderTarget *pTarget );
+	void RetireMpvFrame( const MpvFrame &frame );
+	GLuint GetMpvTextureId();
+
+	// Layered (2D array) render target that both eyes are drawn into with a single draw call
+	// when GL_OVR_multiview2 is available. Each layer is resolved into leftEyeDesc/rightEyeDesc.
+	struct MultiviewFramebufferDesc
+	{
+		GLuint m_nDepthTextureId;
+		GLuint m_nRenderTextureId;
+		GLuint m_nRenderFramebufferId;
+		GLuint m_nLayerFramebufferId[2];
+	};
+	MultiviewFramebufferDesc multiviewDesc = {};
+	bool m_bMultiview = false;
 
 	bool CreateFrameBuffer( int nWidth, int nHeight, FramebufferDesc &framebufferDesc );
+	bool CreateResolveFrameBuffer( int nWidth, int nHeight, FramebufferDesc &framebufferDesc );
+	void DeleteFrameBuffer( FramebufferDesc &framebufferDesc );
+	bool CreateMultiviewFrameBuffer( int nWidth, int nHeight, MultiviewFramebufferDesc &framebufferDesc );
 	void set_current_context(SDL_GLContext context);
-	bool take_render_update();
-	void set_render_update();
+	void set_mpv_context_ready(bool ready);
+	int64_t GetNextVsyncTimeMpv(int64_t &vsync_interval_us);
+	void GetMpvRenderTargetSize(int64_t video_width, int64_t video_height, int64_t &width, int64_t &height);
+	bool push_mpv_command( const MpvThreadCommand &command );
+	void send_mpv_resize_request();
+	void process_mpv_thread_events();
 	
 	uint32_t m_nRenderWidth;
 	uint32_t m_nRenderHeight;
@@ -256,18 +456,38 @@ private: // X compositor
 	bool follow_focused = false;
 	bool focused_window_changed = true;
 	bool focused_window_set = false;
+	// The first video in |mpv_files|
 	const char *mpv_file = nullptr;
+	std::vector<const char*> mpv_files;
 	Mpv mpv;
-	std::mutex mpv_render_update_mutex;
-	bool mpv_render_update = false;
 	int64_t mpv_video_width = 0;
 	int64_t mpv_video_height = 0;
-	bool mpv_video_loaded = false;
-	bool mpv_loaded_in_thread = false;
-	bool running = true;
+	// The size mpv renders the video at, which is smaller than the video when the headset can't show all of its pixels
+	int64_t mpv_render_width = 0;
+	int64_t mpv_render_height = 0;
+	float mpv_oversample = 1.0f;
+	// A resize that didn't fit in |mpv_commands| yet
+	bool mpv_resize_request_pending = false;
+	double mpv_reconfig_request_time_ms = 0.0;
+	bool mpv_reconfig_pending = false;
 	std::mutex context_mutex;
 
 	std::thread mpv_thread;
+	std::promise<bool> mpv_context_promise;
+	bool mpv_context_promise_set = false;
+	// These are updated from |mpv_events|
+	bool mpv_first_frame_rendered = false;
+	bool mpv_create_failed = false;
+	int64_t mpv_rendered_frame_count = 0;
+	// Measures the time from the end of a file to the first frame of the next file
+	bool mpv_switch_pending = false;
+	double mpv_switch_start_time_ms = 0.0;
+	int64_t mpv_switch_frame_count = 0;
+	MpvQualityGovernor mpv_quality_governor;
+
+	std::future<vr::IVRSystem*> vr_init_future;
+	std::atomic<float> hmd_display_frequency{0.0f};
+	vr::EVRInitError vr_init_error = vr::VRInitError_None;
 
 	int mouse_x = 0;
 	int mouse_y = 0;
@@ -282,6 +502,118 @@ private: // X compositor
 	int x_fixes_error_base;
 	int prev_visibility_state = VisibilityFullyObscured;
 
+private: // Event loop
+	bool init_event_loop();
+	void handle_x_events();
+	bool handle_sdl_events();
+	void handle_signals();
+	void handle_frame_timer();
+	void update_focused_window();
+	void process_control_commands();
+
+	void on_x_mapping_notify(XEvent &xev);
+	void on_x_key_press(XEvent &xev);
+	void on_x_property_notify(XEvent &xev);
+	void on_x_visibility_notify(XEvent &xev);
+	void on_x_configure_notify(XEvent &xev);
+	void on_x_cursor_notify(XEvent &xev);
+
+	// X events are read once and dispatched by type, instead of searching the queue for each type we want
+	typedef void (CMainApplication::*XEventHandler)(XEvent &xev);
+	XEventHandler x_event_handlers[128] = {};
+
+	EventLoop event_loop;
+	// Expires at the headset refresh rate, the scene is updated once per expiration
+	int frame_timer_fd = -1;
+	int signal_fd = -1;
+	bool frame_due = false;
+	// Set by the event handlers (signals, mpv, SDL) to quit at the end of the loop iteration
+	bool quit_requested = false;
+	ControlSocket control_socket;
+	std::vector<ControlCommand> control_commands;
+
+private: // Metrics
+	void observe_x_round_trip(double start_time);
+
+	int metrics_port = 0;
+	double prev_frame_submit_time = 0.0;
+	int64_t prev_frame_video_frame_count = -1;
+	MetricsCounter *frames_submitted_metric = metrics_counter("vrvp_overlay_frames_submitted_total", "Frames submitted to the overlay");
+	MetricsCounter *frames_stale_metric = metrics_counter("vrvp_overlay_frames_stale_total", "Frames submitted to the overlay without a new video frame since the previous one");
+	MetricsHistogram *frame_interval_metric = metrics_latency_histogram("vrvp_overlay_frame_interval_seconds", "Time between overlay frame submissions");
+	MetricsCounter *x_round_trips_metric = metrics_counter("vrvp_x_round_trips_total", "Blocking requests to the X server");
+	MetricsHistogram *x_round_trip_time_metric = metrics_latency_histogram("vrvp_x_round_trip_seconds", "Time spent waiting for replies from the X server");
+
+private: // Session trace
+	// The headset properties are read once, from the vr runtime or from the replayed trace
+	void init_hmd_info();
+	// These make the X request and record the reply, or take the reply from the trace when replaying
+	bool query_pointer(int &x, int &y);
+	bool get_window_size(Window window, int &width, int &height);
+	XFixesCursorImage* get_cursor_image();
+	void record_x_event(const XEvent &xev);
+	void replay_x_events();
+	void record_poses(const vr::ETrackedDeviceClass *device_classes);
+	void replay_poses(vr::ETrackedDeviceClass *device_classes);
+	void run_replay_loop();
+	// SDL_GetTicks, or the time of the replayed frame in the recording so that timeouts expire after the same frames
+	Uint32 get_input_time_ms() const;
+
+	SessionTraceHmdInfo hmd_info = {};
+	bool hmd_info_valid = false;
+	const char *record_file = nullptr;
+	const char *replay_file = nullptr;
+	SessionTraceWriter trace_writer;
+	SessionTraceReader trace_reader;
+	// SESSION_TRACE_FRAME_* flags of the frame that is being recorded or replayed
+	uint32_t trace_frame_flags = 0;
+	Uint32 replay_frame_time_ms = 0;
+
+private: // Render benchmark
+	bool init_render_bench();
+	void set_render_bench_headset( int headset_index );
+	void run_render_bench();
+
+	bool render_bench = false;
+	int render_bench_frames = 60;
+	HeadlessGlContext headless_context;
+	// Draw calls made by RenderScene and RenderSceneMultiview
+	int64_t draw_call_count = 0;
+
+private: // Overlay projection
+	bool overlay_scene_enabled() const { return overlay_scene_desc.m_nResolveFramebufferId != 0; }
+	bool create_overlay_scene_target();
+	void render_overlay_scene();
+
+	// The sphere and sphere360 modes are rendered into a side by side texture that is shown on a flat overlay,
+	// as seen from the center of the sphere. Only the single sampled resolve part of the framebuffer is created
+	FramebufferDesc overlay_scene_desc = {};
+	// The size of each eye's half of the texture
+	int overlay_scene_width = 0;
+	int overlay_scene_height = 0;
+	glm::mat4 overlay_scene_matrix[2];
+	// Set while render_overlay_scene draws, GetCurrentViewProjectionMatrix returns overlay_scene_matrix then
+	bool overlay_scene_pass = false;
+	// The texture is rendered again when the scene changes or there is a new video frame
+	bool overlay_scene_dirty = true;
+	int64_t overlay_scene_video_frame_count = -1;
+
+private: // Capture latency probe
+	void sample_capture_latency();
+	void print_capture_latency();
+
+	// How long the probe runs for, 0 if it's not used
+	double latency_probe_seconds = 0.0;
+	LatencyProbeWindow latency_probe_window;
+	GLuint latency_probe_framebuffer = 0;
+	double latency_probe_start_ms = 0.0;
+	std::vector<uint8_t> latency_probe_pixels;
+	uint32_t latency_probe_last_frame = 0;
+	int64_t latency_probe_submits = 0;
+	int64_t latency_probe_unreadable_submits = 0;
+	// Each probe frame that was submitted, the first time it was
+	std::vector<LatencyProbeSample> latency_probe_samples;
+
 	GLint pixmap_texture_width = 1;
 	GLint pixmap_texture_height = 1;
 
@@ -294,6 +626,12 @@ private: // X compositor
 	bool free_camera = false;
 	bool reduce_flicker = false;
 	bool use_system_mpv_config = false;
+	bool mesh_projection = false;
+	bool shader_cache = true;
+	bool first_frame_submitted = false;
+	const char *startup_trace_file = nullptr;
+	std::string control_socket_path;
+	bool control_socket_enabled = true;
 	double reduce_flicker_counter = 0.0;
 
 	GLuint arrow_image_texture_id = 0;
@@ -396,7 +734,7 @@ void dprintf( const char *fmt, ... )
 }
 
 static void usage() {
-	fprintf(stderr, "usage: vr-video-player [--sphere|--sphere360|--flat|--plane] [--left-right|--right-left] [--stretch|--no-stretch] [--zoom zoom-level] [--cursor-scale scale] [--cursor-wrap|--no-cursor-wrap] [--follow-focused|--video video|<window_id>] [--use-system-mpv-config] [--free-camera] [--reduce-flicker]\n");
+	fprintf(stderr, "usage: vr-video-player [--sphere|--sphere360|--flat|--plane] [--left-right|--right-left] [--stretch|--no-stretch] [--zoom zoom-level] [--cursor-scale scale] [--cursor-wrap|--no-cursor-wrap] [--follow-focused|--video video|<window_id>] [--use-system-mpv-config] [--seek-mode keyframe|exact] [--cache auto|no|size] [--cache-on-disk] [--oversample factor] [--mesh-projection] [--no-shader-cache] [--startup-trace file] [--control-socket path|--no-control-socket] [--metrics-port port] [--record file|--replay file] [--render-bench] [--render-bench-frames frames] [--latency-probe seconds] [--free-camera] [--reduce-flicker]\n");
     fprintf(stderr, "\n");
 	fprintf(stderr, "OPTIONS\n");
 	fprintf(stderr, "  --flat                    View the window as a flat screen. This is for 2d videos and games\n");
@@ -407,8 +745,23 @@ static void usage() {
 	//fprintf(stderr, "  --reduce-flicker          A hack to reduce flickering in low resolution text when the headset is not moving by moving the window around quickly by a few pixels\n");
 	//fprintf(stderr, "  --free-camera             If this option is set, then the camera wont follow your position\n");
     fprintf(stderr, "  --follow-focused          If this option is set, then the selected window will be the focused window. vr-video-player will automatically update when the focused window changes. Either this option, --video or window_id should be used\n");
-	fprintf(stderr, "  --video <video>           Select the video to play (using mpv). Either this option, --follow-focused or window_id should be used\n");
+	fprintf(stderr, "  --video <video>           Select the video to play (using mpv). Either this option, --follow-focused or window_id should be used. This option can be used multiple times to play the videos one after another. Press N and P to go to the next and previous video\n");
 	fprintf(stderr, "  --use-system-mpv-config   Use system (~/.config/mpv/mpv.conf) mpv config. Disabled by default\n");
+	fprintf(stderr, "  --seek-mode <mode>        How the arrow keys seek in the video. keyframe seeks to the closest keyframe, which is fast. The positions of keyframes are remembered in ~/.config/vr-video-player/keyframe-cache so later seeks in the same file land closer to the target. exact seeks to the exact position, which can be slow for high resolution videos. The default value is keyframe\n");
+	fprintf(stderr, "  --cache <size>            How much of the video to read ahead of the playhead. auto sizes the cache from the bitrate of the video and the available memory, no disables the cache and a number sets the size in MiB. Can also be set with cache.size in ~/.config/vr-video-player/config. The default value is auto\n");
+	fprintf(stderr, "  --cache-on-disk           Store the cache on disk instead of in memory, which allows a larger cache. Can also be set with cache.on_disk in ~/.config/vr-video-player/config\n");
+	fprintf(stderr, "  --oversample <factor>     Render the video at factor times the resolution the headset can display it at, but never above the resolution of the video. Only used with --video. The default value is 1\n");
+	fprintf(stderr, "  --mesh-projection         Render sphere and sphere360 modes with a tessellated mesh instead of the per-pixel ray-cast projection\n");
+	fprintf(stderr, "  --no-shader-cache         Always compile shaders from source instead of using the cached program binaries in ~/.config/vr-video-player/shader-cache\n");
+	fprintf(stderr, "  --control-socket <path>   Listen for commands (seek, pause, zoom, reset, load, state, ...) on the unix domain socket path. The default value is $XDG_RUNTIME_DIR/vr-video-player.sock, see the README for the commands\n");
+	fprintf(stderr, "  --no-control-socket       Don't listen for commands on a unix domain socket\n");
+	fprintf(stderr, "  --metrics-port <port>     Serve frame, capture and playback metrics on http://127.0.0.1:port/metrics (prometheus text format) and /snapshot (binary). Disabled by default\n");
+	fprintf(stderr, "  --record <file>           Record the X events, X replies, cursor images and headset poses of the session to file, so it can be replayed with --replay. Only for window capture\n");
+	fprintf(stderr, "  --replay <file>           Replay a session recorded with --record as fast as possible, without the captured window or a headset, and print the frame times at the end. The other options should be the same as when recording\n");
+	fprintf(stderr, "  --render-bench            Render every projection and view mode at the resolution of a few headsets without a window, X or a headset (with an EGL surfaceless context, Mesa's llvmpipe works) and print the frame times, draw calls and checksums of the rendered images as JSON\n");
+	fprintf(stderr, "  --render-bench-frames <n> The number of frames --render-bench renders in each mode. The default value is 60\n");
+	fprintf(stderr, "  --latency-probe <seconds> Open a test window that draws its frame number and the time in its pixels, capture it without a headset and print how long changes in the window took to reach the submitted frame as JSON. Works under Xvfb\n");
+	fprintf(stderr, "  --startup-trace <file>    Write the timings of the startup phases to file when the first frame has been submitted. The file is in the chrome trace event format and can be opened in chrome://tracing or https://ui.perfetto.dev\n");
     fprintf(stderr, "  window_id                 The X11 window id of the window to view in vr. Either this option, --follow-focused or --video should be used\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "EXAMPLES\n");
@@ -423,6 +776,19 @@ static void usage() {
 	exit(1);
 }
 
+// Returns an empty string if the action manifest could not be found
+static std::string find_action_manifest_path() {
+	char action_manifest_path[PATH_MAX];
+	if(realpath("config/hellovr_actions.json", action_manifest_path) && access(action_manifest_path, F_OK) == 0)
+		return action_manifest_path;
+
+	strcpy(action_manifest_path, "/usr/share/vr-video-player/hellovr_actions.json");
+	if(access(action_manifest_path, F_OK) == 0)
+		return action_manifest_path;
+
+	return "";
+}
+
 static void get_config_values(const Config &config, ProjectionMode projection_mode, glm::vec3 &pos, glm::quat &rot, float &zoom) {
 	switch(projection_mode) {
 		case ProjectionMode::SPHERE: {
@@ -483,6 +849,8 @@ CMainApplication::CMainApplication( int argc, char *argv[] )
 	const char *projection_arg = nullptr;
 	const char *view_mode_arg = nullptr;
 	bool zoom_set = false;
+	const char *cache_size = nullptr;
+	bool cache_on_disk = false;
 	bool cursor_scale_set = false;
 	bool cursor_wrap_set = false;
 
@@ -505,6 +873,13 @@ CMainApplication::CMainApplication( int argc, char *argv[] )
 			zoom = atof(argv[i + 1]);
 			++i;
 			zoom_set = true;
+		} else if(strcmp(argv[i], "--oversample") == 0 && i < argc - 1) {
+			mpv_oversample = atof(argv[i + 1]);
+			++i;
+			if(mpv_oversample <= 0.0f) {
+				fprintf(stderr, "Error: --oversample should be a positive value\n");
+				exit(1);
+			}
 		} else if(strcmp(argv[i], "--cursor-scale") == 0 && i < argc - 1) {
 			cursor_scale = atof(argv[i + 1]);
 			++i;
@@ -578,10 +953,73 @@ CMainApplication::CMainApplication( int argc, char *argv[] )
 				fprintf(stderr, "Error: window_id option can't be used together with the --video option\n");
 				exit(1);
 			}
-			mpv_file = argv[i + 1];
+			if(!mpv_file)
+				mpv_file = argv[i + 1];
+			mpv_files.push_back(argv[i + 1]);
+			++i;
+		} else if(strcmp(argv[i], "--seek-mode") == 0 && i < argc - 1) {
+			if(strcmp(argv[i + 1], "keyframe") == 0) {
+				mpv.seek_mode = MpvSeekMode::KEYFRAME;
+			} else if(strcmp(argv[i + 1], "exact") == 0) {
+				mpv.seek_mode = MpvSeekMode::EXACT;
+			} else {
+				fprintf(stderr, "Error: invalid --seek-mode %s, expected keyframe or exact\n", argv[i + 1]);
+				exit(1);
+			}
+			++i;
+		} else if(strcmp(argv[i], "--cache") == 0 && i < argc - 1) {
+			MpvCacheSettings cache_settings;
+			if(!mpv_cache_settings_parse_size(argv[i + 1], cache_settings)) {
+				fprintf(stderr, "Error: invalid --cache %s, expected auto, no or a size in MiB\n", argv[i + 1]);
+				exit(1);
+			}
+			cache_size = argv[i + 1];
 			++i;
+		} else if(strcmp(argv[i], "--cache-on-disk") == 0) {
+			cache_on_disk = true;
 		} else if(strcmp(argv[i], "--use-system-mpv-config") == 0) {
 			use_system_mpv_config = true;
+		} else if(strcmp(argv[i], "--mesh-projection") == 0) {
+			mesh_projection = true;
+		} else if(strcmp(argv[i], "--no-shader-cache") == 0) {
+			shader_cache = false;
+		} else if(strcmp(argv[i], "--startup-trace") == 0 && i < argc - 1) {
+			startup_trace_file = argv[i + 1];
+			++i;
+		} else if(strcmp(argv[i], "--control-socket") == 0 && i < argc - 1) {
+			control_socket_path = argv[i + 1];
+			++i;
+		} else if(strcmp(argv[i], "--no-control-socket") == 0) {
+			control_socket_enabled = false;
+		} else if(strcmp(argv[i], "--metrics-port") == 0 && i < argc - 1) {
+			metrics_port = atoi(argv[i + 1]);
+			if(metrics_port <= 0 || metrics_port > 65535) {
+				fprintf(stderr, "Error: --metrics-port should be between 1 and 65535, was %s\n", argv[i + 1]);
+				exit(1);
+			}
+			++i;
+		} else if(strcmp(argv[i], "--record") == 0 && i < argc - 1) {
+			record_file = argv[i + 1];
+			++i;
+		} else if(strcmp(argv[i], "--replay") == 0 && i < argc - 1) {
+			replay_file = argv[i + 1];
+			++i;
+		} else if(strcmp(argv[i], "--render-bench") == 0) {
+			render_bench = true;
+		} else if(strcmp(argv[i], "--render-bench-frames") == 0 && i < argc - 1) {
+			render_bench_frames = atoi(argv[i + 1]);
+			if(render_bench_frames <= 0) {
+				fprintf(stderr, "Error: --render-bench-frames should be a positive value, was %s\n", argv[i + 1]);
+				exit(1);
+			}
+			++i;
+		} else if(strcmp(argv[i], "--latency-probe") == 0 && i < argc - 1) {
+			latency_probe_seconds = atof(argv[i + 1]);
+			if(latency_probe_seconds <= 0.0) {
+				fprintf(stderr, "Error: --latency-probe should be a positive value, was %s\n", argv[i + 1]);
+				exit(1);
+			}
+			++i;
 		} else if(strcmp(argv[i], "--free-camera") == 0) {
 			free_camera = true;
 		} else if(strcmp(argv[i], "--reduce-flicker") == 0) {
@@ -605,7 +1043,35 @@ CMainApplication::CMainApplication( int argc, char *argv[] )
 		}
 	}
 
-	if(src_window_id == None && !follow_focused && !mpv_file) {
+	if(record_file && replay_file) {
+		fprintf(stderr, "Error: --record and --replay can't be used together\n");
+		exit(1);
+	}
+
+	if((record_file || replay_file) && mpv_file) {
+		fprintf(stderr, "Error: --record and --replay can only be used with window capture, not with --video\n");
+		exit(1);
+	}
+
+	if(render_bench && (src_window_id != None || follow_focused || mpv_file || record_file || replay_file)) {
+		fprintf(stderr, "Error: --render-bench renders a test image, it can't be used together with a window, --follow-focused, --video, --record or --replay\n");
+		exit(1);
+	}
+
+	if(is_latency_probe() && (src_window_id != None || follow_focused || mpv_file || record_file || replay_file || render_bench)) {
+		fprintf(stderr, "Error: --latency-probe captures its own test window, it can't be used together with a window, --follow-focused, --video, --record, --replay or --render-bench\n");
+		exit(1);
+	}
+
+	// The json output of the render benchmark and the latency probe goes to stdout
+	if(render_bench || is_latency_probe())
+		g_bPrintf = false;
+
+	// The probe window is drawn by another thread, with its own X connection. This has to be the first Xlib call
+	if(is_latency_probe())
+		XInitThreads();
+
+	if(src_window_id == None && !follow_focused && !mpv_file && !replay_file && !render_bench && !is_latency_probe()) {
 		fprintf(stderr, "Missing required window_id, --follow-focused or --video option\n");
 		usage();
 	}
@@ -638,6 +1104,14 @@ CMainApplication::CMainApplication( int argc, char *argv[] )
 #endif
 
 	config = read_config(config_exists);
+
+	// Command line options override the config file, but are not saved to it
+	if(!mpv_cache_settings_parse_size(cache_size ? cache_size : config.cache.size.c_str(), mpv.cache_settings)) {
+		fprintf(stderr, "Warning: Invalid config option cache.size %s, expected auto, no or a size in MiB\n", config.cache.size.c_str());
+		mpv.cache_settings.mode = MpvCacheSettings::Mode::AUTO;
+	}
+	mpv.cache_settings.on_disk = cache_on_disk || config.cache.on_disk;
+
 	if(!config_exists)
 		return;
 
@@ -692,6 +1166,16 @@ static int xerror(Display *dpy, XErrorEvent *ee) {
     return 0; /* may call exit */ /* TODO: xerrorxlib(dpy, ee); */
 }
 
+// Read from a signalfd by the event loop instead of being handled in signal handlers
+static void get_event_loop_signals(sigset_t &mask)
+{
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+}
+
 static void grabkeys(Display *display) {
 	unsigned int numlockmask = 0;
     KeyCode numlock_keycode = XKeysymToKeycode(display, XK_Num_Lock);
@@ -722,60 +1206,403 @@ static void grabkeys(Display *display) {
 //-----------------------------------------------------------------------------
 bool CMainApplication::BInit()
 {
-	x_display = XOpenDisplay(nullptr);
-	if (!x_display)
-	{
-		printf("Failed to open x display\n");
-		return false;
+	StartupTraceScope trace_scope("BInit");
+
+	// The render benchmark doesn't use X, SDL, mpv or the vr runtime
+	if(render_bench)
+		return init_render_bench();
+
+	// A replayed session uses the window id and the headset of the recording
+	if(replay_file) {
+		if(!trace_reader.open(replay_file, sizeof(XEvent)))
+			return false;
+		src_window_id = trace_reader.get_header().src_window_id;
+		fprintf(stderr, "Replaying %llu frames from %s\n", (unsigned long long)trace_reader.get_num_frames(), replay_file);
 	}
 
-	XSetErrorHandler(xerror);
+	// mpv, the vr runtime and the action manifest lookup don't depend on X, SDL or opengl,
+	// so they are started first and run in parallel with the rest of the initialization
+	if(mpv_file) {
+		// Forked before anything else is loaded and before any thread is started, so the fork is cheap
+		notification_helper_start();
+
+		if(!mpv.create_wakeup_fd())
+			return false;
 
-	net_active_window_atom = XInternAtom(x_display, "_NET_ACTIVE_WINDOW", False);
-	if(!net_active_window_atom) {
-		fprintf(stderr, "Failed to get _NET_ACTIVE_WINDOW atom\n");
-		return false;
+		mpv_thread = std::thread([&]{
+			startup_trace_set_thread_name("mpv");
+			{
+				StartupTraceScope trace_scope("mpv create");
+				if(!mpv.create(use_system_mpv_config)) {
+					mpv_events.push({ MpvThreadEvent::Type::CREATE_FAILED, 0 });
+					return;
+				}
+			}
+
+			// mpv can't open the file until it has a render context, which needs the opengl context
+			// that is created by the main thread
+			bool mpv_context_ready;
+			{
+				StartupTraceScope trace_scope("wait for gl context");
+				mpv_context_ready = mpv_context_promise.get_future().get();
+			}
+			if(!mpv_context_ready)
+				return;
+
+			set_current_context(m_pMpvContext);
+			{
+				StartupTraceScope trace_scope("mpv render context");
+				if(!mpv.create_render_context()) {
+					mpv_events.push({ MpvThreadEvent::Type::CREATE_FAILED, 0 });
+					set_current_context(NULL);
+					return;
+				}
+			}
+
+			mpv.load_file(mpv_files[0]);
+			for(size_t i = 1; i < mpv_files.size(); ++i) {
+				mpv.append_file(mpv_files[i]);
+			}
+			startup_trace_mark("mpv loadfile");
+			set_current_context(NULL);
+
+			bool frame_pending = false;
+			// Events that didn't fit in the queue, sent in order before anything else
+			std::vector<MpvThreadEvent> event_backlog;
+			// Owned by the mpv thread until a frame has been rendered into it
+			MpvRenderTarget *render_target = nullptr;
+			// Targets given to the main thread that haven't been retired yet
+			int published_targets = 0;
+			int requested_render_width = 0;
+			int requested_render_height = 0;
+			int target_width = 0;
+			int target_height = 0;
+			int64_t rendered_frame_count = 0;
+			bool running = true;
+			// Timestamps before and after each draw, double buffered so that the results of the previous
+			// frame can be read without waiting for the gpu
+			GLuint draw_time_queries[2][2] = {};
+			bool draw_time_query_pending[2] = {};
+			int draw_time_query_index = 0;
+			int64_t repeated_frames = 0;
+			int64_t dropped_frames_start = 0;
+			int64_t frame_stats_start_us = 0;
+
+			MetricsCounter *rendered_frames_metric = metrics_counter("vrvp_mpv_rendered_frames_total", "Video frames rendered by mpv");
+			MetricsCounter *repeated_frames_metric = metrics_counter("vrvp_mpv_repeated_frames_total", "Vsyncs where the previous video frame was shown again because the next one was late");
+			MetricsHistogram *draw_time_metric = metrics_latency_histogram("vrvp_mpv_draw_gpu_seconds", "GPU time of rendering a video frame with mpv");
+			MetricsGauge *quality_tier_metric = metrics_gauge("vrvp_mpv_quality_tier", "Render quality tier chosen from the measured frame cost, 0 is the cheapest");
+			MetricsCounter *quality_transitions_metric = metrics_counter("vrvp_mpv_quality_transitions_total", "Render quality tier changes");
+			metrics_gauge_set(quality_tier_metric, mpv_quality_governor.get_tier());
+
+			while(running) {
+				MpvThreadCommand command;
+				while(mpv_commands.pop(command)) {
+					switch(command.m_eType) {
+						case MpvThreadCommand::Type::RESIZE:
+							requested_render_width = command.m_nWidth;
+							requested_render_height = command.m_nHeight;
+							break;
+						case MpvThreadCommand::Type::SEEK:
+							mpv.seek(command.m_fValue);
+							break;
+						case MpvThreadCommand::Type::PAUSE:
+							mpv.set_paused(true);
+							break;
+						case MpvThreadCommand::Type::RESUME:
+							mpv.set_paused(false);
+							break;
+						case MpvThreadCommand::Type::TOGGLE_PAUSE:
+							mpv.toggle_pause();
+							break;
+						case MpvThreadCommand::Type::LOAD:
+							mpv.load_file(command.m_path.c_str());
+							break;
+						case MpvThreadCommand::Type::PLAYLIST_NEXT:
+							mpv.playlist_next();
+							break;
+						case MpvThreadCommand::Type::PLAYLIST_PREV:
+							mpv.playlist_prev();
+							break;
+						case MpvThreadCommand::Type::SHUTDOWN:
+							running = false;
+							break;
+					}
+				}
+				if(!running)
+					break;
+
+				bool render_update = false;
+				int64_t video_width = 0;
+				int64_t video_height = 0;
+				bool mpv_quit = false;
+				int error = 0;
+				bool file_ended = false;
+				mpv.process_wakeups(&render_update, &video_width, &video_height, &mpv_quit, &error, &file_ended);
+				mpv.update_cache_stats();
+				if(render_update)
+					frame_pending = true;
+				if(file_ended)
+					event_backlog.push_back({ MpvThreadEvent::Type::FILE_ENDED, 0 });
+				if(video_width > 0 && video_height > 0)
+					event_backlog.push_back({ MpvThreadEvent::Type::VIDEO_RECONFIG, 0, {}, video_width, video_height });
+				if(mpv_quit)
+					event_backlog.push_back({ MpvThreadEvent::Type::QUIT, 0, {}, 0, 0, error });
+
+				size_t events_sent = 0;
+				while(events_sent < event_backlog.size() && mpv_events.push(event_backlog[events_sent]))
+					++events_sent;
+				event_backlog.erase(event_backlog.begin(), event_backlog.begin() + events_sent);
+
+				set_current_context(m_pMpvContext);
+
+				MpvRenderTarget *retired_target = nullptr;
+				while(mpv_retired_targets.pop(retired_target)) {
+					ReleaseMpvRenderTarget(retired_target);
+					--published_targets;
+				}
+
+				// The main thread requests a new size when the video is reconfigured. The main thread keeps showing
+				// the previous frame until a frame has been rendered at the new size
+				if(requested_render_width > 0 && requested_render_height > 0 && (target_width != requested_render_width || target_height != requested_render_height)) {
+					target_width = requested_render_width;
+					target_height = requested_render_height;
+					if(render_target) {
+						ReleaseMpvRenderTarget(render_target);
+						render_target = nullptr;
+					}
+					// Render the current frame at the new size even if mpv doesn't have a new frame (when paused)
+					frame_pending = true;
+					mpv_quality_governor.reset();
+					if(GLEW_ARB_timer_query && draw_time_queries[0][0] == 0)
+						glGenQueries(4, &draw_time_queries[0][0]);
+				}
+
+				// Each frame is rendered into a target that the main thread isn't using
+				if(!render_target && target_width > 0 && published_targets < k_nMaxPublishedMpvTargets)
+					render_target = AcquireMpvRenderTarget(target_width, target_height);
+
+				bool rendered = false;
+				int64_t vsync_interval_us = 0;
+				int64_t next_vsync_time_us = 0;
+				int64_t frame_target_time_us = 0;
+				if(render_target) {
+					next_vsync_time_us = GetNextVsyncTimeMpv(vsync_interval_us);
+					if(frame_pending && mpv.next_frame_due(next_vsync_time_us, vsync_interval_us)) {
+						frame_pending = false;
+						frame_target_time_us = mpv.next_frame_target_time_us;
+
+						const int render_width = render_target->m_nWidth;
+						const int render_height = render_target->m_nHeight;
+						glBindFramebuffer( GL_FRAMEBUFFER, render_target->m_desc.m_nRenderFramebufferId );
+						glViewport(0, 0, render_width, render_height);
+						glDisable(GL_DEPTH_TEST);
+
+						glBindVertexArray( m_unCompanionWindowVAO );
+						glUseProgram( m_unCompanionWindowProgramID );
+
+						// mpv uses GL_TIME_ELAPSED queries internally, which can't be nested, so timestamps are used instead
+						GLuint *draw_time_query = draw_time_queries[draw_time_query_index];
+						const bool time_draw = draw_time_query[0] != 0 && !draw_time_query_pending[draw_time_query_index];
+						if(time_draw)
+							glQueryCounter(draw_time_query[0], GL_TIMESTAMP);
+
+						mpv.draw(render_target->m_desc.m_nRenderFramebufferId, render_width, render_height);
+
+						if(time_draw) {
+							glQueryCounter(draw_time_query[1], GL_TIMESTAMP);
+							draw_time_query_pending[draw_time_query_index] = true;
+						}
+						draw_time_query_index = (draw_time_query_index + 1) % 2;
+
+						glBindVertexArray( 0 );
+						glUseProgram( 0 );
+						glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+						
+						glDisable( GL_MULTISAMPLE );
+
+						glBindFramebuffer(GL_READ_FRAMEBUFFER, render_target->m_desc.m_nRenderFramebufferId );
+						glBindFramebuffer(GL_DRAW_FRAMEBUFFER, render_target->m_desc.m_nResolveFramebufferId );
+						
+						glBlitFramebuffer( 0, 0, render_width, render_height, 0, 0, render_width, render_height, 
+							GL_COLOR_BUFFER_BIT,
+							GL_LINEAR  );
+
+						glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+						glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0 );
+
+						glEnable( GL_MULTISAMPLE );
+						glFlush();
+						rendered = true;
+
+						if(rendered_frame_count == 0)
+							startup_trace_mark("mpv first video frame");
+						++rendered_frame_count;
+						metrics_counter_add(rendered_frames_metric, 1);
+
+						const MpvFrame frame = {
+							render_target, render_target->m_desc.m_nResolveTextureId,
+							render_target->m_nBucketWidth, render_target->m_nBucketHeight,
+							render_target->m_nWidth, render_target->m_nHeight
+						};
+						// The target belongs to the main thread now. If the event doesn't fit the frame is never shown
+						// and the target is rendered into again
+						if(mpv_events.push({ MpvThreadEvent::Type::FRAME_RENDERED, rendered_frame_count, frame })) {
+							render_target = nullptr;
+							++published_targets;
+						}
+
+						// The other query is from the previous draw and is usually done by now. If it's not, check again after the next draw
+						GLuint *prev_draw_time_query = draw_time_queries[draw_time_query_index];
+						GLuint prev_draw_time_available = 0;
+						if(draw_time_query_pending[draw_time_query_index])
+							glGetQueryObjectuiv(prev_draw_time_query[1], GL_QUERY_RESULT_AVAILABLE, &prev_draw_time_available);
+						if(prev_draw_time_available) {
+							GLuint64 draw_start_ns = 0;
+							GLuint64 draw_end_ns = 0;
+							glGetQueryObjectui64v(prev_draw_time_query[0], GL_QUERY_RESULT, &draw_start_ns);
+							glGetQueryObjectui64v(prev_draw_time_query[1], GL_QUERY_RESULT, &draw_end_ns);
+							draw_time_query_pending[draw_time_query_index] = false;
+							metrics_histogram_observe(draw_time_metric, (draw_end_ns - draw_start_ns) / 1000000000.0);
+
+							if(mpv_quality_governor.add_sample((draw_end_ns - draw_start_ns) / 1000000.0)) {
+								const double frame_budget_ms = vsync_interval_us > 0 ? vsync_interval_us / 1000.0 : 1000.0 / 90.0;
+								if(mpv_quality_governor.update(mpv, mpv.get_dropped_frame_count(), frame_budget_ms)) {
+									metrics_gauge_set(quality_tier_metric, mpv_quality_governor.get_tier());
+									metrics_counter_add(quality_transitions_metric, 1);
+								}
+							}
+						}
+					}
+				}
+
+				set_current_context(NULL);
+
+				// Wakes up as soon as mpv has an event or a new frame. Commands from the main thread
+				// don't wake the thread, they wait for at most a millisecond
+				if(!rendered) {
+					pollfd wakeup_pollfd = { mpv.get_wakeup_fd(), POLLIN, 0 };
+					poll(&wakeup_pollfd, 1, 1);
+					continue;
+				}
+
+				// The compositor picks up the overlay texture at the next vsync, which is when mpv should consider the frame as displayed
+				if(next_vsync_time_us > 0) {
+					const int64_t time_until_vsync_us = next_vsync_time_us - mpv.get_time_us();
+					if(time_until_vsync_us > 0)
+						usleep(time_until_vsync_us);
+				}
+				mpv.report_swap();
+
+				// A frame that is displayed more than half a vsync interval after its target time means that
+				// the previous frame was repeated for an extra vsync
+				if(frame_target_time_us > 0 && next_vsync_time_us > 0 && vsync_interval_us > 0) {
+					const int64_t lateness_us = next_vsync_time_us - frame_target_time_us;
+					if(lateness_us > vsync_interval_us / 2) {
+						const int64_t repeated = (lateness_us + vsync_interval_us / 2) / vsync_interval_us;
+						repeated_frames += repeated;
+						metrics_counter_add(repeated_frames_metric, repeated);
+					}
+				}
+
+				const int64_t now_us = mpv.get_time_us();
+				if(frame_stats_start_us == 0) {
+					frame_stats_start_us = now_us;
+					dropped_frames_start = mpv.get_dropped_frame_count();
+				} else if(now_us - frame_stats_start_us >= 60 * 1000000LL) {
+					const int64_t dropped_frames = mpv.get_dropped_frame_count();
+					const double minutes = (now_us - frame_stats_start_us) / (60.0 * 1000000.0);
+					dprintf("mpv: %.1f dropped and %.1f repeated video frames per minute, quality: %s (%lld transitions)\n",
+						(dropped_frames - dropped_frames_start) / minutes, repeated_frames / minutes,
+						mpv_quality_governor.get_tier_name(), (long long)mpv_quality_governor.get_transition_count());
+					frame_stats_start_us = now_us;
+					dropped_frames_start = dropped_frames;
+					repeated_frames = 0;
+				}
+			}
+
+			// Framebuffers aren't shared between contexts, so they have to be deleted with the context they were created in
+			set_current_context(m_pMpvContext);
+			if(draw_time_queries[0][0])
+				glDeleteQueries(4, &draw_time_queries[0][0]);
+			// The main thread doesn't render anymore once it has sent the shutdown command
+			for(MpvRenderTarget *target : mpv_render_targets) {
+				DeleteFrameBuffer(target->m_desc);
+				delete target;
+			}
+			mpv_render_targets.clear();
+			mpv_free_render_targets.clear();
+			set_current_context(NULL);
+		});
 	}
 
-	if(!XFixesQueryExtension(x_display, &x_fixes_event_base, &x_fixes_error_base)) {
-		fprintf(stderr, "Your x11 server is missing the xfixes extension\n");
-		return false;
+	std::future<std::string> action_manifest_future;
+	if(!replay_file && !is_latency_probe()) {
+		vr_init_future = std::async(std::launch::async, [this]{
+			startup_trace_set_thread_name("vr init");
+			StartupTraceScope trace_scope("VR_Init");
+			return vr::VR_Init( &vr_init_error, vr::VRApplication_Overlay );
+		});
+
+		action_manifest_future = std::async(std::launch::async, []{
+			startup_trace_set_thread_name("action manifest");
+			StartupTraceScope trace_scope("find action manifest");
+			return find_action_manifest_path();
+		});
 	}
 
-	grabkeys(x_display);
+	{
+		StartupTraceScope trace_scope("X setup");
+		x_display = XOpenDisplay(nullptr);
+		if (!x_display)
+		{
+			printf("Failed to open x display\n");
+			return false;
+		}
 
-	if(follow_focused)
-		XSelectInput(x_display, DefaultRootWindow(x_display), PropertyChangeMask);
+		XSetErrorHandler(xerror);
 
-	Bool sup = False;
-	XkbSetDetectableAutoRepeat(x_display, True, &sup);
+		net_active_window_atom = XInternAtom(x_display, "_NET_ACTIVE_WINDOW", False);
+		if(!net_active_window_atom) {
+			fprintf(stderr, "Failed to get _NET_ACTIVE_WINDOW atom\n");
+			return false;
+		}
 
-	if ( SDL_Init( SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_JOYSTICK ) < 0 )
-	{
-		printf("%s - SDL could not initialize! SDL Error: %s\n", __FUNCTION__, SDL_GetError());
-		return false;
+		if(!XFixesQueryExtension(x_display, &x_fixes_event_base, &x_fixes_error_base)) {
+			fprintf(stderr, "Your x11 server is missing the xfixes extension\n");
+			return false;
+		}
+
+		// The keys and focus changes of a replayed session come from the trace
+		if(!replay_file) {
+			grabkeys(x_display);
+
+			if(follow_focused)
+				XSelectInput(x_display, DefaultRootWindow(x_display), PropertyChangeMask);
+		}
+
+		Bool sup = False;
+		XkbSetDetectableAutoRepeat(x_display, True, &sup);
 	}
 
-	// Loading the SteamVR Runtime
-	vr::EVRInitError eError = vr::VRInitError_None;
-	m_pHMD = vr::VR_Init( &eError, vr::VRApplication_Overlay );
+	if(is_latency_probe()) {
+		if(!latency_probe_window.create(60))
+			return false;
+		src_window_id = latency_probe_window.get_window();
+	}
 
-	if ( eError != vr::VRInitError_None )
 	{
-		m_pHMD = NULL;
-		char buf[1024];
-		snprintf( buf, sizeof( buf ), "Unable to init VR runtime: %s", vr::VR_GetVRInitErrorAsEnglishDescription( eError ) );
-		SDL_ShowSimpleMessageBox( SDL_MESSAGEBOX_ERROR, "VR_Init Failed", buf, NULL );
-		return false;
+		StartupTraceScope trace_scope("SDL_Init");
+		if ( SDL_Init( SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_JOYSTICK ) < 0 )
+		{
+			printf("%s - SDL could not initialize! SDL Error: %s\n", __FUNCTION__, SDL_GetError());
+			return false;
+		}
 	}
 
-	auto standing_pos = m_pHMD->GetSeatedZeroPoseToStandingAbsoluteTrackingPose();
-	if(!config_exists)
-		hmd_pos += glm::vec3(standing_pos.m[0][3], standing_pos.m[1][3], standing_pos.m[2][3]);
-
 	int nWindowPosX = 700;
 	int nWindowPosY = 100;
-	Uint32 unWindowFlags = SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN;
+	Uint32 unWindowFlags = SDL_WINDOW_OPENGL | (replay_file || is_latency_probe() ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN);
 
 	SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 3 );
 	SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 2 );
@@ -791,42 +1618,52 @@ bool CMainApplication::BInit()
 	// Needed for mpv
 	SDL_SetHint(SDL_HINT_NO_SIGNAL_HANDLERS, "no");
 
-	m_pCompanionWindow = SDL_CreateWindow( "vr-video-player", nWindowPosX, nWindowPosY, m_nCompanionWindowWidth, m_nCompanionWindowHeight, unWindowFlags );
-	if (m_pCompanionWindow == NULL)
-	{
-		printf( "%s - Window could not be created! SDL Error: %s\n", __FUNCTION__, SDL_GetError() );
-		return false;
-	}
-
-	m_pContext = SDL_GL_CreateContext(m_pCompanionWindow);
-	if (m_pContext == NULL)
 	{
-		printf( "%s - OpenGL context could not be created! SDL Error: %s\n", __FUNCTION__, SDL_GetError() );
-		return false;
-	}
+		StartupTraceScope trace_scope("window and gl contexts");
+		m_pCompanionWindow = SDL_CreateWindow( "vr-video-player", nWindowPosX, nWindowPosY, m_nCompanionWindowWidth, m_nCompanionWindowHeight, unWindowFlags );
+		if (m_pCompanionWindow == NULL)
+		{
+			printf( "%s - Window could not be created! SDL Error: %s\n", __FUNCTION__, SDL_GetError() );
+			return false;
+		}
 
-	if(mpv_file) {
-		m_pMpvContext = SDL_GL_CreateContext(m_pCompanionWindow);
-		if (m_pMpvContext == NULL)
+		m_pContext = SDL_GL_CreateContext(m_pCompanionWindow);
+		if (m_pContext == NULL)
 		{
 			printf( "%s - OpenGL context could not be created! SDL Error: %s\n", __FUNCTION__, SDL_GetError() );
 			return false;
 		}
-	}
 
-	if(SDL_GL_MakeCurrent(m_pCompanionWindow, m_pContext) < 0) {
-		fprintf(stderr, "Failed to make opengl context current, error: %s\n", SDL_GetError());
-		return false;
+		if(mpv_file) {
+			m_pMpvContext = SDL_GL_CreateContext(m_pCompanionWindow);
+			if (m_pMpvContext == NULL)
+			{
+				printf( "%s - OpenGL context could not be created! SDL Error: %s\n", __FUNCTION__, SDL_GetError() );
+				return false;
+			}
+		}
+
+		if(SDL_GL_MakeCurrent(m_pCompanionWindow, m_pContext) < 0) {
+			fprintf(stderr, "Failed to make opengl context current, error: %s\n", SDL_GetError());
+			return false;
+		}
 	}
 
-	glewExperimental = GL_TRUE;
-	GLenum nGlewError = glewInit();
-	if (nGlewError != GLEW_OK)
+	// mpv creates its render context and opens the file while the main thread initializes opengl and openvr
+	if(mpv_file)
+		set_mpv_context_ready(true);
+
 	{
-		printf( "%s - Error initializing GLEW! %s\n", __FUNCTION__, glewGetErrorString( nGlewError ) );
-		return false;
+		StartupTraceScope trace_scope("glewInit");
+		glewExperimental = GL_TRUE;
+		GLenum nGlewError = glewInit();
+		if (nGlewError != GLEW_OK)
+		{
+			printf( "%s - Error initializing GLEW! %s\n", __FUNCTION__, glewGetErrorString( nGlewError ) );
+			return false;
+		}
+		glGetError(); // to clear the error caused deep in GLEW
 	}
-	glGetError(); // to clear the error caused deep in GLEW
 
 	if ( SDL_GL_SetSwapInterval( m_bVblank ? 1 : 0 ) < 0 )
 	{
@@ -834,6 +1671,24 @@ bool CMainApplication::BInit()
 		return false;
 	}
 
+	// Loading the SteamVR Runtime
+	if( !replay_file && !is_latency_probe() )
+	{
+		{
+			StartupTraceScope trace_scope("wait for VR_Init");
+			m_pHMD = vr_init_future.get();
+		}
+
+		if ( vr_init_error != vr::VRInitError_None )
+		{
+			m_pHMD = NULL;
+			char buf[1024];
+			snprintf( buf, sizeof( buf ), "Unable to init VR runtime: %s", vr::VR_GetVRInitErrorAsEnglishDescription( vr_init_error ) );
+			SDL_ShowSimpleMessageBox( SDL_MESSAGEBOX_ERROR, "VR_Init Failed", buf, NULL );
+			return false;
+		}
+	}
+
 	// cube array
  	m_iSceneVolumeWidth = m_iSceneVolumeInit;
  	m_iSceneVolumeHeight = m_iSceneVolumeInit;
@@ -849,6 +1704,24 @@ bool CMainApplication::BInit()
  
 // 		m_MillisecondsTimer.start(1, this);
 // 		m_SecondsTimer.start(1000, this);
+
+	// After the clip distances, which the projection matrices depend on. The latency probe
+	// doesn't render the scene, so any headset does
+	if(is_latency_probe())
+		set_render_bench_headset(0);
+	else
+		init_hmd_info();
+	hmd_display_frequency = hmd_info.display_frequency;
+
+	const float (&standing_pos)[3][4] = hmd_info.seated_to_standing;
+	if(!config_exists)
+		hmd_pos += glm::vec3(standing_pos[0][3], standing_pos[1][3], standing_pos[2][3]);
+
+	if(record_file) {
+		if(!trace_writer.open(record_file, src_window_id, sizeof(XEvent), hmd_info))
+			return false;
+		fprintf(stderr, "Recording the session to %s\n", record_file);
+	}
 	
 	if (!BInitGL())
 	{
@@ -856,111 +1729,152 @@ bool CMainApplication::BInit()
 		return false;
 	}
 
-	if (!BInitCompositor())
+	// Without a headset there is nothing to submit to
+	if( replay_file || is_latency_probe() )
+		return init_event_loop();
+
 	{
-		printf("%s - Failed to initialize VR Compositor!\n", __FUNCTION__);
-		return false;
+		StartupTraceScope trace_scope("BInitCompositor");
+		if (!BInitCompositor())
+		{
+			printf("%s - Failed to initialize VR Compositor!\n", __FUNCTION__);
+			return false;
+		}
 	}
 
-	if(mpv_file) {
-		mpv_thread = std::thread([&]{
-			set_current_context(m_pMpvContext);
-			if(!mpv.create(use_system_mpv_config))
-				return;
-
-			mpv.load_file(mpv_file);
-			set_current_context(NULL);
-
-			while(running) {
-				set_current_context(m_pMpvContext);
-
-				if(mpv_video_loaded && !mpv_loaded_in_thread) {
-					mpv_loaded_in_thread = true;
-					// TODO: Do not create depth buffer and extra framebuffers
-					CreateFrameBuffer(mpv_video_width, mpv_video_height, mpvDesc);
-				}
-
-				if(mpv_video_loaded) {
-					glBindFramebuffer( GL_FRAMEBUFFER, mpvDesc.m_nRenderFramebufferId );
-					glViewport(0, 0, mpv_video_width, mpv_video_height);
-					if(take_render_update()) {
-						glDisable(GL_DEPTH_TEST);
-
-						glBindVertexArray( m_unCompanionWindowVAO );
-						glUseProgram( m_unCompanionWindowProgramID );
-
-						mpv.draw(mpvDesc.m_nRenderFramebufferId, mpv_video_width, mpv_video_height);
-
-						glBindVertexArray( 0 );
-						glUseProgram( 0 );
-					}
-					glBindFramebuffer( GL_FRAMEBUFFER, 0 );
-					
-					glDisable( GL_MULTISAMPLE );
-
-					glBindFramebuffer(GL_READ_FRAMEBUFFER, mpvDesc.m_nRenderFramebufferId );
-					glBindFramebuffer(GL_DRAW_FRAMEBUFFER, mpvDesc.m_nResolveFramebufferId );
-					
-					glBlitFramebuffer( 0, 0, mpv_video_width, mpv_video_height, 0, 0, mpv_video_width, mpv_video_height, 
-						GL_COLOR_BUFFER_BIT,
-						GL_LINEAR  );
-
-					glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-					glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0 );
-
-					glEnable( GL_MULTISAMPLE );
-				} else {
-					usleep(1000);
-				}
+	for ( uint32_t nDevice = 0; nDevice < vr::k_unMaxTrackedDeviceCount; ++nDevice )
+		device_classes[nDevice] = m_pHMD->GetTrackedDeviceClass( nDevice );
+	// Same tracking space as the poses WaitGetPoses returns
+	pose_sampler.start( m_pHMD, vr::VRCompositor()->GetTrackingSpace() );
 
-				set_current_context(NULL);
-			}
-		});
-	}
-	
-	vr::VROverlay()->CreateOverlay("vr-video-player", "Video Player", &overlay);
-	mpvTex = {(void*)(uintptr_t)mpvDesc.m_nResolveTextureId, vr::TextureType_OpenGL, vr::ColorSpace_Auto };
-	vr::VROverlay()->SetOverlayTexture(overlay, &mpvTex);
-	if (projection_mode != ProjectionMode::FLAT) {
-		vr::VROverlay()->SetOverlayFlag(overlay, vr::VROverlayFlags_SideBySide_Parallel, true);
+	{
+		StartupTraceScope trace_scope("create overlay");
+		vr::VROverlay()->CreateOverlay("vr-video-player", "Video Player", &overlay);
+		mpvTex = {(void*)(uintptr_t)GetMpvTextureId(), vr::TextureType_OpenGL, vr::ColorSpace_Auto };
+		vr::VROverlay()->SetOverlayTexture(overlay, &mpvTex);
+		if (projection_mode != ProjectionMode::FLAT) {
+			vr::VROverlay()->SetOverlayFlag(overlay, vr::VROverlayFlags_SideBySide_Parallel, true);
+		}
+		update_overlay_placement();
+		vr::VROverlay()->ShowOverlay(overlay);
 	}
-	vr::VROverlay()->SetOverlayWidthInMeters(overlay, 3);
-	vr::HmdMatrix34_t transform = {
-		1.0f, 0.0f, 0.0f, 0.0f,
-		0.0f, -1.0f, 0.0f, 1.0f,
-		0.0f, 0.0f, 1.0f, -2.0f
-	};
-	vr::VROverlay()->SetOverlayTransformAbsolute(overlay, vr::TrackingUniverseStanding, &transform);
-	vr::VROverlay()->ShowOverlay(overlay);
 
-	char action_manifest_path[PATH_MAX];
-	realpath("config/hellovr_actions.json", action_manifest_path);
-	if(access(action_manifest_path, F_OK) == -1) {
-		strcpy(action_manifest_path, "/usr/share/vr-video-player/hellovr_actions.json");
-		if(access(action_manifest_path, F_OK) == -1) {
-			fprintf(stderr, "Unable to find hellovr_action.json!\n");
-			return false;
-		}
+	const std::string action_manifest_path = action_manifest_future.get();
+	if(action_manifest_path.empty()) {
+		fprintf(stderr, "Unable to find hellovr_action.json!\n");
+		return false;
 	}
 
-	fprintf(stderr, "Using openvr config file: %s\n", action_manifest_path);
+	fprintf(stderr, "Using openvr config file: %s\n", action_manifest_path.c_str());
+
+	{
+		StartupTraceScope trace_scope("action manifest");
+		vr::VRInput()->SetActionManifestPath(action_manifest_path.c_str());
+		vr::VRInput()->GetActionHandle( "/actions/demo/in/HideCubes", &m_actionHideCubes );
+		vr::VRInput()->GetActionSetHandle( "/actions/demo", &m_actionsetDemo );
+	}
 
-	vr::VRInput()->SetActionManifestPath(action_manifest_path);
-	vr::VRInput()->GetActionHandle( "/actions/demo/in/HideCubes", &m_actionHideCubes );
-	vr::VRInput()->GetActionSetHandle( "/actions/demo", &m_actionsetDemo );
+	if(!init_event_loop())
+		return false;
 
 	return true;
 }
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Outputs the string in message to debugging output.
-//          All other parameters are ignored.
-//          Does not return any meaningful value or reference.
+// Purpose: Returns the time of the next headset vsync in the mpv clock, or 0
+//          if it's not known. Sets vsync_interval_us to the headset refresh
+//          interval, or 0 if it's not known.
 //-----------------------------------------------------------------------------
-void DebugCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const char* message, const void* userParam)
+int64_t CMainApplication::GetNextVsyncTimeMpv(int64_t &vsync_interval_us)
 {
-	dprintf( "GL Error: %s\n", message );
+	vsync_interval_us = 0;
+
+	const float display_frequency = hmd_display_frequency;
+	if( display_frequency <= 0.0f || !vr::VRSystem() )
+		return 0;
+
+	float seconds_since_last_vsync = 0.0f;
+	uint64_t frame_counter = 0;
+	if( !vr::VRSystem()->GetTimeSinceLastVsync( &seconds_since_last_vsync, &frame_counter ) )
+		return 0;
+
+	vsync_interval_us = (int64_t)(1000000.0 / display_frequency);
+	int64_t time_until_vsync_us = vsync_interval_us - (int64_t)(seconds_since_last_vsync * 1000000.0);
+	if( vsync_interval_us > 0 && time_until_vsync_us < 0 )
+		time_until_vsync_us = vsync_interval_us - (-time_until_vsync_us % vsync_interval_us);
+	return mpv.get_time_us() + time_until_vsync_us;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Calculates the size mpv should render the video at. That is the
+//          number of headset pixels the overlay covers (times the oversample
+//          factor), but never more than the size of the video itself. mpv then
+//          downscales the video once with its own scaler instead of the
+//          compositor sampling a texture that is much larger than the
+//          overlay is on the display.
+//-----------------------------------------------------------------------------
+void CMainApplication::GetMpvRenderTargetSize(int64_t video_width, int64_t video_height, int64_t &width, int64_t &height)
+{
+	width = video_width;
+	height = video_height;
+
+	if( !hmd_info_valid || video_width <= 0 || video_height <= 0 || m_nRenderWidth == 0 )
+		return;
+
+	const float fLeft = hmd_info.projection_raw_left[0];
+	const float fRight = hmd_info.projection_raw_left[1];
+	if( fRight - fLeft <= 0.0f )
+		return;
+
+	// The recommended render target size already includes the supersampling set in SteamVR.
+	// The overlay is viewed straight on, so its extent in tangent space is its width divided by its distance
+	const double fPixelsPerTangent = m_nRenderWidth / (double)(fRight - fLeft);
+	// A curved overlay is viewed from close to its axis, where its width divided by its distance is the angle it covers
+	double fTangentWidth = overlay_width_meters / overlay_distance_meters;
+
+	// Side by side stereo, each eye sees half of the texture stretched over the whole overlay
+	if( projection_mode != ProjectionMode::FLAT )
+		fTangentWidth *= 2.0;
+
+	// The rendered projections wrap the video around the viewer instead. Each eye's half of the sphere covers
+	// 180 degrees and sphere360 is three 90 degree cube faces wide
+	if( overlay_scene_enabled() )
+		fTangentWidth = projection_mode == ProjectionMode::SPHERE ? glm::two_pi<double>() : 6.0;
+
+	const double fTargetWidth = fPixelsPerTangent * fTangentWidth * mpv_oversample;
+
+	if( fTargetWidth >= video_width )
+		return;
+
+	width = std::max( (int64_t)2, (int64_t)llround( fTargetWidth ) );
+	height = std::max( (int64_t)2, (int64_t)llround( fTargetWidth * video_height / video_width ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Tells the mpv thread if the opengl context it renders with has been
+//          created. Only the first call has an effect.
+//-----------------------------------------------------------------------------
+void CMainApplication::set_mpv_context_ready(bool ready)
+{
+	if(mpv_context_promise_set)
+		return;
+
+	mpv_context_promise_set = true;
+	mpv_context_promise.set_value(ready);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Outputs the string in message to debugging output.
+//          All other parameters are ignored.
+//          Does not return any meaningful value or reference.
+//-----------------------------------------------------------------------------
+void DebugCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const char* message, const void* userParam)
+{
+	dprintf( "GL Error: %s\n", message );
 }
 
 
@@ -1006,10 +1920,19 @@ bool CMainApplication::BInitGL()
 	glGenVertexArrays( 1, &m_unSceneVAO );
 	glGenBuffers( 1, &m_glSceneVertBuffer );
 
-	SetupScene();
+	glGenVertexArrays( 1, &m_unProjectionVAO );
+
 	SetupCameras();
-	if(!SetupStereoRenderTargets())
-		return false;
+	// Before SetupScene, which needs to know if the multiview path is used
+	{
+		StartupTraceScope trace_scope("SetupStereoRenderTargets");
+		if(!SetupStereoRenderTargets())
+			return false;
+	}
+	{
+		StartupTraceScope trace_scope("SetupScene");
+		SetupScene();
+	}
 	SetupCompanionWindow();
 
 	return true;
@@ -1032,18 +1955,200 @@ bool CMainApplication::BInitCompositor()
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Sets the size, curvature and distance of the overlay. The plane
+//          mode is curved by the compositor instead of drawing the mesh of
+//          AddCubeToScene, the sizes follow the mesh. The sphere modes are
+//          rendered into the overlay texture by render_overlay_scene.
+//-----------------------------------------------------------------------------
+void CMainApplication::update_overlay_placement()
+{
+	if( overlay != vr::k_ulOverlayHandleInvalid && !overlay_scene_enabled()
+		&& ( projection_mode == ProjectionMode::SPHERE || projection_mode == ProjectionMode::SPHERE360 ) )
+	{
+		create_overlay_scene_target();
+	}
+	overlay_scene_dirty = true;
+
+	// Each eye sees half of a side by side texture stretched over the whole overlay
+	double eye_width_ratio = (double)pixmap_texture_width / (double)pixmap_texture_height;
+	if( projection_mode != ProjectionMode::FLAT )
+		eye_width_ratio *= 0.5;
+
+	double width = g_fOverlayWidthMeters;
+	double distance = g_fOverlayDistanceMeters;
+	double curvature = 0.0;
+	if( projection_mode == ProjectionMode::CYLINDER )
+	{
+		// The cylinder mesh is 3 units high and covers 1.6 radians. With the default zoom of 1 the viewer is on its axis
+		const double arc_radians = 1.6;
+		width = 3.0 * eye_width_ratio;
+		curvature = arc_radians / glm::two_pi<double>();
+		distance = width / arc_radians + ( zoom - 1.0 );
+	}
+	else if( overlay_scene_enabled() )
+	{
+		// A window onto the rendered sphere, the zoom is part of the rendering
+		width = 2.0 * g_fOverlayDistanceMeters * g_fOverlaySceneHalfTangentX;
+	}
+	else if( projection_mode == ProjectionMode::SPHERE )
+	{
+		// Without the overlay texture the half sphere, which covers 180 degrees around the viewer, is curved by the
+		// compositor. It only curves the overlay horizontally, so it becomes a half cylinder with the viewer on its axis
+		const double radius = g_fOverlayDistanceMeters + zoom;
+		width = glm::pi<double>() * radius;
+		curvature = 0.5;
+		distance = radius;
+	}
+	distance = std::max( distance, 0.1 );
+
+	overlay_width_meters = width;
+	overlay_distance_meters = distance;
+	overlay_curvature = curvature;
+	if( overlay == vr::k_ulOverlayHandleInvalid )
+		return;
+
+	vr::VROverlay()->SetOverlayWidthInMeters( overlay, overlay_width_meters );
+	vr::VROverlay()->SetOverlayCurvature( overlay, overlay_curvature );
+	// The window and mpv textures have the top row first, the rendered texture has it last like the eye textures
+	const float flip_y = overlay_scene_enabled() ? 1.0f : -1.0f;
+	vr::HmdMatrix34_t transform = {
+		1.0f, 0.0f, 0.0f, 0.0f,
+		0.0f, flip_y, 0.0f, 1.0f,
+		0.0f, 0.0f, 1.0f, -overlay_distance_meters
+	};
+	vr::VROverlay()->SetOverlayTransformAbsolute( overlay, vr::TrackingUniverseStanding, &transform );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Creates the side by side texture that the sphere and sphere360
+//          modes are rendered into in overlay mode, with as many pixels per
+//          tangent as the headset renders with, and the view projection of
+//          each eye through the overlay. Returns false if the setup failed,
+//          the overlay then shows the video texture like the other modes.
+//-----------------------------------------------------------------------------
+bool CMainApplication::create_overlay_scene_target()
+{
+	if( !hmd_info_valid || m_nRenderWidth == 0 )
+		return false;
+
+	const float fLeft = hmd_info.projection_raw_left[0];
+	const float fRight = hmd_info.projection_raw_left[1];
+	if( fRight - fLeft <= 0.0f )
+		return false;
+
+	const double fPixelsPerTangent = m_nRenderWidth / (double)(fRight - fLeft);
+	double fWidth = fPixelsPerTangent * 2.0 * g_fOverlaySceneHalfTangentX;
+	double fHeight = fPixelsPerTangent * 2.0 * g_fOverlaySceneHalfTangentY;
+	GLint nMaxTextureSize = 0;
+	glGetIntegerv( GL_MAX_TEXTURE_SIZE, &nMaxTextureSize );
+	if( nMaxTextureSize > 0 && fWidth * 2.0 > nMaxTextureSize )
+	{
+		fHeight *= nMaxTextureSize / ( fWidth * 2.0 );
+		fWidth = nMaxTextureSize / 2;
+	}
+	overlay_scene_width = std::max( 1, (int)fWidth );
+	overlay_scene_height = std::max( 1, (int)fHeight );
+
+	if( !CreateResolveFrameBuffer( overlay_scene_width * 2, overlay_scene_height, overlay_scene_desc ) )
+	{
+		fprintf( stderr, "Error: failed to create the %dx%d overlay texture, the projection is done by the compositor\n", overlay_scene_width * 2, overlay_scene_height );
+		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+		DeleteFrameBuffer( overlay_scene_desc );
+		return false;
+	}
+
+	// Each eye looks through the overlay from where it is when the head is at the center of the sphere. The compositor
+	// reprojects the overlay for the actual head pose, so moving the head doesn't need a new render
+	const float fHalfWidth = g_fOverlayDistanceMeters * g_fOverlaySceneHalfTangentX;
+	const float fHalfHeight = g_fOverlayDistanceMeters * g_fOverlaySceneHalfTangentY;
+	for( int nEye = 0; nEye < 2; ++nEye )
+	{
+		const float (&eye_to_head)[3][4] = hmd_info.eye_to_head[nEye];
+		const glm::vec3 eye_pos( eye_to_head[0][3], eye_to_head[1][3], eye_to_head[2][3] );
+		const float fScale = m_fNearClip / ( g_fOverlayDistanceMeters + eye_pos.z );
+		const glm::mat4 projection = glm::frustum(
+			( -fHalfWidth - eye_pos.x ) * fScale, ( fHalfWidth - eye_pos.x ) * fScale,
+			( -fHalfHeight - eye_pos.y ) * fScale, ( fHalfHeight - eye_pos.y ) * fScale,
+			m_fNearClip, m_fFarClip );
+		overlay_scene_matrix[nEye] = projection * glm::translate( glm::mat4( 1.0f ), -eye_pos );
+	}
+
+	dprintf( "Rendering the projection into a %dx%d overlay texture\n", overlay_scene_width * 2, overlay_scene_height );
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Renders each eye into its half of the overlay texture with the
+//          same programs and meshes as the headset views.
+//-----------------------------------------------------------------------------
+void CMainApplication::render_overlay_scene()
+{
+	overlay_scene_pass = true;
+
+	// Transparent where the projection doesn't cover the overlay
+	glClearColor( 0.0f, 0.0f, 0.0f, 0.0f );
+	glBindFramebuffer( GL_FRAMEBUFFER, overlay_scene_desc.m_nResolveFramebufferId );
+	// RenderScene clears the whole framebuffer, the scissor keeps that to one eye
+	glEnable( GL_SCISSOR_TEST );
+	for( int nEye = vr::Eye_Left; nEye <= vr::Eye_Right; ++nEye )
+	{
+		glViewport( nEye * overlay_scene_width, 0, overlay_scene_width, overlay_scene_height );
+		glScissor( nEye * overlay_scene_width, 0, overlay_scene_width, overlay_scene_height );
+		RenderScene( (vr::Hmd_Eye)nEye );
+	}
+	glDisable( GL_SCISSOR_TEST );
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+	overlay_scene_pass = false;
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
 void CMainApplication::Shutdown()
 {
+	// BInit may have failed while the mpv thread or VR_Init were still running
+	if(mpv_thread.joinable())
+		push_mpv_command({ MpvThreadCommand::Type::SHUTDOWN });
+	set_mpv_context_ready(false);
+	if(mpv_thread.joinable())
+		mpv_thread.join();
+
+	control_socket.destroy();
+	metrics_server_stop();
+	trace_writer.close();
+	trace_reader.close();
+	if(frame_timer_fd != -1)
+	{
+		close(frame_timer_fd);
+		frame_timer_fd = -1;
+	}
+	if(signal_fd != -1)
+	{
+		close(signal_fd);
+		signal_fd = -1;
+	}
+
+	if( vr_init_future.valid() )
+	{
+		m_pHMD = vr_init_future.get();
+		if( vr_init_error != vr::VRInitError_None )
+			m_pHMD = NULL;
+	}
+
+	pose_sampler.stop();
+
 	if( m_pHMD )
 	{
 		vr::VR_Shutdown();
 		m_pHMD = NULL;
 	}
 	
-	if( m_pContext )
+	if( m_pContext || headless_context.is_created() )
 	{
 		if(mpv_thread.joinable())
 			mpv_thread.join();
@@ -1066,26 +2171,28 @@ void CMainApplication::Shutdown()
 		{
 			glDeleteProgram( m_unCompanionWindowProgramID );
 		}
+		if ( m_unSceneMultiviewProgramID )
+		{
+			glDeleteProgram( m_unSceneMultiviewProgramID );
+		}
+		if ( m_unProjectionProgramID )
+		{
+			glDeleteProgram( m_unProjectionProgramID );
+		}
+		if ( m_unProjectionMultiviewProgramID )
+		{
+			glDeleteProgram( m_unProjectionMultiviewProgramID );
+		}
 
 		glDeleteTextures(1, &arrow_image_texture_id);
 
-		glDeleteRenderbuffers( 1, &leftEyeDesc.m_nDepthBufferId );
-		glDeleteTextures( 1, &leftEyeDesc.m_nRenderTextureId );
-		glDeleteFramebuffers( 1, &leftEyeDesc.m_nRenderFramebufferId );
-		glDeleteTextures( 1, &leftEyeDesc.m_nResolveTextureId );
-		glDeleteFramebuffers( 1, &leftEyeDesc.m_nResolveFramebufferId );
+		DeleteStereoRenderTargets();
+		DeleteFrameBuffer( overlay_scene_desc );
 
-		glDeleteRenderbuffers( 1, &rightEyeDesc.m_nDepthBufferId );
-		glDeleteTextures( 1, &rightEyeDesc.m_nRenderTextureId );
-		glDeleteFramebuffers( 1, &rightEyeDesc.m_nRenderFramebufferId );
-		glDeleteTextures( 1, &rightEyeDesc.m_nResolveTextureId );
-		glDeleteFramebuffers( 1, &rightEyeDesc.m_nResolveFramebufferId );
-
-		glDeleteRenderbuffers( 1, &mpvDesc.m_nDepthBufferId );
-		glDeleteTextures( 1, &mpvDesc.m_nRenderTextureId );
-		glDeleteFramebuffers( 1, &mpvDesc.m_nRenderFramebufferId );
-		glDeleteTextures( 1, &mpvDesc.m_nResolveTextureId );
-		glDeleteFramebuffers( 1, &mpvDesc.m_nResolveFramebufferId );
+		if( latency_probe_framebuffer != 0 )
+		{
+			glDeleteFramebuffers( 1, &latency_probe_framebuffer );
+		}
 
 		if( m_unCompanionWindowVAO != 0 )
 		{
@@ -1095,9 +2202,15 @@ void CMainApplication::Shutdown()
 		{
 			glDeleteVertexArrays( 1, &m_unSceneVAO );
 		}
+		if( m_unProjectionVAO != 0 )
+		{
+			glDeleteVertexArrays( 1, &m_unProjectionVAO );
+		}
 	}
 
 	window_texture_deinit(&window_texture);
+	headless_context.destroy();
+	latency_probe_window.destroy();
 
 	if( m_pCompanionWindow )
 	{
@@ -1109,6 +2222,8 @@ void CMainApplication::Shutdown()
 
 	if (x_display)
 		XCloseDisplay(x_display);
+
+	notification_helper_stop();
 }
 
 void CMainApplication::zoom_in() {
@@ -1117,14 +2232,7 @@ void CMainApplication::zoom_in() {
     else
         zoom -= 0.01f;
     zoom_resize = true;
-
-    std::stringstream strstr;
-    if(follow_focused)
-        strstr << "/tmp/vr-video-player_focused";
-    else
-        strstr << "/tmp/vr-video-player_" << src_window_id;
-    std::ofstream zoomstate(strstr.str());
-    zoomstate << zoom; 
+    save_zoom();
 }
 
 void CMainApplication::zoom_out() {
@@ -1133,7 +2241,10 @@ void CMainApplication::zoom_out() {
     else
         zoom += 0.01f;
     zoom_resize = true;
+    save_zoom();
+}
 
+void CMainApplication::save_zoom() {
     std::stringstream strstr;
     if(follow_focused)
         strstr << "/tmp/vr-video-player_focused";
@@ -1148,153 +2259,42 @@ void CMainApplication::zoom_out() {
 //-----------------------------------------------------------------------------
 bool CMainApplication::HandleInput()
 {
-	SDL_Event sdlEvent;
-	bool bRet = false;
-    zoom_resize = false;
-	int64_t video_width = 0;
-	int64_t video_height = 0;
-	bool mpv_quit = false;
-
-	while ( SDL_PollEvent( &sdlEvent ) != 0 )
-	{
-		if ( sdlEvent.type == SDL_QUIT )
-		{
-			bRet = true;
-		}
-		else if ( sdlEvent.type == SDL_KEYDOWN )
-		{
-			if( sdlEvent.key.keysym.sym == SDLK_w )
-			{
-				m_bResetRotation = true;
-			}
-			if( sdlEvent.key.keysym.sym == SDLK_ESCAPE )
-			{
-				bRet = true;
-			}
-			if( sdlEvent.key.keysym.sym == SDLK_q )
-			{
-                zoom_in();
-			}
-			if( sdlEvent.key.keysym.sym == SDLK_e )
-			{
-                zoom_out();
-			}
-			if(mpv_file && sdlEvent.key.keysym.sym == SDLK_LEFT)
-			{
-				mpv.seek(-5.0); // Seek backwards 5 seconds
-			}
-			if(mpv_file && sdlEvent.key.keysym.sym == SDLK_RIGHT)
-			{
-				mpv.seek(5.0); // Seek forwards 5 seconds
-			}
-			if(mpv_file && sdlEvent.key.keysym.sym == SDLK_SPACE)
-			{
-				mpv.toggle_pause();
-			}
-		}
-
-		bool opdoot = false;
-		if(mpv_file) {
-			int error = 0;
-			mpv.on_event(sdlEvent, &opdoot, &video_width, &video_height, &mpv_quit, &error);
-			if(mpv_quit && error != 0)
-				exit_code = 2;
-		}
-
-		if(opdoot)
-			set_render_update();
-
-		if(mpv_quit)
-			bRet = true;
-
-		// TODO: Allow video resize to update texture size
-		if(video_width > 0 && video_height > 0 && video_width != mpv_video_width && video_height != mpv_video_height && !mpv_video_loaded && !mpv_loaded_in_thread) {
-			mpv_video_width = video_width;
-			mpv_video_height = video_height;
-			pixmap_texture_width = mpv_video_width;
-			pixmap_texture_height = mpv_video_height;
-			mpv_video_loaded = true;
-			SetupScene();
-		}
+	if(mpv_file) {
+		process_mpv_thread_events();
+		send_mpv_resize_request();
 	}
 
-	XEvent xev;
-	
-    if(XCheckTypedEvent(x_display, MappingNotify, &xev)) {
-		XMappingEvent *mapping_ev = &xev.xmapping;
-		XRefreshKeyboardMapping(mapping_ev);
-		if(mapping_ev->request == MappingKeyboard) {
-			fprintf(stderr, "Update keyboard mapping!\n");
-			grabkeys(x_display);
-		}
+	if(mpv_create_failed) {
+		exit_code = 2;
+		return true;
 	}
-	
-    if (XCheckTypedEvent(x_display, KeyPress, &xev) && (xev.xkey.state & Mod1Mask)) {
-	    KeySym keysym = XLookupKeysym(&xev.xkey, 0);
-        if(keysym == XK_F1)
-    		m_bResetRotation = true;
-        else if(keysym == XK_q)
-            zoom_in();
-        else if(keysym == XK_e)
-            zoom_out();
-	}
-
-	if(follow_focused && ((XCheckTypedWindowEvent(x_display, DefaultRootWindow(x_display), PropertyNotify, &xev) && xev.xproperty.atom == net_active_window_atom) || !focused_window_set)) {
-		focused_window_set = true;
-		Window focused_window = get_focused_window();
-		if(focused_window && focused_window != src_window_id) {
-			fprintf(stderr, "Window focus changed to window %ld\n", focused_window);
-			src_window_id = focused_window;
-			focused_window_changed = true;
-		}
-	}
-
-	if(src_window_id) {
-		if (XCheckTypedWindowEvent(x_display, src_window_id, VisibilityNotify, &xev)) {
-			if((prev_visibility_state == VisibilityFullyObscured && xev.xvisibility.state != VisibilityFullyObscured) || (xev.xvisibility.state == prev_visibility_state)) {
-				window_resize_time = SDL_GetTicks();
-				window_resized = true;
-			}
-			prev_visibility_state = xev.xvisibility.state;
-		}
 
-		if (XCheckTypedWindowEvent(x_display, src_window_id, ConfigureNotify, &xev) && xev.xconfigure.window == src_window_id) {
-			// Window resize
-			if(xev.xconfigure.width != window_width || xev.xconfigure.height != window_height) {
-				window_width = xev.xconfigure.width;
-				window_height = xev.xconfigure.height;
-				window_resize_time = SDL_GetTicks();
-				window_resized = true;
-			}
-		}
+	// SDL queues some events internally, and Xlib can read events into its queue when waiting for a reply,
+	// so these are checked every frame even if their fd hasn't become readable
+	bool bRet = handle_sdl_events();
+	handle_x_events();
+	if(is_replaying())
+		replay_x_events();
+	process_control_commands();
 
-		if(XCheckTypedWindowEvent(x_display, src_window_id, x_fixes_event_base + XFixesCursorNotify, &xev)) {
-			XFixesCursorNotifyEvent *cursor_notify_event = (XFixesCursorNotifyEvent*)&xev;
-			if(cursor_notify_event->subtype == XFixesDisplayCursorNotify && cursor_notify_event->window == src_window_id) {
-				cursor_image_set = true;
-				SetCursorFromX11CursorImage(XFixesGetCursorImage(x_display));
-			}
-		}
-	}
+	if(follow_focused && !focused_window_set)
+		update_focused_window();
 
 	if(!cursor_image_set) {
 		cursor_image_set = true;
-		SetCursorFromX11CursorImage(XFixesGetCursorImage(x_display));
+		SetCursorFromX11CursorImage(get_cursor_image());
 	}
 
-	Uint32 time_now = SDL_GetTicks();
+	Uint32 time_now = get_input_time_ms();
 	const int window_resize_timeout = 1000; /* 1.0 second */
 	if((focused_window_changed && src_window_id) || (window_resized && time_now - window_resize_time >= window_resize_timeout)) {
-		XWindowAttributes xwa;
-		if(!XGetWindowAttributes(x_display, src_window_id, &xwa)) {
+		if(!get_window_size(src_window_id, window_width, window_height)) {
 			fprintf(stderr, "Error: Invalid window id: %lud\n", src_window_id);
 		}
-		window_width = xwa.width;
-		window_height = xwa.height;
-		window_resize_time = SDL_GetTicks();
+		window_resize_time = get_input_time_ms();
 		window_resized = false;
 
-		if(focused_window_changed) {
+		if(focused_window_changed && !is_replaying()) {
 			XSelectInput(x_display, src_window_id, StructureNotifyMask|VisibilityChangeMask|KeyPressMask|KeyReleaseMask);
 			XFixesSelectCursorInput(x_display, src_window_id, XFixesDisplayCursorNotifyMask);
 		}
@@ -1302,7 +2302,11 @@ bool CMainApplication::HandleInput()
 		focused_window_changed = false;
 		window_resized = false;
 		window_texture_deinit(&window_texture);
-		if(window_texture_init(&window_texture, x_display, src_window_id) != 0) {
+		// The recorded window doesn't exist anymore, a texture of the same size is rendered instead
+		const int texture_result = is_replaying()
+			? window_texture_init_placeholder(&window_texture, window_width, window_height)
+			: window_texture_init(&window_texture, x_display, src_window_id);
+		if(texture_result != 0) {
 			fprintf(stderr, "Failed to init texture\n");
 			//return false;
 		}
@@ -1318,30 +2322,38 @@ bool CMainApplication::HandleInput()
 	} else if(!window_resized && zoom_resize) {
 		SetupScene();
 	}
+	zoom_resize = false;
 
-	if(src_window_id) {
-		Window dummyW;
-		int dummyI;
-		unsigned int dummyU;
-		XQueryPointer(x_display, src_window_id, &dummyW, &dummyW,
-					&dummyI, &dummyI, &mouse_x, &mouse_y, &dummyU);
-	}
+	if(src_window_id)
+		query_pointer(mouse_x, mouse_y);
 
-	// Process SteamVR events
-	vr::VREvent_t event;
-	while( m_pHMD->PollNextEvent( &event, sizeof( event ) ) )
+	bool bResetAction = false;
+	if( is_replaying() )
 	{
-		ProcessVREvent( event );
+		bResetAction = ( trace_frame_flags & SESSION_TRACE_FRAME_RESET_ROTATION ) != 0;
 	}
+	else if( m_pHMD )
+	{
+		// Process SteamVR events
+		vr::VREvent_t event;
+		while( m_pHMD->PollNextEvent( &event, sizeof( event ) ) )
+		{
+			ProcessVREvent( event );
+		}
 
-	// Process SteamVR action state
-	// UpdateActionState is called each frame to update the state of the actions themselves. The application
-	// controls which action sets are active with the provided array of VRActiveActionSet_t structs.
-	vr::VRActiveActionSet_t actionSet = { 0 };
-	actionSet.ulActionSet = m_actionsetDemo;
-	vr::VRInput()->UpdateActionState( &actionSet, sizeof(actionSet), 1 );
+		// Process SteamVR action state
+		// UpdateActionState is called each frame to update the state of the actions themselves. The application
+		// controls which action sets are active with the provided array of VRActiveActionSet_t structs.
+		vr::VRActiveActionSet_t actionSet = { 0 };
+		actionSet.ulActionSet = m_actionsetDemo;
+		vr::VRInput()->UpdateActionState( &actionSet, sizeof(actionSet), 1 );
+
+		bResetAction = GetDigitalActionState( m_actionHideCubes );
+	}
 
-	if(GetDigitalActionState( m_actionHideCubes ) || m_bResetRotation) {
+	if(bResetAction || m_bResetRotation) {
+		// Resets from signals and the control socket are replayed as well
+		trace_frame_flags |= SESSION_TRACE_FRAME_RESET_ROTATION;
 		printf("reset rotation!\n");
 		//printf("pos, %f, %f, %f\n", m_mat4HMDPose[0][2], m_mat4HMDPose[1][2], m_mat4HMDPose[2][2]);
 		// m_resetPos = m_mat4HMDPose;
@@ -1353,7 +2365,7 @@ bool CMainApplication::HandleInput()
 	if(!free_camera)
 		hmd_pos = current_pos;
 
-	return bRet;
+	return bRet || quit_requested;
 }
 
 //-----------------------------------------------------------------------------
@@ -1361,21 +2373,43 @@ bool CMainApplication::HandleInput()
 //-----------------------------------------------------------------------------
 void CMainApplication::RunMainLoop()
 {
+	// Renders its test cases and exits, there is no input or event loop
+	if( render_bench )
+	{
+		run_render_bench();
+		return;
+	}
+
 	SDL_StartTextInput();
 
 	SDL_Joystick *controller = SDL_JoystickOpen(0);
 	if (!controller)
 		fprintf(stderr, "Could not open gamecontroller: %s\n", SDL_GetError());
 
+	if( is_replaying() )
+		run_replay_loop();
 
 	while ( !bQuit )
 	{
 		set_current_context(m_pContext);
-		bQuit = HandleInput();
-		if(bQuit)
-			running = false;
 
-		RenderFrame();
+		// Sleeps until there is something to do. X, mpv and signals are handled as soon as they arrive,
+		// the rest of the input and the overlay are updated when the frame timer expires
+		frame_due = false;
+		if(!event_loop.wait(-1))
+			quit_requested = true;
+
+		if(frame_due)
+		{
+			bQuit = HandleInput();
+			RenderFrame();
+		}
+		bQuit = bQuit || quit_requested;
+
+		if(bQuit && mpv_thread.joinable())
+			push_mpv_command({ MpvThreadCommand::Type::SHUTDOWN });
+
+		event_loop.update_stats();
 		set_current_context(NULL);
 	}
 
@@ -1396,15 +2430,26 @@ void CMainApplication::RunMainLoop()
 //-----------------------------------------------------------------------------
 void CMainApplication::ProcessVREvent( const vr::VREvent_t & event )
 {
+	if ( event.trackedDeviceIndex >= vr::k_unMaxTrackedDeviceCount )
+		return;
+
 	switch( event.eventType )
 	{
+	case vr::VREvent_TrackedDeviceActivated:
+		{
+			device_classes[event.trackedDeviceIndex] = m_pHMD->GetTrackedDeviceClass( event.trackedDeviceIndex );
+			dprintf( "Device %u attached.\n", event.trackedDeviceIndex );
+		}
+		break;
 	case vr::VREvent_TrackedDeviceDeactivated:
 		{
+			device_classes[event.trackedDeviceIndex] = vr::TrackedDeviceClass_Invalid;
 			dprintf( "Device %u detached.\n", event.trackedDeviceIndex );
 		}
 		break;
 	case vr::VREvent_TrackedDeviceUpdated:
 		{
+			device_classes[event.trackedDeviceIndex] = m_pHMD->GetTrackedDeviceClass( event.trackedDeviceIndex );
 			dprintf( "Device %u updated.\n", event.trackedDeviceIndex );
 		}
 		break;
@@ -1417,6 +2462,23 @@ void CMainApplication::ProcessVREvent( const vr::VREvent_t & event )
 //-----------------------------------------------------------------------------
 void CMainApplication::RenderFrame()
 {
+	// There is no overlay to submit to. The scene is rendered with the recorded poses instead, so that
+	// a replay measures the rendering of the recorded views. glFinish includes the gpu time in the frame time
+	if ( is_replaying() )
+	{
+		RenderStereoTargets();
+		glFinish();
+		UpdateHMDMatrixPose();
+		return;
+	}
+
+	// The captured texture is read back where it would be submitted
+	if ( is_latency_probe() )
+	{
+		sample_capture_latency();
+		return;
+	}
+
 	// for now as fast as possible
 	if ( m_pHMD )
 	{
@@ -1429,12 +2491,83 @@ void CMainApplication::RenderFrame()
 		//vr::VRCompositor()->Submit(vr::Eye_Right, &rightEyeTexture );
 	}
 	
-	mpvTex = {
-		(void*)(uintptr_t)(mpv_file ? mpvDesc.m_nResolveTextureId : window_texture_get_opengl_texture_id(&window_texture)),
-		vr::TextureType_OpenGL,
-		vr::ColorSpace_Auto
-	};
-	vr::VROverlay()->SetOverlayTexture(overlay, &mpvTex);
+	bool submit = true;
+	if( overlay_scene_enabled() )
+	{
+		// The compositor keeps showing the last texture and reprojects it for the head pose, so the projection is only
+		// rendered again for a new video frame. A captured window has no frame notification and is rendered every frame
+		submit = overlay_scene_dirty || !mpv_file || mpv_rendered_frame_count != overlay_scene_video_frame_count;
+		if( submit )
+		{
+			render_overlay_scene();
+			overlay_scene_dirty = false;
+			overlay_scene_video_frame_count = mpv_rendered_frame_count;
+			mpvTex = { (void*)(uintptr_t)overlay_scene_desc.m_nResolveTextureId, vr::TextureType_OpenGL, vr::ColorSpace_Auto };
+			vr::VROverlay()->SetOverlayTexture(overlay, &mpvTex);
+		}
+	}
+	else
+	{
+		mpvTex = {
+			(void*)(uintptr_t)(mpv_file ? GetMpvTextureId() : window_texture_get_opengl_texture_id(&window_texture)),
+			vr::TextureType_OpenGL,
+			vr::ColorSpace_Auto
+		};
+		vr::VROverlay()->SetOverlayTexture(overlay, &mpvTex);
+	}
+
+	if(submit) {
+		const double submit_time = metrics_time_seconds();
+		metrics_counter_add(frames_submitted_metric, 1);
+		if(prev_frame_submit_time > 0.0)
+			metrics_histogram_observe(frame_interval_metric, submit_time - prev_frame_submit_time);
+		prev_frame_submit_time = submit_time;
+		if(mpv_file) {
+			if(mpv_rendered_frame_count == prev_frame_video_frame_count)
+				metrics_counter_add(frames_stale_metric, 1);
+			prev_frame_video_frame_count = mpv_rendered_frame_count;
+		}
+	}
+
+	if( mpv_switch_pending && mpv_rendered_frame_count > mpv_switch_frame_count )
+	{
+		mpv_switch_pending = false;
+		dprintf( "Switched to the next video in %.2f ms\n", get_monotonic_time_ms() - mpv_switch_start_time_ms );
+	}
+
+	const MpvFrame &mpv_frame = mpv_front_frame;
+	if( mpv_frame.m_pTarget != mpv_submitted_frame.m_pTarget )
+	{
+		// The overlay shows the new frame from now on
+		RetireMpvFrame( mpv_submitted_frame );
+		mpv_submitted_frame = mpv_frame;
+		if( mpv_frame.m_pTarget )
+		{
+			// The rendered projection only samples the used part of the target
+			if( !overlay_scene_enabled() )
+			{
+				vr::VRTextureBounds_t bounds = { 0.0f, 0.0f, (float)mpv_frame.m_nWidth / (float)mpv_frame.m_nBucketWidth, (float)mpv_frame.m_nHeight / (float)mpv_frame.m_nBucketHeight };
+				vr::VROverlay()->SetOverlayTextureBounds( overlay, &bounds );
+			}
+
+			if( mpv_reconfig_pending && mpv_frame.m_nWidth == mpv_render_width && mpv_frame.m_nHeight == mpv_render_height )
+			{
+				mpv_reconfig_pending = false;
+				dprintf( "Video reconfigured to %dx%d in %.2f ms\n", mpv_frame.m_nWidth, mpv_frame.m_nHeight, get_monotonic_time_ms() - mpv_reconfig_request_time_ms );
+			}
+		}
+	}
+
+	// With mpv the first frames are submitted before the video has been decoded, so wait for
+	// the first frame with video in it
+	if( !first_frame_submitted && ( !mpv_file || mpv_first_frame_rendered ) )
+	{
+		first_frame_submitted = true;
+		startup_trace_mark( "first frame submitted" );
+		dprintf( "First frame submitted %.2f ms after startup\n", startup_trace_elapsed_ms() );
+		if( startup_trace_file && startup_trace_write( startup_trace_file ) )
+			dprintf( "Wrote startup trace to %s\n", startup_trace_file );
+	}
 
 	if ( m_bVblank && m_bGlFinishHack )
 	{
@@ -1470,11 +2603,23 @@ void CMainApplication::RenderFrame()
 	{
 		m_iValidPoseCount_Last = m_iValidPoseCount;
 		m_iTrackedControllerCount_Last = m_iTrackedControllerCount;
-		
+
+		m_strPoseClasses = "";
+		for ( int nDevice = 0; nDevice < (int)vr::k_unMaxTrackedDeviceCount; ++nDevice )
+		{
+			if ( m_rTrackedDevicePose[nDevice].bPoseIsValid )
+				m_strPoseClasses += m_rDevClassChar[nDevice];
+		}
 		dprintf( "PoseCount:%d(%s) Controllers:%d\n", m_iValidPoseCount, m_strPoseClasses.c_str(), m_iTrackedControllerCount );
 	}
 
 	UpdateHMDMatrixPose();
+
+	if ( trace_writer.is_open() )
+	{
+		trace_writer.end_frame( trace_frame_flags );
+		trace_frame_flags = 0;
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -1537,6 +2682,13 @@ void CMainApplication::MouseButton(int button, bool down)
 //-----------------------------------------------------------------------------
 GLuint CMainApplication::CompileGLShader( const char *pchShaderName, const char *pchVertexShader, const char *pchFragmentShader )
 {
+	if( shader_cache )
+	{
+		GLuint unCachedProgramID = program_cache_load( pchShaderName, pchVertexShader, pchFragmentShader );
+		if( unCachedProgramID != 0 )
+			return unCachedProgramID;
+	}
+
 	GLuint unProgramID = glCreateProgram();
 
 	GLuint nSceneVertexShader = glCreateShader(GL_VERTEX_SHADER);
@@ -1572,6 +2724,10 @@ GLuint CMainApplication::CompileGLShader( const char *pchShaderName, const char
 	glAttachShader( unProgramID, nSceneFragmentShader );
 	glDeleteShader( nSceneFragmentShader ); // the program hangs onto this once it's attached
 
+	const bool bCacheProgram = shader_cache && program_cache_supported();
+	if( bCacheProgram )
+		glProgramParameteri( unProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+
 	glLinkProgram( unProgramID );
 
 	GLint programSuccess = GL_TRUE;
@@ -1586,15 +2742,105 @@ GLuint CMainApplication::CompileGLShader( const char *pchShaderName, const char
 	glUseProgram( unProgramID );
 	glUseProgram( 0 );
 
+	if( bCacheProgram )
+		program_cache_save( pchShaderName, unProgramID, pchVertexShader, pchFragmentShader );
+
 	return unProgramID;
 }
 
 
+// Shared by the Scene and SceneMultiview programs. texture_bounds is the part of the texture that has the image
+// in it, the mpv render targets are rounded up to a bucket size
+static const char *g_pchSceneFragmentShader =
+	"#version 410 core\n"
+	"uniform sampler2D mytexture;\n"
+	"uniform sampler2D arrow_texture;\n"
+	"uniform vec2 texture_bounds;\n"
+	"in vec2 v2UVcoords;\n"
+	"in vec2 v2CursorLocation;\n"
+	"in vec2 arrow_size_frag;\n"
+	"out vec4 outputColor;\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 cursor_diff = (v2CursorLocation + arrow_size_frag) - v2UVcoords;\n"
+	"	vec2 arrow_coord = (arrow_size_frag - cursor_diff) / arrow_size_frag;\n"
+	"	vec4 arrow_col = texture(arrow_texture, arrow_coord);\n"
+	"	vec4 col = texture(mytexture, v2UVcoords * texture_bounds);\n"
+	"	if(arrow_size_frag.x < 0.01 || arrow_size_frag.y < 0.01 || arrow_coord.x < 0.0 || arrow_coord.x > 1.0 || arrow_coord.y < 0.0 || arrow_coord.y > 1.0) arrow_col.a = 0.0;\n"
+	"	outputColor = mix(col, arrow_col.bgra, arrow_col.a);\n"
+	"}\n";
+
+// Shared by the Projection and ProjectionMultiview programs. Intersects the view ray of each pixel with the
+// same surfaces that AddCubeToScene tessellates and computes the texture coordinate analytically:
+//   projection 0: the 180 degree half ellipsoid of the sphere mode
+//   projection 1: the six cube faces of the sphere360 mode, mapped onto the unit sphere
+static const char *g_pchProjectionFragmentShader =
+	"#version 410 core\n"
+	"uniform sampler2D mytexture;\n"
+	"uniform sampler2D arrow_texture;\n"
+	"uniform int projection;\n"
+	"uniform float texture_scale_x;\n"
+	"uniform vec2 texture_bounds;\n"
+	"uniform vec3 sphere_center;\n"
+	"uniform vec3 sphere_radius;\n"
+	"uniform mat3 face_rotation[6];\n"
+	"uniform vec4 face_rect[6];\n"
+	"noperspective in vec4 v4RayNear;\n"
+	"noperspective in vec4 v4RayFar;\n"
+	"flat in float texture_offset_frag;\n"
+	"flat in vec2 v2CursorLocation;\n"
+	"flat in vec2 arrow_size_frag;\n"
+	"out vec4 outputColor;\n"
+	"void main()\n"
+	"{\n"
+	"	vec3 origin = v4RayNear.xyz / v4RayNear.w;\n"
+	"	vec3 dir = normalize(v4RayFar.xyz / v4RayFar.w - origin);\n"
+	"	vec3 o = (origin - sphere_center) / sphere_radius;\n"
+	"	vec3 d = dir / sphere_radius;\n"
+	"	float a = dot(d, d);\n"
+	"	float b = dot(o, d);\n"
+	"	float disc = b*b - a*(dot(o, o) - 1.0);\n"
+	"	if(disc < 0.0) discard;\n"
+	"	float t_near = (-b - sqrt(disc)) / a;\n"
+	"	float t_far = (-b + sqrt(disc)) / a;\n"
+	"	vec2 uv;\n"
+	"	if(projection == 0) {\n"
+	"		vec3 p = o + t_near*d;\n"
+	"		if(t_near < 0.0 || atan(p.z, -p.x) < 0.0) p = o + t_far*d;\n"
+	"		float angle_x = atan(p.z, -p.x);\n"
+	"		float angle_y = acos(clamp(p.y, -1.0, 1.0));\n"
+	"		if(t_far < 0.0 || angle_x < 0.0 || angle_x > 3.14 || angle_y > 3.14) discard;\n"
+	"		uv = vec2(angle_x / 3.14 * texture_scale_x + texture_offset_frag, angle_y / 3.14);\n"
+	"	} else {\n"
+	"		vec3 p = o + t_far*d;\n"
+	"		vec2 half_texel = 0.5 / (vec2(textureSize(mytexture, 0)) * texture_bounds);\n"
+	"		int face = -1;\n"
+	"		vec3 l;\n"
+	"		for(int i = 0; i < 6; ++i) {\n"
+	"			l = p * face_rotation[i];\n"
+	"			if(l.z > 0.0 && abs(l.x) <= l.z && abs(l.y) <= l.z) { face = i; break; }\n"
+	"		}\n"
+	"		if(face == -1) discard;\n"
+	"		vec4 rect = face_rect[face];\n"
+	"		vec2 face_uv = rect.xy + rect.zw * (1.0 - l.xy / l.z) * 0.5;\n"
+	"		face_uv = clamp(face_uv, rect.xy + half_texel, rect.xy + rect.zw - half_texel);\n"
+	"		uv = vec2(1.0 - face_uv.x, face_uv.y) * vec2(texture_scale_x, 1.0) + vec2(texture_offset_frag, 0.0);\n"
+	"	}\n"
+	"	vec2 cursor_diff = (v2CursorLocation + arrow_size_frag) - uv;\n"
+	"	vec2 arrow_coord = (arrow_size_frag - cursor_diff) / arrow_size_frag;\n"
+	"	vec4 arrow_col = texture(arrow_texture, arrow_coord);\n"
+	"	vec4 col = texture(mytexture, uv * texture_bounds);\n"
+	"	if(arrow_size_frag.x < 0.01 || arrow_size_frag.y < 0.01 || arrow_coord.x < 0.0 || arrow_coord.x > 1.0 || arrow_coord.y < 0.0 || arrow_coord.y > 1.0) arrow_col.a = 0.0;\n"
+	"	outputColor = mix(col, arrow_col.bgra, arrow_col.a);\n"
+	"}\n";
+
 //-----------------------------------------------------------------------------
 // Purpose: Creates all the shaders used by HelloVR SDL
 //-----------------------------------------------------------------------------
 bool CMainApplication::CreateAllShaders()
 {
+	StartupTraceScope trace_scope("CreateAllShaders");
+	const double fStartTimeMs = startup_trace_elapsed_ms();
 	m_unSceneProgramID = CompileGLShader( 
 		"Scene",
 
@@ -1621,22 +2867,7 @@ bool CMainApplication::CreateAllShaders()
 		"}\n",
 
 		// Fragment Shader
-		"#version 410 core\n"
-		"uniform sampler2D mytexture;\n"
-		"uniform sampler2D arrow_texture;\n"
-		"in vec2 v2UVcoords;\n"
-		"in vec2 v2CursorLocation;\n"
-		"in vec2 arrow_size_frag;\n"
-		"out vec4 outputColor;\n"
-		"void main()\n"
-		"{\n"
-		"	vec2 cursor_diff = (v2CursorLocation + arrow_size_frag) - v2UVcoords;\n"
-		"	vec2 arrow_coord = (arrow_size_frag - cursor_diff) / arrow_size_frag;\n"
-		"	vec4 arrow_col = texture(arrow_texture, arrow_coord);\n"
-		"	vec4 col = texture(mytexture, v2UVcoords);\n"
-		"	if(arrow_size_frag.x < 0.01 || arrow_size_frag.y < 0.01 || arrow_coord.x < 0.0 || arrow_coord.x > 1.0 || arrow_coord.y < 0.0 || arrow_coord.y > 1.0) arrow_col.a = 0.0;\n"
-		"	outputColor = mix(col, arrow_col.bgra, arrow_col.a);\n"
-		"}\n"
+		g_pchSceneFragmentShader
 		);
 	m_nSceneMatrixLocation = glGetUniformLocation( m_unSceneProgramID, "matrix" );
 	if( m_nSceneMatrixLocation == -1 )
@@ -1656,6 +2887,12 @@ bool CMainApplication::CreateAllShaders()
 		dprintf( "Unable to find texture_scale_x uniform in scene shader\n" );
 		return false;
 	}
+	m_nSceneTextureBoundsLocation = glGetUniformLocation( m_unSceneProgramID, "texture_bounds" );
+	if( m_nSceneTextureBoundsLocation == -1 )
+	{
+		dprintf( "Unable to find texture_bounds uniform in scene shader\n" );
+		return false;
+	}
 	m_nCursorLocation = glGetUniformLocation( m_unSceneProgramID, "cursor_location" );
 	if( m_nCursorLocation == -1 )
 	{
@@ -1705,8 +2942,180 @@ bool CMainApplication::CreateAllShaders()
 		"}\n"
 		);
 
-	return m_unSceneProgramID != 0 
-		&& m_unCompanionWindowProgramID != 0;
+	if( m_unSceneProgramID == 0 || m_unCompanionWindowProgramID == 0 )
+		return false;
+
+	// Optional single-pass stereo program. gl_ViewID_OVR selects the per-eye matrix, texture offset and
+	// cursor location. OVR_multiview2 is required since the view id is used for more than gl_Position.
+	if( GLEW_OVR_multiview && GLEW_OVR_multiview2 )
+	{
+		m_unSceneMultiviewProgramID = CompileGLShader(
+			"SceneMultiview",
+
+			// Vertex Shader
+			"#version 410\n"
+			"#extension GL_OVR_multiview2 : require\n"
+			"layout(num_views = 2) in;\n"
+			"uniform mat4 matrix[2];\n"
+			"uniform float texture_offset_x[2];\n"
+			"uniform float texture_scale_x;\n"
+			"uniform vec2 cursor_location[2];\n"
+			"uniform vec2 arrow_size;\n"
+			"layout(location = 0) in vec4 position;\n"
+			"layout(location = 1) in vec2 v2UVcoordsIn;\n"
+			"layout(location = 2) in vec3 v3NormalIn;\n"
+			"out vec2 v2CursorLocation;\n"
+			"out vec2 arrow_size_frag;\n"
+			"out vec2 v2UVcoords;\n"
+			"void main()\n"
+			"{\n"
+			"	v2UVcoords = vec2(1.0 - v2UVcoordsIn.x, v2UVcoordsIn.y) * vec2(texture_scale_x, 1.0) + vec2(texture_offset_x[gl_ViewID_OVR], 0.0);\n"
+			"   vec4 inverse_pos = vec4(position.x, position.y, -position.z, position.w);\n"
+			"	v2CursorLocation = cursor_location[gl_ViewID_OVR];\n"
+			"	arrow_size_frag = arrow_size;\n"
+			"	gl_Position = matrix[gl_ViewID_OVR] * inverse_pos;\n"
+			"}\n",
+
+			// Fragment Shader
+			g_pchSceneFragmentShader
+			);
+
+		if( m_unSceneMultiviewProgramID != 0 )
+		{
+			m_nMultiviewMatrixLocation = glGetUniformLocation( m_unSceneMultiviewProgramID, "matrix" );
+			m_nMultiviewTextureOffsetXLocation = glGetUniformLocation( m_unSceneMultiviewProgramID, "texture_offset_x" );
+			m_nMultiviewTextureScaleXLocation = glGetUniformLocation( m_unSceneMultiviewProgramID, "texture_scale_x" );
+			m_nMultiviewTextureBoundsLocation = glGetUniformLocation( m_unSceneMultiviewProgramID, "texture_bounds" );
+			m_nMultiviewCursorLocation = glGetUniformLocation( m_unSceneMultiviewProgramID, "cursor_location" );
+			m_nMultiviewArrowSizeLocation = glGetUniformLocation( m_unSceneMultiviewProgramID, "arrow_size" );
+			if( m_nMultiviewMatrixLocation == -1 || m_nMultiviewTextureOffsetXLocation == -1 || m_nMultiviewTextureScaleXLocation == -1
+				|| m_nMultiviewTextureBoundsLocation == -1 || m_nMultiviewCursorLocation == -1 || m_nMultiviewArrowSizeLocation == -1 )
+			{
+				dprintf( "Unable to find uniforms in multiview scene shader, falling back to two-pass stereo rendering\n" );
+				glDeleteProgram( m_unSceneMultiviewProgramID );
+				m_unSceneMultiviewProgramID = 0;
+			}
+			else
+			{
+				glUseProgram( m_unSceneMultiviewProgramID );
+				glUniform1i( glGetUniformLocation( m_unSceneMultiviewProgramID, "mytexture" ), 0 );
+				glUniform1i( glGetUniformLocation( m_unSceneMultiviewProgramID, "arrow_texture" ), 1 );
+				glUseProgram( 0 );
+			}
+		}
+	}
+
+	m_unProjectionProgramID = CompileGLShader(
+		"Projection",
+
+		// Vertex Shader. Fullscreen triangle, the unprojected near and far points are linear in screen space
+		"#version 410 core\n"
+		"uniform mat4 inverse_matrix;\n"
+		"uniform float texture_offset_x;\n"
+		"uniform vec2 cursor_location;\n"
+		"uniform vec2 arrow_size;\n"
+		"noperspective out vec4 v4RayNear;\n"
+		"noperspective out vec4 v4RayFar;\n"
+		"flat out float texture_offset_frag;\n"
+		"flat out vec2 v2CursorLocation;\n"
+		"flat out vec2 arrow_size_frag;\n"
+		"void main()\n"
+		"{\n"
+		"	vec2 ndc = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2)) * 2.0 - 1.0;\n"
+		"	v4RayNear = inverse_matrix * vec4(ndc, -1.0, 1.0);\n"
+		"	v4RayFar = inverse_matrix * vec4(ndc, 1.0, 1.0);\n"
+		"	texture_offset_frag = texture_offset_x;\n"
+		"	v2CursorLocation = cursor_location;\n"
+		"	arrow_size_frag = arrow_size;\n"
+		"	gl_Position = vec4(ndc, 0.0, 1.0);\n"
+		"}\n",
+
+		// Fragment Shader
+		g_pchProjectionFragmentShader
+		);
+	if( m_unProjectionProgramID != 0 && !GetProjectionProgramLocations( m_unProjectionProgramID, m_projectionLocations ) )
+	{
+		dprintf( "Unable to find uniforms in projection shader, using the mesh projection\n" );
+		glDeleteProgram( m_unProjectionProgramID );
+		m_unProjectionProgramID = 0;
+	}
+
+	if( m_unSceneMultiviewProgramID != 0 )
+	{
+		m_unProjectionMultiviewProgramID = CompileGLShader(
+			"ProjectionMultiview",
+
+			// Vertex Shader
+			"#version 410\n"
+			"#extension GL_OVR_multiview2 : require\n"
+			"layout(num_views = 2) in;\n"
+			"uniform mat4 inverse_matrix[2];\n"
+			"uniform float texture_offset_x[2];\n"
+			"uniform vec2 cursor_location[2];\n"
+			"uniform vec2 arrow_size;\n"
+			"noperspective out vec4 v4RayNear;\n"
+			"noperspective out vec4 v4RayFar;\n"
+			"flat out float texture_offset_frag;\n"
+			"flat out vec2 v2CursorLocation;\n"
+			"flat out vec2 arrow_size_frag;\n"
+			"void main()\n"
+			"{\n"
+			"	vec2 ndc = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2)) * 2.0 - 1.0;\n"
+			"	v4RayNear = inverse_matrix[gl_ViewID_OVR] * vec4(ndc, -1.0, 1.0);\n"
+			"	v4RayFar = inverse_matrix[gl_ViewID_OVR] * vec4(ndc, 1.0, 1.0);\n"
+			"	texture_offset_frag = texture_offset_x[gl_ViewID_OVR];\n"
+			"	v2CursorLocation = cursor_location[gl_ViewID_OVR];\n"
+			"	arrow_size_frag = arrow_size;\n"
+			"	gl_Position = vec4(ndc, 0.0, 1.0);\n"
+			"}\n",
+
+			// Fragment Shader
+			g_pchProjectionFragmentShader
+			);
+		if( m_unProjectionMultiviewProgramID != 0 && !GetProjectionProgramLocations( m_unProjectionMultiviewProgramID, m_projectionMultiviewLocations ) )
+		{
+			dprintf( "Unable to find uniforms in multiview projection shader, using the mesh projection\n" );
+			glDeleteProgram( m_unProjectionMultiviewProgramID );
+			m_unProjectionMultiviewProgramID = 0;
+		}
+	}
+
+	dprintf( "Shaders created in %.2f ms (shader cache %s)\n", startup_trace_elapsed_ms() - fStartTimeMs, shader_cache && program_cache_supported() ? "enabled" : "disabled" );
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Looks up the uniforms of a projection program and binds its
+//          samplers. Returns false if any uniform is missing.
+//-----------------------------------------------------------------------------
+bool CMainApplication::GetProjectionProgramLocations( GLuint unProgramID, ProjectionProgramLocations &locations )
+{
+	locations.m_nInverseMatrixLocation = glGetUniformLocation( unProgramID, "inverse_matrix" );
+	locations.m_nTextureOffsetXLocation = glGetUniformLocation( unProgramID, "texture_offset_x" );
+	locations.m_nTextureScaleXLocation = glGetUniformLocation( unProgramID, "texture_scale_x" );
+	locations.m_nTextureBoundsLocation = glGetUniformLocation( unProgramID, "texture_bounds" );
+	locations.m_nCursorLocation = glGetUniformLocation( unProgramID, "cursor_location" );
+	locations.m_nArrowSizeLocation = glGetUniformLocation( unProgramID, "arrow_size" );
+	locations.m_nProjectionLocation = glGetUniformLocation( unProgramID, "projection" );
+	locations.m_nSphereCenterLocation = glGetUniformLocation( unProgramID, "sphere_center" );
+	locations.m_nSphereRadiusLocation = glGetUniformLocation( unProgramID, "sphere_radius" );
+	locations.m_nFaceRotationLocation = glGetUniformLocation( unProgramID, "face_rotation" );
+	locations.m_nFaceRectLocation = glGetUniformLocation( unProgramID, "face_rect" );
+
+	if( locations.m_nInverseMatrixLocation == -1 || locations.m_nTextureOffsetXLocation == -1 || locations.m_nTextureScaleXLocation == -1
+		|| locations.m_nTextureBoundsLocation == -1 || locations.m_nCursorLocation == -1 || locations.m_nArrowSizeLocation == -1 || locations.m_nProjectionLocation == -1
+		|| locations.m_nSphereCenterLocation == -1 || locations.m_nSphereRadiusLocation == -1 || locations.m_nFaceRotationLocation == -1
+		|| locations.m_nFaceRectLocation == -1 )
+	{
+		return false;
+	}
+
+	glUseProgram( unProgramID );
+	glUniform1i( glGetUniformLocation( unProgramID, "mytexture" ), 0 );
+	glUniform1i( glGetUniformLocation( unProgramID, "arrow_texture" ), 1 );
+	glUseProgram( 0 );
+	return true;
 }
 
 bool CMainApplication::SetCursorFromX11CursorImage(XFixesCursorImage *x11_cursor_image) {
@@ -1726,22 +3135,7 @@ bool CMainApplication::SetCursorFromX11CursorImage(XFixesCursorImage *x11_cursor
 	arrow_image_height = x11_cursor_image->height;
 	const unsigned long *pixels = x11_cursor_image->pixels;
 	uint8_t *cursor_data = new uint8_t[arrow_image_width * arrow_image_height * 4];
-	uint8_t *out = cursor_data;
-	/* Un-premultiply alpha */
-	for(int y = 0; y < arrow_image_height; ++y) {
-		for(int x = 0; x < arrow_image_width; ++x) {
-			uint32_t pixel = *pixels++;
-			uint8_t *in = (uint8_t*)&pixel;
-			uint8_t alpha = in[3];
-			if(alpha == 0)
-				alpha = 1;
-
-			*out++ = (unsigned)*in++ * 255/alpha;
-			*out++ = (unsigned)*in++ * 255/alpha;
-			*out++ = (unsigned)*in++ * 255/alpha;
-			*out++ = *in++;
-		}
-	}
+	cursor_unpremultiply_alpha(pixels, arrow_image_width, arrow_image_height, cursor_data);
 
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, arrow_image_width, arrow_image_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, cursor_data);
 	delete []cursor_data;
@@ -1769,17 +3163,29 @@ bool CMainApplication::SetCursorFromX11CursorImage(XFixesCursorImage *x11_cursor
 }
 
 Window CMainApplication::get_focused_window() {
+	if(is_replaying()) {
+		size_t size = 0;
+		const void *data = trace_reader.take(SessionTraceRecordType::FOCUSED_WINDOW, size);
+		uint64_t focused_window = None;
+		if(data && size == sizeof(focused_window))
+			memcpy(&focused_window, data, sizeof(focused_window));
+		return focused_window;
+	}
+
+	Window focused_window = None;
 	Atom type;
 	int format = 0;
 	unsigned long num_items = 0;
 	unsigned long bytes_after = 0;
 	unsigned char *properties = nullptr;
 	if(XGetWindowProperty(x_display, DefaultRootWindow(x_display), net_active_window_atom, 0, 1024, False, AnyPropertyType, &type, &format, &num_items, &bytes_after, &properties) == Success && properties) {
-		Window focused_window = *(unsigned long*)properties;
+		focused_window = *(unsigned long*)properties;
 		XFree(properties);
-		return focused_window;
 	}
-	return None;
+
+	const uint64_t recorded_window = focused_window;
+	trace_writer.write(SessionTraceRecordType::FOCUSED_WINDOW, &recorded_window, sizeof(recorded_window));
+	return focused_window;
 }
 
 void CMainApplication::save_config() {
@@ -1834,7 +3240,7 @@ void CMainApplication::save_config() {
 //-----------------------------------------------------------------------------
 void CMainApplication::SetupScene()
 {
-	if ( !m_pHMD )
+	if ( !hmd_info_valid )
 		return;
 
 	std::vector<float> vertdataarray;
@@ -1880,7 +3286,8 @@ void CMainApplication::SetupScene()
 	
 	glBindVertexArray( m_unSceneVAO );
 	glBindBuffer( GL_ARRAY_BUFFER, m_glSceneVertBuffer );
-	glBufferData( GL_ARRAY_BUFFER, sizeof(float) * vertdataarray.size(), &vertdataarray[0], GL_STATIC_DRAW);
+	// Empty when the projection pass is used
+	glBufferData( GL_ARRAY_BUFFER, sizeof(float) * vertdataarray.size(), vertdataarray.empty() ? nullptr : &vertdataarray[0], GL_STATIC_DRAW);
 
 	GLsizei stride = sizeof(VertexDataScene);
 	uintptr_t offset = 0;
@@ -1895,364 +3302,1391 @@ void CMainApplication::SetupScene()
 	glBindVertexArray( 0 );
 	glDisableVertexAttribArray(0);
 	glDisableVertexAttribArray(1);
+
+	update_overlay_placement();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CMainApplication::AddCubeToScene( const glm::mat4 &mat, std::vector<float> &vertdata )
+{
+	double width_ratio = (double)pixmap_texture_width / (double)pixmap_texture_height;
+	arrow_ratio = width_ratio;
+
+	Window root_window;
+	int x_return, y_return;
+	unsigned int width_return, height_return, border_width_return = 0, depth_return;
+	if(src_window_id)
+		XGetGeometry(x_display, src_window_id, &root_window, &x_return, &y_return, &width_return, &height_return, &border_width_return, &depth_return);
+
+	if(UseProjectionPass())
+	{
+		SetupProjectionPass( width_ratio, border_width_return );
+	}
+	else if(projection_mode == ProjectionMode::SPHERE)
+	{
+		scene_mesh_add_sphere( vertdata, mat, width_ratio, zoom );
+	}
+	else if (projection_mode == ProjectionMode::CYLINDER)
+	{
+		scene_mesh_add_cylinder( vertdata, width_ratio, zoom );
+	} else if (projection_mode == ProjectionMode::FLAT) {
+		scene_mesh_add_flat( vertdata, width_ratio, zoom, stretch );
+		if(stretch)
+			arrow_ratio = width_ratio * 2.0;
+	} else if (projection_mode == ProjectionMode::SPHERE360) {
+		if(!mpv_file)
+			border_width_return += 2; // Meh, hac k to deal with seams a bit
+		double px = (double)border_width_return / (double)pixmap_texture_width;
+		double py = (double)border_width_return / (double)pixmap_texture_height;
+		double hz = zoom / (double)pixmap_texture_height;
+		scene_mesh_add_sphere360( vertdata, px, py, hz );
+	}
+
+	cursor_scale_uniform[0] = 0.01 * cursor_scale;
+	cursor_scale_uniform[1] = cursor_scale_uniform[0] * arrow_ratio * ((float)arrow_image_height / (float)(arrow_image_width == 0 ? 1 : arrow_image_width));
+
+	glUseProgram( m_unSceneProgramID );
+	glUniform2fv(m_nArrowSizeLocation, 1, &cursor_scale_uniform[0]);
+	glUseProgram( 0 );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if the current projection mode is drawn with the
+//          ray-cast projection pass instead of a mesh.
+//-----------------------------------------------------------------------------
+bool CMainApplication::UseProjectionPass() const
+{
+	if( mesh_projection || (projection_mode != ProjectionMode::SPHERE && projection_mode != ProjectionMode::SPHERE360) )
+		return false;
+	// The overlay texture is rendered one eye at a time
+	return (m_bMultiview && !overlay_scene_pass ? m_unProjectionMultiviewProgramID : m_unProjectionProgramID) != 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Uploads the surface description of the current projection mode to
+//          the projection programs. Uses the same parameters as the meshes
+//          built in AddCubeToScene.
+//-----------------------------------------------------------------------------
+void CMainApplication::SetupProjectionPass( double width_ratio, unsigned int border_width )
+{
+	int projection = 0;
+	glm::vec3 sphere_center(0.0f, 0.0f, 0.0f);
+	glm::vec3 sphere_radius(1.0f, 1.0f, 1.0f);
+	glm::mat3 face_rotation[6];
+	glm::vec4 face_rect[6];
+
+	if(projection_mode == ProjectionMode::SPHERE) {
+		const double radius_height = 1.0;
+		const double radius = radius_height * width_ratio * 0.5;
+		sphere_center = glm::vec3(0.0f, 0.0f, zoom);
+		sphere_radius = glm::vec3(radius, radius_height, radius);
+	} else {
+		projection = 1;
+		// No extra border is needed to hide seams since each pixel is clamped to its own face
+		double px = (double)border_width / (double)pixmap_texture_width;
+		double py = (double)border_width / (double)pixmap_texture_height;
+
+		double width = 1.0 - px * 2.0;
+		double height = 1.0 - py * 2.0;
+
+		double hz = zoom / (double)pixmap_texture_height;
+
+		double texture_width = width / 3.0;
+		double texture_height = height * 0.5;
+
+		for(int i = 0; i < 3; ++i) {
+			face_rotation[i] = glm::mat3_cast(glm::angleAxis(-glm::half_pi<float>() + i * glm::half_pi<float>(), glm::vec3(0.0f, 1.0f, 0.0f)));
+			face_rect[i] = glm::vec4(texture_width * (2 - i) + px, py + hz, texture_width, texture_height - hz);
+		}
+
+		for(int i = 0; i < 3; ++i) {
+			glm::quat rotation_z = glm::angleAxis(-glm::half_pi<float>(), glm::vec3(0.0f, 0.0f, 1.0f));
+			glm::quat rotation_x = glm::angleAxis(-glm::half_pi<float>() - i * glm::half_pi<float>(), glm::vec3(1.0f, 0.0f, 0.0f));
+			face_rotation[3 + i] = glm::mat3_cast(rotation_x * rotation_z);
+			face_rect[3 + i] = glm::vec4(px + texture_width * i, 0.5f, texture_width, texture_height - hz);
+		}
+	}
+
+	const GLuint programs[2] = { m_unProjectionProgramID, m_unProjectionMultiviewProgramID };
+	const ProjectionProgramLocations *locations[2] = { &m_projectionLocations, &m_projectionMultiviewLocations };
+	for( int i = 0; i < 2; ++i )
+	{
+		if( programs[i] == 0 )
+			continue;
+
+		glUseProgram( programs[i] );
+		glUniform1i( locations[i]->m_nProjectionLocation, projection );
+		glUniform3fv( locations[i]->m_nSphereCenterLocation, 1, glm::value_ptr(sphere_center) );
+		glUniform3fv( locations[i]->m_nSphereRadiusLocation, 1, glm::value_ptr(sphere_radius) );
+		glUniformMatrix3fv( locations[i]->m_nFaceRotationLocation, 6, GL_FALSE, glm::value_ptr(face_rotation[0]) );
+		glUniform4fv( locations[i]->m_nFaceRectLocation, 6, glm::value_ptr(face_rect[0]) );
+	}
+	glUseProgram( 0 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CMainApplication::SetupCameras()
+{
+	m_mat4ProjectionLeft = GetHMDMatrixProjectionEye( vr::Eye_Left );
+	m_mat4ProjectionRight = GetHMDMatrixProjectionEye( vr::Eye_Right );
+	m_mat4eyePosLeft = GetHMDMatrixPoseEye( vr::Eye_Left );
+	m_mat4eyePosRight = GetHMDMatrixPoseEye( vr::Eye_Right );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Creates a frame buffer. Returns true if the buffer was set up.
+//          Returns false if the setup failed.
+//-----------------------------------------------------------------------------
+bool CMainApplication::CreateFrameBuffer( int nWidth, int nHeight, FramebufferDesc &framebufferDesc )
+{
+	glGenFramebuffers(1, &framebufferDesc.m_nRenderFramebufferId );
+	glBindFramebuffer(GL_FRAMEBUFFER, framebufferDesc.m_nRenderFramebufferId);
+
+	glGenRenderbuffers(1, &framebufferDesc.m_nDepthBufferId);
+	glBindRenderbuffer(GL_RENDERBUFFER, framebufferDesc.m_nDepthBufferId);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, 4, GL_DEPTH_COMPONENT, nWidth, nHeight );
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER,	framebufferDesc.m_nDepthBufferId );
+
+	glGenTextures(1, &framebufferDesc.m_nRenderTextureId );
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, framebufferDesc.m_nRenderTextureId );
+	glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, 4, GL_RGBA8, nWidth, nHeight, true);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, framebufferDesc.m_nRenderTextureId, 0);
+
+	return CreateResolveFrameBuffer( nWidth, nHeight, framebufferDesc );
 }
 
 
-static void AddCubeVertex( float x, float y, float z, float u, float v, std::vector<float> &vertdata )
+//-----------------------------------------------------------------------------
+// Purpose: Deletes everything created by CreateFrameBuffer.
+//-----------------------------------------------------------------------------
+void CMainApplication::DeleteFrameBuffer( FramebufferDesc &framebufferDesc )
 {
-	vertdata.push_back( x );
-	vertdata.push_back( y );
-	vertdata.push_back( z );
-	vertdata.push_back( u );
-	vertdata.push_back( v );
+	glDeleteRenderbuffers( 1, &framebufferDesc.m_nDepthBufferId );
+	glDeleteTextures( 1, &framebufferDesc.m_nRenderTextureId );
+	glDeleteFramebuffers( 1, &framebufferDesc.m_nRenderFramebufferId );
+	glDeleteTextures( 1, &framebufferDesc.m_nResolveTextureId );
+	glDeleteFramebuffers( 1, &framebufferDesc.m_nResolveFramebufferId );
+	framebufferDesc = {};
 }
 
-static void CreateSegmentedPlane(std::vector<float> &vertdata, float width, float height, float depth, float texture_width, float texture_height, float texture_offset_x, float texture_offset_y, int num_columns, int num_rows) {
-	#if 0
-	float segment_width = width / (float)num_columns;
-	float segment_height = height / (float)num_rows;
-	float segment_texture_width = texture_width / (float)num_columns;
-	float segment_texture_height = texture_height / (float)num_rows;
-	for(int y = 0; y < num_rows; ++y) {
-		float segment_height_offset = segment_height * (float)y;
-		float segment_texture_height_offset = segment_texture_height * (float)y;
-		for(int x = 0; x < num_columns; ++x) {
-			float segment_width_offset = segment_width * (float)x;
-			float segment_texture_width_offset = segment_texture_width * (float)x;
-			//segment_texture_width_offset = 0.0f;
-			//segment_texture_height_offset = 0.0f;
-			//segment_texture_width = texture_width;
-			//segment_texture_height = texture_height;
-			// AddCubeVertex(segment_width_offset + -segment_width, 	segment_height_offset +  segment_height, zoom, segment_texture_width_offset + texture_offset_x + segment_texture_width, 	segment_texture_height_offset + texture_offset_y, 							vertdata);
-			// AddCubeVertex(segment_width_offset + segment_width, 	segment_height_offset +  segment_height, zoom, segment_texture_width_offset + texture_offset_x, 							segment_texture_height_offset + texture_offset_y, 							vertdata);
-			// AddCubeVertex(segment_width_offset + -segment_width, 	segment_height_offset + -segment_height, zoom, segment_texture_width_offset + texture_offset_x + segment_texture_width, 	segment_texture_height_offset + texture_offset_y + segment_texture_height, 	vertdata);
 
-			// AddCubeVertex(segment_width_offset + -segment_width, 	segment_height_offset + -segment_height, zoom, segment_texture_width_offset + texture_offset_x + segment_texture_width, 	segment_texture_height_offset + texture_offset_y + segment_texture_height, 	vertdata);
-			// AddCubeVertex(segment_width_offset + segment_width, 	segment_height_offset + -segment_height, zoom, segment_texture_width_offset + texture_offset_x, 							segment_texture_height_offset + texture_offset_y + segment_texture_height, 	vertdata);
-			// AddCubeVertex(segment_width_offset + segment_width, 	segment_height_offset +  segment_height, zoom, segment_texture_width_offset + texture_offset_x, 							segment_texture_height_offset + texture_offset_y, 							vertdata);
+//-----------------------------------------------------------------------------
+// Purpose: Returns a render target for the mpv thread that is at least
+//          nWidth x nHeight, reusing a free target of the same bucket size
+//          if there is one. Must be called from the mpv thread.
+//-----------------------------------------------------------------------------
+CMainApplication::MpvRenderTarget* CMainApplication::AcquireMpvRenderTarget( int nWidth, int nHeight )
+{
+	const int nBucketSize = 256;
+	const int nBucketWidth = (nWidth + nBucketSize - 1) / nBucketSize * nBucketSize;
+	const int nBucketHeight = (nHeight + nBucketSize - 1) / nBucketSize * nBucketSize;
+
+	MpvRenderTarget *pTarget = nullptr;
+	for( size_t i = 0; i < mpv_free_render_targets.size(); ++i )
+	{
+		if( mpv_free_render_targets[i]->m_nBucketWidth == nBucketWidth && mpv_free_render_targets[i]->m_nBucketHeight == nBucketHeight )
+		{
+			pTarget = mpv_free_render_targets[i];
+			mpv_free_render_targets.erase( mpv_free_render_targets.begin() + i );
+			break;
 		}
 	}
-	#endif
-	float segment_width = width / (float)num_columns;
-	float segment_height = height / (float)num_rows;
-	float segment_texture_width = texture_width / (float)num_columns;
-	float segment_texture_height = texture_height / (float)num_rows;
 
-	for(int y = 0; y < num_rows; ++y) {
-		float segment_height_offset = height - segment_height * 2.0f * (float)y;
-		float segment_texture_height_offset = segment_texture_height * (float)y;
-		for(int x = 0; x < num_columns; ++x) {
-			float segment_width_offset = width - segment_width * 2.0f * (float)x;
-			float segment_texture_width_offset = segment_texture_width * (float)x;
+	if( !pTarget )
+	{
+		pTarget = new MpvRenderTarget();
+		pTarget->m_desc = {};
+		pTarget->m_nBucketWidth = nBucketWidth;
+		pTarget->m_nBucketHeight = nBucketHeight;
+		// TODO: Do not create depth buffer and extra framebuffers
+		CreateFrameBuffer( nBucketWidth, nBucketHeight, pTarget->m_desc );
+		mpv_render_targets.push_back( pTarget );
+	}
+
+	pTarget->m_nWidth = nWidth;
+	pTarget->m_nHeight = nHeight;
+	return pTarget;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns a render target to the pool. Only a couple of free targets
+//          are kept around, the oldest ones are deleted. Must be called from
+//          the mpv thread.
+//-----------------------------------------------------------------------------
+void CMainApplication::ReleaseMpvRenderTarget( MpvRenderTarget *pTarget )
+{
+	const size_t unMaxFreeTargets = 2;
+	mpv_free_render_targets.push_back( pTarget );
+	while( mpv_free_render_targets.size() > unMaxFreeTargets )
+	{
+		MpvRenderTarget *pOldest = mpv_free_render_targets.front();
+		mpv_free_render_targets.erase( mpv_free_render_targets.begin() );
+		mpv_render_targets.erase( std::find( mpv_render_targets.begin(), mpv_render_targets.end(), pOldest ) );
+		DeleteFrameBuffer( pOldest->m_desc );
+		delete pOldest;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: The texture with the latest video frame, or 0 if no frame has been
+//          rendered yet.
+//-----------------------------------------------------------------------------
+GLuint CMainApplication::GetMpvTextureId()
+{
+	return mpv_front_frame.m_nTextureId;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Gives the target of a frame that isn't shown anymore back to the
+//          mpv thread. Must be called from the main thread.
+//-----------------------------------------------------------------------------
+void CMainApplication::RetireMpvFrame( const MpvFrame &frame )
+{
+	if( !frame.m_pTarget )
+		return;
+
+	// There are never more than k_nMaxPublishedMpvTargets targets in flight
+	if( !mpv_retired_targets.push( frame.m_pTarget ) )
+		fprintf( stderr, "Error: the retired mpv render target queue is full\n" );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Creates only the single sampled resolve part of a frame buffer.
+//          Returns false if the setup failed.
+//-----------------------------------------------------------------------------
+bool CMainApplication::CreateResolveFrameBuffer( int nWidth, int nHeight, FramebufferDesc &framebufferDesc )
+{
+	glGenFramebuffers(1, &framebufferDesc.m_nResolveFramebufferId );
+	glBindFramebuffer(GL_FRAMEBUFFER, framebufferDesc.m_nResolveFramebufferId);
+
+	glGenTextures(1, &framebufferDesc.m_nResolveTextureId );
+	glBindTexture(GL_TEXTURE_2D, framebufferDesc.m_nResolveTextureId );
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, nWidth, nHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, framebufferDesc.m_nResolveTextureId, 0);
+
+	// check FBO status
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		return false;
+	}
+
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Creates a two layer multisampled render target for single-pass
+//          stereo rendering, plus one read framebuffer per layer for the
+//          resolve. Returns false if the setup failed.
+//-----------------------------------------------------------------------------
+bool CMainApplication::CreateMultiviewFrameBuffer( int nWidth, int nHeight, MultiviewFramebufferDesc &framebufferDesc )
+{
+	glGenFramebuffers(1, &framebufferDesc.m_nRenderFramebufferId );
+	glBindFramebuffer(GL_FRAMEBUFFER, framebufferDesc.m_nRenderFramebufferId);
+
+	// Renderbuffers can't be layered, so depth is a multisample array texture as well
+	glGenTextures(1, &framebufferDesc.m_nDepthTextureId );
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE_ARRAY, framebufferDesc.m_nDepthTextureId );
+	glTexImage3DMultisample(GL_TEXTURE_2D_MULTISAMPLE_ARRAY, 4, GL_DEPTH_COMPONENT24, nWidth, nHeight, 2, true);
+	glFramebufferTextureMultiviewOVR(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, framebufferDesc.m_nDepthTextureId, 0, 0, 2);
 
-			AddCubeVertex(segment_width_offset, segment_height_offset, depth, segment_texture_width_offset + texture_offset_x, segment_texture_height_offset + texture_offset_y, vertdata);
-			AddCubeVertex(segment_width_offset - segment_width*2.0f, segment_height_offset, depth, segment_texture_width_offset + texture_offset_x + segment_texture_width, segment_texture_height_offset + texture_offset_y, vertdata);
-			AddCubeVertex(segment_width_offset - segment_width*2.0f, segment_height_offset - segment_height*2.0f, depth, segment_texture_width_offset + texture_offset_x + segment_texture_width, segment_texture_height_offset + texture_offset_y + segment_texture_height, vertdata);
+	glGenTextures(1, &framebufferDesc.m_nRenderTextureId );
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE_ARRAY, framebufferDesc.m_nRenderTextureId );
+	glTexImage3DMultisample(GL_TEXTURE_2D_MULTISAMPLE_ARRAY, 4, GL_RGBA8, nWidth, nHeight, 2, true);
+	glFramebufferTextureMultiviewOVR(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, framebufferDesc.m_nRenderTextureId, 0, 0, 2);
+
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE_ARRAY, 0 );
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+		return false;
+	}
 
-			AddCubeVertex(segment_width_offset - segment_width*2.0f, segment_height_offset - segment_height*2.0f, depth, segment_texture_width_offset + texture_offset_x + segment_texture_width, segment_texture_height_offset + texture_offset_y + segment_texture_height, vertdata);
-			AddCubeVertex(segment_width_offset, segment_height_offset - segment_height*2.0f, depth, segment_texture_width_offset + texture_offset_x, segment_texture_height_offset + texture_offset_y + segment_texture_height, vertdata);
-			AddCubeVertex(segment_width_offset, segment_height_offset, depth, segment_texture_width_offset + texture_offset_x, segment_texture_height_offset + texture_offset_y, vertdata);
+	// glBlitFramebuffer only reads from a single layer
+	glGenFramebuffers(2, framebufferDesc.m_nLayerFramebufferId );
+	for( int nLayer = 0; nLayer < 2; ++nLayer )
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, framebufferDesc.m_nLayerFramebufferId[nLayer]);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, framebufferDesc.m_nRenderTextureId, 0, nLayer);
+		status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+			return false;
+		}
+	}
+
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Registers X, SDL, mpv, signals and the frame timer with the event
+//          loop that RunMainLoop sleeps in.
+//-----------------------------------------------------------------------------
+bool CMainApplication::init_event_loop()
+{
+	if(!event_loop.create())
+		return false;
+
+	x_event_handlers[MappingNotify] = &CMainApplication::on_x_mapping_notify;
+	x_event_handlers[KeyPress] = &CMainApplication::on_x_key_press;
+	x_event_handlers[PropertyNotify] = &CMainApplication::on_x_property_notify;
+	x_event_handlers[VisibilityNotify] = &CMainApplication::on_x_visibility_notify;
+	x_event_handlers[ConfigureNotify] = &CMainApplication::on_x_configure_notify;
+	x_event_handlers[(x_fixes_event_base + XFixesCursorNotify) & 0x7f] = &CMainApplication::on_x_cursor_notify;
+	if(!event_loop.add_fd(ConnectionNumber(x_display), [this]{ handle_x_events(); }))
+		return false;
+
+	// The companion window has its own X connection
+	SDL_SysWMinfo wm_info;
+	SDL_VERSION(&wm_info.version);
+	if(SDL_GetWindowWMInfo(m_pCompanionWindow, &wm_info) && wm_info.subsystem == SDL_SYSWM_X11)
+		event_loop.add_fd(ConnectionNumber(wm_info.info.x11.display), [this]{ if(handle_sdl_events()) quit_requested = true; });
+
+	sigset_t signal_mask;
+	get_event_loop_signals(signal_mask);
+	signal_fd = event_loop_create_signalfd(signal_mask);
+	if(signal_fd == -1 || !event_loop.add_fd(signal_fd, [this]{ handle_signals(); }))
+		return false;
+
+	const float display_frequency = hmd_display_frequency;
+	const int64_t frame_interval_us = (int64_t)(1000000.0 / (display_frequency > 0.0f ? display_frequency : 90.0f));
+	frame_timer_fd = event_loop_create_timer(frame_interval_us);
+	if(frame_timer_fd == -1 || !event_loop.add_fd(frame_timer_fd, [this]{ handle_frame_timer(); }))
+		return false;
+
+	// The player works without it, for example when another instance is already using the socket
+	if(control_socket_enabled) {
+		if(control_socket_path.empty())
+			control_socket_path = control_socket_get_default_path();
+		if(control_socket.create(control_socket_path, event_loop))
+			fprintf(stderr, "Listening for commands on %s\n", control_socket_path.c_str());
+	}
+
+	if(metrics_port > 0 && metrics_server_start(metrics_port) == 0)
+		fprintf(stderr, "Serving metrics on http://127.0.0.1:%d/metrics\n", metrics_port);
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Dispatches every queued X event once to its handler. Events without
+//          a handler are dropped.
+//-----------------------------------------------------------------------------
+void CMainApplication::handle_x_events()
+{
+	while(XPending(x_display))
+	{
+		XEvent xev;
+		XNextEvent(x_display, &xev);
+		// The events of a replayed session come from the trace instead
+		if(is_replaying())
+			continue;
+
+		XEventHandler handler = x_event_handlers[xev.type & 0x7f];
+		if(handler)
+		{
+			record_x_event(xev);
+			(this->*handler)(xev);
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns true if the application should quit.
+//-----------------------------------------------------------------------------
+bool CMainApplication::handle_sdl_events()
+{
+	SDL_Event sdlEvent;
+	bool bRet = false;
+	while ( SDL_PollEvent( &sdlEvent ) != 0 )
+	{
+		if ( sdlEvent.type == SDL_QUIT )
+		{
+			bRet = true;
+		}
+		else if ( sdlEvent.type == SDL_KEYDOWN )
+		{
+			if( sdlEvent.key.keysym.sym == SDLK_w )
+			{
+				m_bResetRotation = true;
+			}
+			if( sdlEvent.key.keysym.sym == SDLK_ESCAPE )
+			{
+				bRet = true;
+			}
+			if( sdlEvent.key.keysym.sym == SDLK_q )
+			{
+                zoom_in();
+			}
+			if( sdlEvent.key.keysym.sym == SDLK_e )
+			{
+                zoom_out();
+			}
+			if(mpv_file && sdlEvent.key.keysym.sym == SDLK_LEFT)
+			{
+				push_mpv_command({ MpvThreadCommand::Type::SEEK, 0, 0, -5.0 }); // Seek backwards 5 seconds
+			}
+			if(mpv_file && sdlEvent.key.keysym.sym == SDLK_RIGHT)
+			{
+				push_mpv_command({ MpvThreadCommand::Type::SEEK, 0, 0, 5.0 }); // Seek forwards 5 seconds
+			}
+			if(mpv_file && sdlEvent.key.keysym.sym == SDLK_SPACE)
+			{
+				push_mpv_command({ MpvThreadCommand::Type::TOGGLE_PAUSE });
+			}
+			if(mpv_file && sdlEvent.key.keysym.sym == SDLK_n)
+			{
+				push_mpv_command({ MpvThreadCommand::Type::PLAYLIST_NEXT });
+			}
+			if(mpv_file && sdlEvent.key.keysym.sym == SDLK_p)
+			{
+				push_mpv_command({ MpvThreadCommand::Type::PLAYLIST_PREV });
+			}
+		}
+	}
+	return bRet;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CMainApplication::handle_signals()
+{
+	struct signalfd_siginfo siginfo;
+	while(read(signal_fd, &siginfo, sizeof(siginfo)) == sizeof(siginfo))
+	{
+		switch(siginfo.ssi_signo)
+		{
+			case SIGUSR1:
+			case SIGUSR2:
+				printf("ok\n");
+				ResetRotation();
+				break;
+			case SIGINT:
+			case SIGTERM:
+				quit_requested = true;
+				break;
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CMainApplication::handle_frame_timer()
+{
+	double latency_ms = 0.0;
+	if(event_loop_read_timer(frame_timer_fd, latency_ms) == 0)
+		return;
+
+	frame_due = true;
+	event_loop.add_latency_sample(latency_ms);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Applies the commands received on the control socket since the last
+//          frame, in order, and replies to each of them.
+//-----------------------------------------------------------------------------
+void CMainApplication::process_control_commands()
+{
+	control_socket.take_commands(control_commands);
+	for(const ControlCommand &command : control_commands)
+	{
+		const bool mpv_command = command.type == ControlCommandType::SEEK || command.type == ControlCommandType::PAUSE
+			|| command.type == ControlCommandType::RESUME || command.type == ControlCommandType::TOGGLE_PAUSE
+			|| command.type == ControlCommandType::LOAD || command.type == ControlCommandType::NEXT || command.type == ControlCommandType::PREV;
+		if(mpv_command && !mpv_file) {
+			control_socket.reply_error(command, "only available when playing a video with --video");
+			continue;
+		}
+
+		char result[256];
+		result[0] = '\0';
+		bool queued = true;
+		switch(command.type)
+		{
+			case ControlCommandType::SEEK:
+				queued = push_mpv_command({ MpvThreadCommand::Type::SEEK, 0, 0, command.value });
+				break;
+			case ControlCommandType::PAUSE:
+				queued = push_mpv_command({ MpvThreadCommand::Type::PAUSE });
+				break;
+			case ControlCommandType::RESUME:
+				queued = push_mpv_command({ MpvThreadCommand::Type::RESUME });
+				break;
+			case ControlCommandType::TOGGLE_PAUSE:
+				queued = push_mpv_command({ MpvThreadCommand::Type::TOGGLE_PAUSE });
+				break;
+			case ControlCommandType::ZOOM_IN:
+				zoom_in();
+				break;
+			case ControlCommandType::ZOOM_OUT:
+				zoom_out();
+				break;
+			case ControlCommandType::ZOOM:
+				if(!std::isfinite(command.value) || command.value <= 0.0) {
+					control_socket.reply_error(command, "the zoom level has to be a positive number");
+					continue;
+				}
+				zoom = command.value;
+				zoom_resize = true;
+				save_zoom();
+				break;
+			case ControlCommandType::RESET:
+				m_bResetRotation = true;
+				break;
+			case ControlCommandType::LOAD:
+				// mpv opens the file asynchronously, so ok only means that the file is going to be loaded
+				queued = push_mpv_command({ MpvThreadCommand::Type::LOAD, 0, 0, 0.0, command.path });
+				break;
+			case ControlCommandType::NEXT:
+				queued = push_mpv_command({ MpvThreadCommand::Type::PLAYLIST_NEXT });
+				break;
+			case ControlCommandType::PREV:
+				queued = push_mpv_command({ MpvThreadCommand::Type::PLAYLIST_PREV });
+				break;
+			case ControlCommandType::STATE:
+				// These read mpv properties, which is safe to do from any thread
+				if(mpv_file)
+					snprintf(result, sizeof(result), "paused=%d zoom=%f position=%.3f duration=%.3f", mpv.get_paused() ? 1 : 0, zoom, mpv.get_position(), mpv.get_duration());
+				else
+					snprintf(result, sizeof(result), "zoom=%f window=%lu", zoom, (unsigned long)src_window_id);
+				break;
+		}
+		if(!queued) {
+			control_socket.reply_error(command, "the mpv thread is busy, try again");
+			continue;
+		}
+		control_socket.reply_ok(command, result);
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CMainApplication::update_focused_window()
+{
+	focused_window_set = true;
+	Window focused_window = get_focused_window();
+	if(focused_window && focused_window != src_window_id) {
+		fprintf(stderr, "Window focus changed to window %ld\n", focused_window);
+		src_window_id = focused_window;
+		focused_window_changed = true;
+	}
+}
+
+void CMainApplication::on_x_mapping_notify(XEvent &xev)
+{
+	XMappingEvent *mapping_ev = &xev.xmapping;
+	XRefreshKeyboardMapping(mapping_ev);
+	if(mapping_ev->request == MappingKeyboard) {
+		fprintf(stderr, "Update keyboard mapping!\n");
+		grabkeys(x_display);
+	}
+}
+
+void CMainApplication::on_x_key_press(XEvent &xev)
+{
+	if(!(xev.xkey.state & Mod1Mask))
+		return;
+
+	KeySym keysym = XLookupKeysym(&xev.xkey, 0);
+	if(keysym == XK_F1)
+		m_bResetRotation = true;
+	else if(keysym == XK_q)
+		zoom_in();
+	else if(keysym == XK_e)
+		zoom_out();
+}
+
+void CMainApplication::on_x_property_notify(XEvent &xev)
+{
+	if(follow_focused && xev.xproperty.window == DefaultRootWindow(x_display) && xev.xproperty.atom == net_active_window_atom)
+		update_focused_window();
+}
+
+void CMainApplication::on_x_visibility_notify(XEvent &xev)
+{
+	if(!src_window_id || xev.xvisibility.window != src_window_id)
+		return;
+
+	if((prev_visibility_state == VisibilityFullyObscured && xev.xvisibility.state != VisibilityFullyObscured) || (xev.xvisibility.state == prev_visibility_state)) {
+		window_resize_time = get_input_time_ms();
+		window_resized = true;
+	}
+	prev_visibility_state = xev.xvisibility.state;
+}
+
+void CMainApplication::on_x_configure_notify(XEvent &xev)
+{
+	if(!src_window_id || xev.xconfigure.window != src_window_id)
+		return;
+
+	// Window resize
+	if(xev.xconfigure.width != window_width || xev.xconfigure.height != window_height) {
+		window_width = xev.xconfigure.width;
+		window_height = xev.xconfigure.height;
+		window_resize_time = get_input_time_ms();
+		window_resized = true;
+	}
+}
+
+void CMainApplication::on_x_cursor_notify(XEvent &xev)
+{
+	XFixesCursorNotifyEvent *cursor_notify_event = (XFixesCursorNotifyEvent*)&xev;
+	if(src_window_id && cursor_notify_event->subtype == XFixesDisplayCursorNotify && cursor_notify_event->window == src_window_id) {
+		cursor_image_set = true;
+		SetCursorFromX11CursorImage(get_cursor_image());
+	}
+}
+
+void CMainApplication::observe_x_round_trip(double start_time)
+{
+	metrics_counter_add(x_round_trips_metric, 1);
+	metrics_histogram_observe(x_round_trip_time_metric, metrics_time_seconds() - start_time);
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads the headset properties the renderer needs once, from the vr
+//          runtime or from the header of the replayed trace.
+//-----------------------------------------------------------------------------
+void CMainApplication::init_hmd_info()
+{
+	static_assert(sizeof(hmd_info.projection[0]) == sizeof(vr::HmdMatrix44_t::m), "");
+	static_assert(sizeof(hmd_info.eye_to_head[0]) == sizeof(vr::HmdMatrix34_t::m), "");
+
+	hmd_info_valid = false;
+	if(is_replaying())
+	{
+		hmd_info = trace_reader.get_header().hmd_info;
+		hmd_info_valid = true;
+		return;
+	}
+
+	if(!m_pHMD)
+		return;
+
+	m_pHMD->GetRecommendedRenderTargetSize(&hmd_info.render_width, &hmd_info.render_height);
+	hmd_info.display_frequency = m_pHMD->GetFloatTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_DisplayFrequency_Float);
+	m_pHMD->GetProjectionRaw(vr::Eye_Left, &hmd_info.projection_raw_left[0], &hmd_info.projection_raw_left[1], &hmd_info.projection_raw_left[2], &hmd_info.projection_raw_left[3]);
+	for(vr::Hmd_Eye eye : { vr::Eye_Left, vr::Eye_Right })
+	{
+		const vr::HmdMatrix44_t projection = m_pHMD->GetProjectionMatrix(eye, m_fNearClip, m_fFarClip);
+		memcpy(hmd_info.projection[eye], projection.m, sizeof(projection.m));
+		const vr::HmdMatrix34_t eye_to_head = m_pHMD->GetEyeToHeadTransform(eye);
+		memcpy(hmd_info.eye_to_head[eye], eye_to_head.m, sizeof(eye_to_head.m));
+	}
+	const vr::HmdMatrix34_t seated_to_standing = m_pHMD->GetSeatedZeroPoseToStandingAbsoluteTrackingPose();
+	memcpy(hmd_info.seated_to_standing, seated_to_standing.m, sizeof(seated_to_standing.m));
+	hmd_info_valid = true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Sets x and y to the position of the cursor in the captured window.
+//          Returns false if the position isn't known, the values are unchanged then.
+//-----------------------------------------------------------------------------
+bool CMainApplication::query_pointer(int &x, int &y)
+{
+	SessionTracePointer pointer;
+	if(is_replaying())
+	{
+		size_t size = 0;
+		const void *data = trace_reader.take(SessionTraceRecordType::POINTER, size);
+		if(!data || size != sizeof(pointer))
+			return false;
+		memcpy(&pointer, data, sizeof(pointer));
+		x = pointer.x;
+		y = pointer.y;
+		return true;
+	}
+
+	Window dummyW;
+	int dummyI;
+	unsigned int dummyU;
+	const double request_start_time = metrics_time_seconds();
+	const Bool result = XQueryPointer(x_display, src_window_id, &dummyW, &dummyW,
+				&dummyI, &dummyI, &x, &y, &dummyU);
+	observe_x_round_trip(request_start_time);
+
+	pointer.x = x;
+	pointer.y = y;
+	trace_writer.write(SessionTraceRecordType::POINTER, &pointer, sizeof(pointer));
+	return result;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns false if the window doesn't exist, the size is unchanged then.
+//-----------------------------------------------------------------------------
+bool CMainApplication::get_window_size(Window window, int &width, int &height)
+{
+	SessionTraceWindowSize window_size = {};
+	if(is_replaying())
+	{
+		size_t size = 0;
+		const void *data = trace_reader.take(SessionTraceRecordType::WINDOW_SIZE, size);
+		if(!data || size != sizeof(window_size))
+			return false;
+		memcpy(&window_size, data, sizeof(window_size));
+	}
+	else
+	{
+		XWindowAttributes xwa;
+		const double request_start_time = metrics_time_seconds();
+		window_size.valid = XGetWindowAttributes(x_display, window, &xwa) != 0;
+		observe_x_round_trip(request_start_time);
+		if(window_size.valid)
+		{
+			window_size.width = xwa.width;
+			window_size.height = xwa.height;
+		}
+		trace_writer.write(SessionTraceRecordType::WINDOW_SIZE, &window_size, sizeof(window_size));
+	}
+
+	if(!window_size.valid)
+		return false;
+
+	width = window_size.width;
+	height = window_size.height;
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the current cursor image (or nullptr), which should be
+//          freed with XFree.
+//-----------------------------------------------------------------------------
+XFixesCursorImage* CMainApplication::get_cursor_image()
+{
+	SessionTraceCursorImage image_header = {};
+	if(is_replaying())
+	{
+		size_t size = 0;
+		const uint8_t *data = (const uint8_t*)trace_reader.take(SessionTraceRecordType::CURSOR_IMAGE, size);
+		if(!data || size < sizeof(image_header))
+			return nullptr;
+		memcpy(&image_header, data, sizeof(image_header));
+		const size_t num_pixels = (size_t)image_header.width * image_header.height;
+		if(num_pixels == 0 || size != sizeof(image_header) + num_pixels * sizeof(uint32_t))
+			return nullptr;
+
+		// A single allocation like the one XFixesGetCursorImage returns, so it can be freed with XFree
+		XFixesCursorImage *cursor_image = (XFixesCursorImage*)calloc(1, sizeof(XFixesCursorImage) + num_pixels * sizeof(unsigned long));
+		if(!cursor_image)
+			return nullptr;
+		cursor_image->width = image_header.width;
+		cursor_image->height = image_header.height;
+		cursor_image->xhot = image_header.xhot;
+		cursor_image->yhot = image_header.yhot;
+		cursor_image->pixels = (unsigned long*)(cursor_image + 1);
+		const uint8_t *pixels = data + sizeof(image_header);
+		for(size_t i = 0; i < num_pixels; ++i)
+		{
+			uint32_t pixel;
+			memcpy(&pixel, pixels + i * sizeof(pixel), sizeof(pixel));
+			cursor_image->pixels[i] = pixel;
+		}
+		return cursor_image;
+	}
+
+	const double request_start_time = metrics_time_seconds();
+	XFixesCursorImage *cursor_image = XFixesGetCursorImage(x_display);
+	observe_x_round_trip(request_start_time);
+
+	if(trace_writer.is_open())
+	{
+		// Pixels are 32-bit ARGB stored in longs
+		std::vector<uint32_t> pixels;
+		if(cursor_image && cursor_image->pixels)
+		{
+			image_header.width = cursor_image->width;
+			image_header.height = cursor_image->height;
+			image_header.xhot = cursor_image->xhot;
+			image_header.yhot = cursor_image->yhot;
+			pixels.assign(cursor_image->pixels, cursor_image->pixels + (size_t)cursor_image->width * cursor_image->height);
+		}
+		trace_writer.write(SessionTraceRecordType::CURSOR_IMAGE, &image_header, sizeof(image_header), pixels.data(), pixels.size() * sizeof(uint32_t));
+	}
+	return cursor_image;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Keyboard mapping changes are not recorded, the mapping of the X
+//          server that replays the session is used.
+//-----------------------------------------------------------------------------
+void CMainApplication::record_x_event(const XEvent &xev)
+{
+	if(xev.type != MappingNotify)
+		trace_writer.write(SessionTraceRecordType::X_EVENT, &xev, sizeof(xev));
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Dispatches the X events of the replayed frame, like handle_x_events
+//          does with live events.
+//-----------------------------------------------------------------------------
+void CMainApplication::replay_x_events()
+{
+	while(true)
+	{
+		size_t size = 0;
+		const void *data = trace_reader.take(SessionTraceRecordType::X_EVENT, size);
+		if(!data)
+			break;
+		if(size != sizeof(XEvent))
+			continue;
+
+		XEvent xev;
+		memcpy(&xev, data, sizeof(xev));
+		// XLookupKeysym uses the display of the event
+		xev.xany.display = x_display;
+		XEventHandler handler = x_event_handlers[xev.type & 0x7f];
+		if(handler)
+			(this->*handler)(xev);
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Only the valid poses are recorded.
+//-----------------------------------------------------------------------------
+void CMainApplication::record_poses(const vr::ETrackedDeviceClass *device_classes)
+{
+	SessionTracePose poses[ vr::k_unMaxTrackedDeviceCount ];
+	uint32_t num_poses = 0;
+	for ( uint32_t nDevice = 0; nDevice < vr::k_unMaxTrackedDeviceCount; ++nDevice )
+	{
+		if ( !m_rTrackedDevicePose[nDevice].bPoseIsValid )
+			continue;
+
+		SessionTracePose &pose = poses[num_poses++];
+		pose.device_index = nDevice;
+		pose.device_class = device_classes[nDevice];
+		memcpy( pose.device_to_absolute_tracking, m_rTrackedDevicePose[nDevice].mDeviceToAbsoluteTracking.m, sizeof( pose.device_to_absolute_tracking ) );
+	}
+
+	const uint32_t poses_header[2] = { num_poses, 0 };
+	trace_writer.write( SessionTraceRecordType::POSES, poses_header, sizeof( poses_header ), poses, num_poses * sizeof( SessionTracePose ) );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Sets the poses and device classes to the recorded ones. Poses that
+//          weren't recorded are invalid.
+//-----------------------------------------------------------------------------
+void CMainApplication::replay_poses(vr::ETrackedDeviceClass *device_classes)
+{
+	for ( uint32_t nDevice = 0; nDevice < vr::k_unMaxTrackedDeviceCount; ++nDevice )
+		m_rTrackedDevicePose[nDevice].bPoseIsValid = false;
+
+	size_t size = 0;
+	const uint8_t *data = (const uint8_t*)trace_reader.take( SessionTraceRecordType::POSES, size );
+	uint32_t poses_header[2] = {};
+	if ( !data || size < sizeof( poses_header ) )
+		return;
+	memcpy( poses_header, data, sizeof( poses_header ) );
+	if ( size != sizeof( poses_header ) + poses_header[0] * sizeof( SessionTracePose ) )
+		return;
+
+	for ( uint32_t i = 0; i < poses_header[0]; ++i )
+	{
+		SessionTracePose pose;
+		memcpy( &pose, data + sizeof( poses_header ) + i * sizeof( pose ), sizeof( pose ) );
+		if ( pose.device_index >= vr::k_unMaxTrackedDeviceCount )
+			continue;
+
+		vr::TrackedDevicePose_t &device_pose = m_rTrackedDevicePose[pose.device_index];
+		device_pose.bPoseIsValid = true;
+		device_pose.bDeviceIsConnected = true;
+		device_pose.eTrackingResult = vr::TrackingResult_Running_OK;
+		memcpy( device_pose.mDeviceToAbsoluteTracking.m, pose.device_to_absolute_tracking, sizeof( device_pose.mDeviceToAbsoluteTracking.m ) );
+		device_classes[pose.device_index] = (vr::ETrackedDeviceClass)pose.device_class;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs the frames of the replayed trace as fast as possible and prints
+//          the frame times. Signals and the control socket are still handled.
+//-----------------------------------------------------------------------------
+void CMainApplication::run_replay_loop()
+{
+	std::vector<double> frame_times_ms;
+	frame_times_ms.reserve( trace_reader.get_num_frames() );
+	int64_t first_frame_time_us = -1;
+	int64_t last_frame_time_us = 0;
+	const double replay_start_ms = get_monotonic_time_ms();
+
+	SessionTraceFrame frame;
+	int64_t frame_time_us = 0;
+	while ( !bQuit && trace_reader.next_frame( frame, frame_time_us ) )
+	{
+		set_current_context( m_pContext );
+		if ( !event_loop.wait( 0 ) )
+			quit_requested = true;
+
+		if ( first_frame_time_us == -1 )
+			first_frame_time_us = frame_time_us;
+		last_frame_time_us = frame_time_us;
+		replay_frame_time_ms = (Uint32)( frame_time_us / 1000 );
+		trace_frame_flags = frame.flags;
+
+		const double frame_start_ms = get_monotonic_time_ms();
+		bQuit = HandleInput();
+		RenderFrame();
+		frame_times_ms.push_back( get_monotonic_time_ms() - frame_start_ms );
+		bQuit = bQuit || quit_requested;
+		set_current_context( NULL );
+	}
+	bQuit = true;
+
+	if ( frame_times_ms.empty() )
+	{
+		fprintf( stderr, "The trace has no frames\n" );
+		return;
+	}
+
+	const double replay_ms = get_monotonic_time_ms() - replay_start_ms;
+	std::vector<double> sorted_frame_times_ms = frame_times_ms;
+	std::sort( sorted_frame_times_ms.begin(), sorted_frame_times_ms.end() );
+	auto percentile = [&sorted_frame_times_ms]( double p ) {
+		return sorted_frame_times_ms[std::min( sorted_frame_times_ms.size() - 1, (size_t)( p * sorted_frame_times_ms.size() ) )];
+	};
+	double total_frame_time_ms = 0.0;
+	for ( double frame_time_ms : frame_times_ms )
+		total_frame_time_ms += frame_time_ms;
+
+	fprintf( stderr, "Replayed %zu frames (%.2f s recorded) in %.2f s\n", frame_times_ms.size(), ( last_frame_time_us - first_frame_time_us ) / 1000000.0, replay_ms / 1000.0 );
+	fprintf( stderr, "Frame time: mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+		total_frame_time_ms / frame_times_ms.size(), percentile( 0.5 ), percentile( 0.99 ), sorted_frame_times_ms.back() );
+}
+
+Uint32 CMainApplication::get_input_time_ms() const
+{
+	return is_replaying() ? replay_frame_time_ms : SDL_GetTicks();
+}
+
+
+// Headsets the render benchmark renders for. The values are close to what the vr runtime reports for
+// them at 100% resolution. Only the left eye is listed, the right eye is its mirror image
+struct RenderBenchHeadset
+{
+	const char *name;
+	uint32_t render_width;
+	uint32_t render_height;
+	float display_frequency;
+	// Left, right, top, bottom tangents like IVRSystem::GetProjectionRaw
+	float projection_raw[4];
+	float ipd;
+};
+
+static const RenderBenchHeadset g_renderBenchHeadsets[] = {
+	{ "vive", 1512, 1680, 90.0f, { -1.397f, 1.244f, -1.467f, 1.466f }, 0.064f },
+	{ "index", 2016, 2240, 120.0f, { -1.395f, 1.240f, -1.472f, 1.457f }, 0.064f },
+	{ "quest2", 1832, 1920, 90.0f, { -1.192f, 0.904f, -1.150f, 1.038f }, 0.063f }
+};
+static const int g_nRenderBenchHeadsetCount = sizeof(g_renderBenchHeadsets) / sizeof(g_renderBenchHeadsets[0]);
+
+// Size of the test image, a 16:9 side-by-side video
+static const int g_nRenderBenchTextureWidth = 3840;
+static const int g_nRenderBenchTextureHeight = 2160;
+
+static uint64_t fnv1a_64( const uint8_t *data, size_t size )
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for( size_t i = 0; i < size; ++i )
+	{
+		hash ^= data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Creates a headless opengl context, the shaders and a test image
+//          for run_render_bench.
+//-----------------------------------------------------------------------------
+bool CMainApplication::init_render_bench()
+{
+	if( !headless_context.create( 3, 2 ) )
+		return false;
+
+	{
+		glewExperimental = GL_TRUE;
+		GLenum nGlewError = glewInit();
+		// glew initializes glx after the opengl functions, which fails because there is no X display
+		if ( nGlewError != GLEW_OK && nGlewError != GLEW_ERROR_NO_GLX_DISPLAY )
+		{
+			fprintf( stderr, "%s - Error initializing GLEW! %s\n", __FUNCTION__, glewGetErrorString( nGlewError ) );
+			return false;
+		}
+		glGetError(); // to clear the error caused deep in GLEW
+	}
+
+	fprintf( stderr, "Render benchmark on %s\n", (const char*)glGetString( GL_RENDERER ) );
+
+	m_fScale = 1.0f;
+	m_fScaleSpacing = 2.0f;
+	m_fNearClip = 0.01f;
+	m_fFarClip = 30.0f;
+	m_uiVertcount = 0;
+
+	set_render_bench_headset( 0 );
+	if ( !BInitGL() )
+	{
+		fprintf( stderr, "%s - Unable to initialize OpenGL!\n", __FUNCTION__ );
+		return false;
+	}
+
+	// Gradients with a checkerboard on top, so that a change in the texture coordinates changes the checksums
+	window_width = g_nRenderBenchTextureWidth;
+	window_height = g_nRenderBenchTextureHeight;
+	if( window_texture_init_placeholder( &window_texture, window_width, window_height ) != 0 )
+	{
+		fprintf( stderr, "Failed to create the render benchmark texture\n" );
+		return false;
+	}
+
+	std::vector<uint8_t> pixels( (size_t)window_width * window_height * 3 );
+	uint8_t *pixel = pixels.data();
+	for( int y = 0; y < window_height; ++y )
+	{
+		for( int x = 0; x < window_width; ++x )
+		{
+			*pixel++ = (uint8_t)( x * 255 / window_width );
+			*pixel++ = (uint8_t)( y * 255 / window_height );
+			*pixel++ = ( ( x / 64 ) ^ ( y / 64 ) ) & 1 ? 255 : 0;
 		}
 	}
+	glBindTexture( GL_TEXTURE_2D, window_texture_get_opengl_texture_id( &window_texture ) );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, window_width, window_height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data() );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+	glBindTexture( GL_TEXTURE_2D, 0 );
+
+	pixmap_texture_width = window_width;
+	pixmap_texture_height = window_height;
+	mouse_x = window_width / 4;
+	mouse_y = window_height / 2;
+	return true;
 }
 
-static glm::vec3 vertex_get_center(glm::mat3 vertex) {
-	return glm::vec3(
-		(vertex[0].x + vertex[1].x + vertex[2].x) / 3.0f,
-		(vertex[0].y + vertex[1].y + vertex[2].y) / 3.0f,
-		(vertex[0].z + vertex[1].z + vertex[2].z) / 3.0f
-	);
-}
-
-static void plane_normalize_depth(float *vertices, size_t num_vertices, float depth) {
-	for(size_t i = 0; i < num_vertices; ++i) {
-		float *vertex_data = &vertices[i * 5];
-		float dist = sqrtf(vertex_data[0]*vertex_data[0] + vertex_data[1]*vertex_data[1] + vertex_data[2]*vertex_data[2]);
-		vertex_data[0] = vertex_data[0]/dist * depth;
-		vertex_data[1] = vertex_data[1]/dist * depth;
-		vertex_data[2] = vertex_data[2]/dist * depth;
+//-----------------------------------------------------------------------------
+// Purpose: Uses the properties of a headset from g_renderBenchHeadsets instead
+//          of the vr runtime, and recreates the render targets at its size.
+//-----------------------------------------------------------------------------
+void CMainApplication::set_render_bench_headset( int headset_index )
+{
+	const RenderBenchHeadset &headset = g_renderBenchHeadsets[headset_index];
+
+	hmd_info = {};
+	hmd_info.render_width = headset.render_width;
+	hmd_info.render_height = headset.render_height;
+	hmd_info.display_frequency = headset.display_frequency;
+	memcpy( hmd_info.projection_raw_left, headset.projection_raw, sizeof( hmd_info.projection_raw_left ) );
+	for( vr::Hmd_Eye eye : { vr::Eye_Left, vr::Eye_Right } )
+	{
+		// Same as IVRSystem::GetProjectionMatrix
+		const float *raw = headset.projection_raw;
+		const float left = eye == vr::Eye_Left ? raw[0] : -raw[1];
+		const float right = eye == vr::Eye_Left ? raw[1] : -raw[0];
+		const float top = raw[2];
+		const float bottom = raw[3];
+		float (&projection)[4][4] = hmd_info.projection[eye];
+		projection[0][0] = 2.0f / ( right - left );
+		projection[0][2] = ( right + left ) / ( right - left );
+		projection[1][1] = 2.0f / ( bottom - top );
+		projection[1][2] = ( bottom + top ) / ( bottom - top );
+		projection[2][2] = -m_fFarClip / ( m_fFarClip - m_fNearClip );
+		projection[2][3] = -m_fFarClip * m_fNearClip / ( m_fFarClip - m_fNearClip );
+		projection[3][2] = -1.0f;
+
+		float (&eye_to_head)[3][4] = hmd_info.eye_to_head[eye];
+		eye_to_head[0][0] = 1.0f;
+		eye_to_head[1][1] = 1.0f;
+		eye_to_head[2][2] = 1.0f;
+		eye_to_head[0][3] = eye == vr::Eye_Left ? -headset.ipd * 0.5f : headset.ipd * 0.5f;
 	}
-}
-
-static void vertices_rotate(float *vertices, size_t num_vertices, float angle, glm::vec3 rotation_axis) {
-	for(size_t i = 0; i < num_vertices - 2; i += 3) {
-		float *vertex_data1 = &vertices[(i + 0) * 5];
-		float *vertex_data2 = &vertices[(i + 1) * 5];
-		float *vertex_data3 = &vertices[(i + 2) * 5];
-		glm::quat quatRot = glm::angleAxis(angle, rotation_axis);
-		glm::mat4x4 matRot = glm::mat4_cast(quatRot);
-		glm::vec3 &vec1 = *(glm::vec3*)vertex_data1;
-		glm::vec3 &vec2 = *(glm::vec3*)vertex_data2;
-		glm::vec3 &vec3 = *(glm::vec3*)vertex_data3;
-		glm::vec3 center = vertex_get_center(glm::mat3(vec1, vec2, vec3));
-
-		vec1 -= center;
-		vec2 -= center;
-		vec3 -= center;
-
-		glm::mat4 tran = glm::translate(matRot, center);
-
-		glm::vec4 out1 = tran * glm::vec4(vec1.x, vec1.y, vec1.z, 1.0f);
-		glm::vec4 out2 = tran * glm::vec4(vec2.x, vec2.y, vec2.z, 1.0f);
-		glm::vec4 out3 = tran * glm::vec4(vec3.x, vec3.y, vec3.z, 1.0f);
-		vec1 = glm::vec3(out1.x, out1.y, out1.z);
-		vec2 = glm::vec3(out2.x, out2.y, out2.z);
-		vec3 = glm::vec3(out3.x, out3.y, out3.z);
+	hmd_info.seated_to_standing[0][0] = 1.0f;
+	hmd_info.seated_to_standing[1][1] = 1.0f;
+	hmd_info.seated_to_standing[2][2] = 1.0f;
+	hmd_info_valid = true;
+	hmd_display_frequency = hmd_info.display_frequency;
+
+	// BInitGL creates the render targets of the first headset
+	if( leftEyeDesc.m_nResolveFramebufferId != 0 )
+	{
+		DeleteStereoRenderTargets();
+		SetupCameras();
+		SetupStereoRenderTargets();
 	}
 }
 
-
 //-----------------------------------------------------------------------------
-// Purpose:
+// Purpose: Renders the test image in every projection and view mode for each
+//          headset in g_renderBenchHeadsets and prints the results as json.
+//          Each mode gets a few frames to warm up and then
+//          render_bench_frames timed frames. glFinish is part of the frame
+//          time so that it's the time the gpu took, not just the submission.
 //-----------------------------------------------------------------------------
-void CMainApplication::AddCubeToScene( const glm::mat4 &mat, std::vector<float> &vertdata )
+void CMainApplication::run_render_bench()
 {
-	double width_ratio = (double)pixmap_texture_width / (double)pixmap_texture_height;
-	arrow_ratio = width_ratio;
-
-	Window root_window;
-	int x_return, y_return;
-	unsigned int width_return, height_return, border_width_return = 0, depth_return;
-	if(src_window_id)
-		XGetGeometry(x_display, src_window_id, &root_window, &x_return, &y_return, &width_return, &height_return, &border_width_return, &depth_return);
-
-	if(projection_mode == ProjectionMode::SPHERE)
-	{
-		long columns = 32;
-		long rows = 32;
-		double angle_x = 3.14;
-		double radius_height = 1.0;
-		double radius = radius_height * width_ratio * 0.5;
-
-		for(long row = 0; row < rows; ++row) {
-			for(long column = 0; column < columns; ++column) {
-				double offset_angle = 0.0;//angle_x*0.5;
-
-				double y_sin1 = sin((double)row / (double)rows * 3.14);
-				double y_sin2 = sin((double)(row + 1) / (double)rows * 3.14);
-
-				double z1 = sin(offset_angle + (double)column / (double)columns * angle_x) * radius;
-				double z2 = sin(offset_angle + (double)(column + 1) / (double)columns * angle_x) * radius;
-				double z3 = z1;
-
-				double z4 = z3;
-				double z5 = z2;
-				double z6 = z2;
-
-				z1 *= y_sin1;
-				z2 *= y_sin1;
-				z3 *= y_sin2;
-				z4 *= y_sin2;
-				z5 *= y_sin2;
-				z6 *= y_sin1;
-
-				double x1 = -cos(offset_angle + (double)column / (double)columns * angle_x) * radius;
-				double x2 = -cos(offset_angle + (double)(column + 1) / (double)columns * angle_x) * radius;
-				double x3 = x1;
-
-				double x4 = x3;
-				double x5 = x2;
-				double x6 = x2;
-
-				x1 *= y_sin1;
-				x2 *= y_sin1;
-				x3 *= y_sin2;
-				x4 *= y_sin2;
-				x5 *= y_sin2;
-				x6 *= y_sin1;
-	#if 0
-				double y1 = cos((double)row / (double)rows * angle_y) * radius;
-				double y2 = y1;
-				double y3 = cos((double)(row + 1) / (double)rows * angle_y) * radius;
-
-				double y4 = y3;
-				double y5 = y3;
-				double y6 = y1;
-
-				z1 *= sin((double)row / (double)rows * angle_y) * radius_depth;
-				z2 *= sin((double)row / (double)rows * angle_y) * radius_depth;
-				z3 *= sin((double)(row + 1) / (double)rows * angle_y) * radius_depth;
-				z4 *= sin((double)(row + 1) / (double)rows * angle_y) * radius_depth;
-				z5 *= sin((double)(row + 1) / (double)rows * angle_y) * radius_depth;
-				z6 *= sin((double)row / (double)rows * angle_y) * radius_depth;
-
-				x1 *= sin((double)row / (double)rows * angle_y) * radius_depth;
-				x2 *= sin((double)row / (double)rows * angle_y) * radius_depth;
-				x3 *= sin((double)(row + 1) / (double)rows * angle_y) * radius_depth;
-				x4 *= sin((double)(row + 1) / (double)rows * angle_y) * radius_depth;
-				x5 *= sin((double)(row + 1) / (double)rows * angle_y) * radius_depth;
-				x6 *= sin((double)row / (double)rows * angle_y) * radius_depth;
-	#else
-				double y1 = cos((double)row / (double)rows * 3.14) * radius_height;
-				double y2 = y1;
-				double y3 = cos((double)(row + 1) / (double)rows * 3.14) * radius_height;
-
-				double y4 = y3;
-				double y5 = y3;
-				double y6 = y1;
-	#endif
-
-				glm::vec4 v1 = mat * glm::vec4(x1, y1, z1 + zoom, 1.0);
-				glm::vec4 v2 = mat * glm::vec4(x2, y2, z2 + zoom, 1.0);
-				glm::vec4 v3 = mat * glm::vec4(x3, y3, z3 + zoom, 1.0);
-				glm::vec4 v4 = mat * glm::vec4(x4, y4, z4 + zoom, 1.0);
-				glm::vec4 v5 = mat * glm::vec4(x5, y5, z5 + zoom, 1.0);
-				glm::vec4 v6 = mat * glm::vec4(x6, y6, z6 + zoom, 1.0);
-
-				AddCubeVertex(v1.x, v1.y, v1.z, 1.0 - (double)column / (double)columns,                 (double)row / (double)rows, vertdata);
-				AddCubeVertex(v2.x, v2.y, v2.z, 1.0 - (double)(column + 1) / (double)columns,   (double)row / (double)rows, vertdata);
-				AddCubeVertex(v3.x, v3.y, v3.z, 1.0 - (double)column / (double)columns,                 (double)(row + 1) / (double)rows, vertdata);
-
-				AddCubeVertex(v4.x, v4.y, v4.z, 1.0 - (double)column / (double)columns,                 (double)(row + 1) / (double)rows, vertdata);
-				AddCubeVertex(v5.x, v5.y, v5.z, 1.0 - (double)(column + 1) / (double)columns,   (double)(row + 1) / (double)rows, vertdata);
-				AddCubeVertex(v6.x, v6.y, v6.z, 1.0 - (double)(column + 1) / (double)columns,   (double)row / (double)rows, vertdata);
-			}
-		}
-	}
-	else if (projection_mode == ProjectionMode::CYLINDER)
+	struct RenderBenchCase
 	{
-		long columns = 64;
-		double angle_start = -0.8;
-		double angle_end = 0.8;
-		double height = 1.5;
-		double angle_len = angle_end - angle_start;
-
-		double width_start = sin(angle_start);
-		double width_end = sin(angle_start + angle_len);
-		double target_radius = height * width_ratio;
-		double radius = 2.0 * (target_radius / (width_end - width_start));
+		const char *name;
+		ProjectionMode projection_mode;
+		ViewMode view_mode;
+		bool mesh_projection;
+	};
+	static const RenderBenchCase cases[] = {
+		{ "sphere-left-right", ProjectionMode::SPHERE, ViewMode::LEFT_RIGHT, false },
+		{ "sphere-left-right-mesh", ProjectionMode::SPHERE, ViewMode::LEFT_RIGHT, true },
+		{ "sphere-right-left", ProjectionMode::SPHERE, ViewMode::RIGHT_LEFT, false },
+		{ "flat-left-right", ProjectionMode::FLAT, ViewMode::LEFT_RIGHT, false },
+		{ "flat-right-left", ProjectionMode::FLAT, ViewMode::RIGHT_LEFT, false },
+		{ "plane", ProjectionMode::CYLINDER, ViewMode::PLANE, false },
+		{ "sphere360", ProjectionMode::SPHERE360, ViewMode::SPHERE360, false },
+		{ "sphere360-mesh", ProjectionMode::SPHERE360, ViewMode::SPHERE360, true }
+	};
+	const int warmup_frames = 3;
+
+	// The user's saved placement would change the images
+	m_mat4HMDPose = glm::mat4( 1.0f );
+	hmd_pos = glm::vec3( 0.0f, 0.0f, 0.0f );
+	m_reset_rotation = glm::quat( 1.0f, 0.0f, 0.0f, 0.0f );
+	reduce_flicker = false;
+	stretch = true;
+
+	std::vector<std::string> results;
+	std::vector<double> frame_times_ms;
+	std::vector<uint8_t> pixels;
+	for( int headset_index = 0; headset_index < g_nRenderBenchHeadsetCount; ++headset_index )
+	{
+		const RenderBenchHeadset &headset = g_renderBenchHeadsets[headset_index];
+		set_render_bench_headset( headset_index );
 
-		for(long column = 0; column < columns; ++column) {
-			double t1 = ((double)column / (double)columns);
-			double t2 = (((double)column + 1) / (double)columns);
+		for( const RenderBenchCase &bench_case : cases )
+		{
+			// The defaults of the command line options for the mode
+			projection_mode = bench_case.projection_mode;
+			view_mode = bench_case.view_mode;
+			mesh_projection = bench_case.mesh_projection;
+			zoom = projection_mode == ProjectionMode::FLAT || projection_mode == ProjectionMode::CYLINDER ? 1.0f : 0.0f;
+			cursor_scale = projection_mode == ProjectionMode::SPHERE || projection_mode == ProjectionMode::SPHERE360 ? 0.001f : 2.0f;
+			cursor_wrap = projection_mode != ProjectionMode::FLAT;
+			SetupScene();
 
-			double x1 = sin(angle_start + t1 * angle_len) * radius;
-			double y1 = cos(angle_start + t1 * angle_len) * radius * 0.6;
-			double x2 = sin(angle_start + t2 * angle_len) * radius;
-			double y2 = cos(angle_start + t2 * angle_len) * radius * 0.6;
+			const std::string name = std::string( headset.name ) + "/" + bench_case.name;
+			fprintf( stderr, "Rendering %s\n", name.c_str() );
 
-			//     2     n
-			// 1  /|   / |    m
-			// | / | /   |  / |
-			// |/  2     n/   |
-			// 1              m
+			glGetError();
+			for( int i = 0; i < warmup_frames; ++i )
+			{
+				RenderStereoTargets();
+				glFinish();
+			}
 
-			AddCubeVertex(x1, height, zoom + y1, 1 - t1, 0, vertdata);
-			AddCubeVertex(x2, height, zoom + y2, 1 - t2, 0, vertdata);
-			AddCubeVertex(x1, -height, zoom + y1, 1 - t1, 1, vertdata);
+			frame_times_ms.clear();
+			draw_call_count = 0;
+			for( int i = 0; i < render_bench_frames; ++i )
+			{
+				const double frame_start_ms = get_monotonic_time_ms();
+				RenderStereoTargets();
+				glFinish();
+				frame_times_ms.push_back( get_monotonic_time_ms() - frame_start_ms );
+			}
+			const double draw_calls_per_frame = (double)draw_call_count / (double)render_bench_frames;
 
-			AddCubeVertex(x1, -height, zoom + y1, 1 - t1, 1, vertdata);
-			AddCubeVertex(x2, height, zoom + y2, 1 - t2, 0, vertdata);
-			AddCubeVertex(x2, -height, zoom + y2, 1 - t2, 1, vertdata);
+			uint64_t checksums[2];
+			const FramebufferDesc *eye_descs[2] = { &leftEyeDesc, &rightEyeDesc };
+			pixels.resize( (size_t)m_nRenderWidth * m_nRenderHeight * 4 );
+			for( int eye = 0; eye < 2; ++eye )
+			{
+				glBindFramebuffer( GL_READ_FRAMEBUFFER, eye_descs[eye]->m_nResolveFramebufferId );
+				glReadPixels( 0, 0, m_nRenderWidth, m_nRenderHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data() );
+				checksums[eye] = fnv1a_64( pixels.data(), pixels.size() );
+			}
+			glBindFramebuffer( GL_READ_FRAMEBUFFER, 0 );
+
+			int gl_errors = 0;
+			while( glGetError() != GL_NO_ERROR && gl_errors < 100 )
+				++gl_errors;
+
+			std::sort( frame_times_ms.begin(), frame_times_ms.end() );
+			double total_frame_time_ms = 0.0;
+			for( double frame_time_ms : frame_times_ms )
+				total_frame_time_ms += frame_time_ms;
+			auto percentile = [&frame_times_ms]( double p ) {
+				return frame_times_ms[std::min( frame_times_ms.size() - 1, (size_t)( p * frame_times_ms.size() ) )];
+			};
+
+			char result[1024];
+			snprintf( result, sizeof( result ),
+				"{\"name\":\"%s\",\"width\":%u,\"height\":%u,\"path\":\"%s\",\"frames\":%d,\"frame_ms_mean\":%.3f,\"frame_ms_p50\":%.3f,\"frame_ms_p99\":%.3f,"
+				"\"draw_calls_per_frame\":%.1f,\"gl_errors\":%d,\"checksum_left\":\"%016llx\",\"checksum_right\":\"%016llx\"}",
+				name.c_str(), m_nRenderWidth, m_nRenderHeight, UseProjectionPass() ? "projection-pass" : "mesh", render_bench_frames,
+				total_frame_time_ms / frame_times_ms.size(), percentile( 0.5 ), percentile( 0.99 ),
+				draw_calls_per_frame, gl_errors, (unsigned long long)checksums[0], (unsigned long long)checksums[1] );
+			results.push_back( result );
 		}
-	} else if (projection_mode == ProjectionMode::FLAT) {
-		double height = 0.5;
-		double width = height * (stretch ? 1.0 : 0.5) * width_ratio;
-		AddCubeVertex(-width, 	 height, zoom, 1.0, 0.0, vertdata);
-		AddCubeVertex(width, 	 height, zoom, 0.0, 0.0, vertdata);
-		AddCubeVertex(-width, 	-height, zoom, 1.0, 1.0, vertdata);
+	}
 
-		AddCubeVertex(-width, 	-height, zoom, 1.0, 1.0, vertdata);
-		AddCubeVertex(width, 	-height, zoom, 0.0, 1.0, vertdata);
-		AddCubeVertex(width, 	 height, zoom, 0.0, 0.0, vertdata);
+	// The renderer name is the only string that doesn't come from this file
+	std::string renderer = (const char*)glGetString( GL_RENDERER );
+	for( char &c : renderer )
+	{
+		if( c == '"' || c == '\\' || (unsigned char)c < 0x20 )
+			c = ' ';
+	}
 
-		if(stretch)
-			arrow_ratio = width_ratio * 2.0;
-	} else if (projection_mode == ProjectionMode::SPHERE360) {
-		if(!mpv_file)
-			border_width_return += 2; // Meh, hac k to deal with seams a bit
-		double px = (double)border_width_return / (double)pixmap_texture_width;
-		double py = (double)border_width_return / (double)pixmap_texture_height;
+	std::sort( results.begin(), results.end() );
+	printf( "{\"renderer\":\"%s\",\"multiview\":%s,\"cases\":[", renderer.c_str(), m_bMultiview ? "true" : "false" );
+	for( size_t i = 0; i < results.size(); ++i )
+		printf( "%s\n  %s", i == 0 ? "" : ",", results[i].c_str() );
+	printf( "\n]}\n" );
+	fflush( stdout );
+}
 
-		double width = 1.0 - px * 2.0;
-		double height = 1.0 - py * 2.0;
 
-		double hz = zoom / (double)pixmap_texture_height;
+// {"count":n,"min":..,"mean":..,"p50":..,"p90":..,"p99":..,"max":..} of the values, in milliseconds
+static std::string latency_distribution_json( std::vector<double> values_ms )
+{
+	if( values_ms.empty() )
+		return "{\"count\":0}";
+
+	std::sort( values_ms.begin(), values_ms.end() );
+	double total_ms = 0.0;
+	for( double value_ms : values_ms )
+		total_ms += value_ms;
+	auto percentile = [&values_ms]( double p ) {
+		return values_ms[std::min( values_ms.size() - 1, (size_t)( p * values_ms.size() ) )];
+	};
 
-		double texture_width = width / 3.0;
-		double texture_height = height * 0.5;
+	char json[256];
+	snprintf( json, sizeof( json ), "{\"count\":%zu,\"min\":%.3f,\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f}",
+		values_ms.size(), values_ms.front(), total_ms / values_ms.size(), percentile( 0.5 ), percentile( 0.9 ), percentile( 0.99 ), values_ms.back() );
+	return json;
+}
 
-		for(int i = 0; i < 3; ++i) {
-			size_t plane_vertices_start = vertdata.size();
-			CreateSegmentedPlane(vertdata, 1.0f, 1.0f, 1.0f, texture_width, texture_height - hz, texture_width * (2 - i) + px, py + hz, 32, 32);
-			size_t plane_vertices_end = vertdata.size();
-			size_t num_vertex_data = (plane_vertices_end - plane_vertices_start) / 5;
+//-----------------------------------------------------------------------------
+// Purpose: Reads the pattern of the latency probe window back from the
+//          captured texture at the point where the texture would be given
+//          to the overlay, and quits when the probe has run long enough.
+//-----------------------------------------------------------------------------
+void CMainApplication::sample_capture_latency()
+{
+	const double now_ms = get_monotonic_time_ms();
+	if( latency_probe_start_ms == 0.0 )
+		latency_probe_start_ms = now_ms;
 
-			plane_normalize_depth(&vertdata[plane_vertices_start], num_vertex_data, 1.0f);
-			vertices_rotate(&vertdata[plane_vertices_start], num_vertex_data, -glm::half_pi<float>() + i * glm::half_pi<float>(), glm::vec3(0.0f, 1.0f, 0.0f));
+	const GLuint texture_id = window_texture_get_opengl_texture_id( &window_texture );
+	if( texture_id != 0 )
+	{
+		// Free where the pixmap is shared with the texture, needed where it's copied
+		window_texture_refresh( &window_texture );
+
+		if( latency_probe_framebuffer == 0 )
+			glGenFramebuffers( 1, &latency_probe_framebuffer );
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, latency_probe_framebuffer );
+		glFramebufferTexture2D( GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture_id, 0 );
+
+		// The top of the window is the first row of the texture if the pixmap is y-inverted, otherwise the last
+		const int row_width = std::min( (int)pixmap_texture_width, LATENCY_PROBE_NUM_CELLS * LATENCY_PROBE_CELL_SIZE );
+		const int rows[2] = { LATENCY_PROBE_CELL_SIZE / 2, pixmap_texture_height - 1 - LATENCY_PROBE_CELL_SIZE / 2 };
+		latency_probe_pixels.resize( (size_t)row_width * 4 );
+		LatencyProbeFrame frame;
+		bool decoded = false;
+		for( int row : rows )
+		{
+			glReadPixels( 0, row, row_width, 1, GL_RGBA, GL_UNSIGNED_BYTE, latency_probe_pixels.data() );
+			if( latency_probe_decode( latency_probe_pixels.data(), row_width, frame ) )
+			{
+				decoded = true;
+				break;
+			}
 		}
-
-		for(int i = 0; i < 3; ++i) {
-			size_t plane_vertices_start = vertdata.size();
-			CreateSegmentedPlane(vertdata, 1.0f, 1.0f, 1.0f, texture_width, texture_height - hz, px + texture_width * i, 0.5f, 32, 32);
-			size_t plane_vertices_end = vertdata.size();
-			size_t num_vertex_data = (plane_vertices_end - plane_vertices_start) / 5;
-
-			plane_normalize_depth(&vertdata[plane_vertices_start], num_vertex_data, 1.0f);
-			vertices_rotate(&vertdata[plane_vertices_start], num_vertex_data, -glm::half_pi<float>(), glm::vec3(0.0f, 0.0f, 1.0f));
-			vertices_rotate(&vertdata[plane_vertices_start], num_vertex_data, -glm::half_pi<float>() - i * glm::half_pi<float>(), glm::vec3(1.0f, 0.0f, 0.0f));
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, 0 );
+
+		// The readback waits for the texture, so this is when the frame would have been visible to the compositor
+		const int64_t submit_time_us = latency_probe_time_us();
+		++latency_probe_submits;
+		if( !decoded )
+			++latency_probe_unreadable_submits;
+		else if( frame.frame > latency_probe_last_frame )
+		{
+			latency_probe_samples.push_back( { frame, submit_time_us } );
+			latency_probe_last_frame = frame.frame;
 		}
 	}
 
-	cursor_scale_uniform[0] = 0.01 * cursor_scale;
-	cursor_scale_uniform[1] = cursor_scale_uniform[0] * arrow_ratio * ((float)arrow_image_height / (float)(arrow_image_width == 0 ? 1 : arrow_image_width));
-
-	glUseProgram( m_unSceneProgramID );
-	glUniform2fv(m_nArrowSizeLocation, 1, &cursor_scale_uniform[0]);
-	glUseProgram( 0 );
-}
-
-//-----------------------------------------------------------------------------
-// Purpose:
-//-----------------------------------------------------------------------------
-void CMainApplication::SetupCameras()
-{
-	m_mat4ProjectionLeft = GetHMDMatrixProjectionEye( vr::Eye_Left );
-	m_mat4ProjectionRight = GetHMDMatrixProjectionEye( vr::Eye_Right );
-	m_mat4eyePosLeft = GetHMDMatrixPoseEye( vr::Eye_Left );
-	m_mat4eyePosRight = GetHMDMatrixPoseEye( vr::Eye_Right );
+	if( now_ms - latency_probe_start_ms >= latency_probe_seconds * 1000.0 )
+	{
+		print_capture_latency();
+		quit_requested = true;
+	}
 }
 
-
 //-----------------------------------------------------------------------------
-// Purpose: Creates a frame buffer. Returns true if the buffer was set up.
-//          Returns false if the setup failed.
+// Purpose: Prints the latency of the probe frames as json. The first frame
+//          drawn after each resize of the probe window is reported separately,
+//          as the time until any frame at least as new was submitted, because
+//          the capture only follows the window after the resize timeout.
 //-----------------------------------------------------------------------------
-bool CMainApplication::CreateFrameBuffer( int nWidth, int nHeight, FramebufferDesc &framebufferDesc )
+void CMainApplication::print_capture_latency()
 {
-	glGenFramebuffers(1, &framebufferDesc.m_nRenderFramebufferId );
-	glBindFramebuffer(GL_FRAMEBUFFER, framebufferDesc.m_nRenderFramebufferId);
-
-	glGenRenderbuffers(1, &framebufferDesc.m_nDepthBufferId);
-	glBindRenderbuffer(GL_RENDERBUFFER, framebufferDesc.m_nDepthBufferId);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, 4, GL_DEPTH_COMPONENT, nWidth, nHeight );
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER,	framebufferDesc.m_nDepthBufferId );
-
-	glGenTextures(1, &framebufferDesc.m_nRenderTextureId );
-	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, framebufferDesc.m_nRenderTextureId );
-	glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, 4, GL_RGBA8, nWidth, nHeight, true);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, framebufferDesc.m_nRenderTextureId, 0);
-
-	glGenFramebuffers(1, &framebufferDesc.m_nResolveFramebufferId );
-	glBindFramebuffer(GL_FRAMEBUFFER, framebufferDesc.m_nResolveFramebufferId);
-
-	glGenTextures(1, &framebufferDesc.m_nResolveTextureId );
-	glBindTexture(GL_TEXTURE_2D, framebufferDesc.m_nResolveTextureId );
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, nWidth, nHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, framebufferDesc.m_nResolveTextureId, 0);
-
-	// check FBO status
-	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-	if (status != GL_FRAMEBUFFER_COMPLETE)
+	const std::vector<LatencyProbeFrame> resize_frames = latency_probe_window.get_resize_frames();
+	std::vector<double> latencies_ms;
+	std::vector<double> resize_latencies_ms;
+	size_t resize_index = 0;
+	for( const LatencyProbeSample &sample : latency_probe_samples )
 	{
-		return false;
+		bool after_resize = false;
+		while( resize_index < resize_frames.size() && resize_frames[resize_index].frame <= sample.frame.frame )
+		{
+			resize_latencies_ms.push_back( ( sample.submit_time_us - resize_frames[resize_index].time_us ) / 1000.0 );
+			++resize_index;
+			after_resize = true;
+		}
+		if( !after_resize )
+			latencies_ms.push_back( ( sample.submit_time_us - sample.frame.time_us ) / 1000.0 );
 	}
 
-	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
-
-	return true;
+	printf( "{\"duration_s\":%.3f,\"frames_drawn\":%u,\"frames_seen\":%zu,\"submits\":%lld,\"unreadable_submits\":%lld,\"resizes\":%zu,\n",
+		( get_monotonic_time_ms() - latency_probe_start_ms ) / 1000.0, latency_probe_window.get_num_frames_drawn(), latency_probe_samples.size(),
+		(long long)latency_probe_submits, (long long)latency_probe_unreadable_submits, resize_frames.size() );
+	printf( "  \"latency_ms\":%s,\n", latency_distribution_json( latencies_ms ).c_str() );
+	printf( "  \"resize_latency_ms\":%s}\n", latency_distribution_json( resize_latencies_ms ).c_str() );
+	fflush( stdout );
 }
 
 void CMainApplication::set_current_context(SDL_GLContext context) {
@@ -2260,16 +4694,70 @@ void CMainApplication::set_current_context(SDL_GLContext context) {
 	SDL_GL_MakeCurrent(m_pCompanionWindow, context);
 }
 
-bool CMainApplication::take_render_update() {
-	std::lock_guard<std::mutex> lock(mpv_render_update_mutex);
-	bool should_update = mpv_render_update;
-	mpv_render_update = false;
-	return should_update;
+// Never waits for the mpv thread. Returns false if the command was dropped because the queue is full.
+// The last free slot is kept for shutdown, so shutdown always fits and is only sent once
+bool CMainApplication::push_mpv_command(const MpvThreadCommand &command) {
+	if(command.m_eType == MpvThreadCommand::Type::SHUTDOWN) {
+		if(!mpv_shutdown_sent)
+			mpv_shutdown_sent = mpv_commands.push(command);
+		return mpv_shutdown_sent;
+	}
+	if(mpv_shutdown_sent || mpv_commands.size_for_producer() + 1 >= mpv_commands.capacity())
+		return false;
+	return mpv_commands.push(command);
+}
+
+void CMainApplication::send_mpv_resize_request() {
+	if(!mpv_resize_request_pending)
+		return;
+	if(push_mpv_command({ MpvThreadCommand::Type::RESIZE, (int)mpv_render_width, (int)mpv_render_height }))
+		mpv_resize_request_pending = false;
 }
 
-void CMainApplication::set_render_update() {
-	std::lock_guard<std::mutex> lock(mpv_render_update_mutex);
-	mpv_render_update = true;
+void CMainApplication::process_mpv_thread_events() {
+	MpvThreadEvent event;
+	while(mpv_events.pop(event)) {
+		switch(event.m_eType) {
+			case MpvThreadEvent::Type::CREATE_FAILED:
+				mpv_create_failed = true;
+				break;
+			case MpvThreadEvent::Type::FRAME_RENDERED:
+				// A front frame that never reached the overlay is replaced without being shown
+				if(mpv_front_frame.m_pTarget != mpv_submitted_frame.m_pTarget)
+					RetireMpvFrame(mpv_front_frame);
+				mpv_front_frame = event.m_frame;
+				mpv_rendered_frame_count = event.m_nFrameCount;
+				mpv_first_frame_rendered = true;
+				break;
+			case MpvThreadEvent::Type::VIDEO_RECONFIG:
+				// The video can be reconfigured at any time (adaptive streams, new playlist entries, video filters).
+				// The mpv thread switches to a target with the new size without the main thread waiting for it
+				if(event.m_nVideoWidth != mpv_video_width || event.m_nVideoHeight != mpv_video_height) {
+					mpv_video_width = event.m_nVideoWidth;
+					mpv_video_height = event.m_nVideoHeight;
+					GetMpvRenderTargetSize(mpv_video_width, mpv_video_height, mpv_render_width, mpv_render_height);
+					dprintf("Rendering the %lldx%lld video at %lldx%lld (oversample %.2f)\n", (long long)mpv_video_width, (long long)mpv_video_height, (long long)mpv_render_width, (long long)mpv_render_height, mpv_oversample);
+					pixmap_texture_width = mpv_video_width;
+					pixmap_texture_height = mpv_video_height;
+					mpv_reconfig_request_time_ms = get_monotonic_time_ms();
+					mpv_reconfig_pending = true;
+					mpv_resize_request_pending = true;
+					send_mpv_resize_request();
+					SetupScene();
+				}
+				break;
+			case MpvThreadEvent::Type::FILE_ENDED:
+				mpv_switch_pending = true;
+				mpv_switch_start_time_ms = get_monotonic_time_ms();
+				mpv_switch_frame_count = mpv_rendered_frame_count;
+				break;
+			case MpvThreadEvent::Type::QUIT:
+				if(event.m_nError != 0)
+					exit_code = 2;
+				quit_requested = true;
+				break;
+		}
+	}
 }
 
 
@@ -2278,10 +4766,31 @@ void CMainApplication::set_render_update() {
 //-----------------------------------------------------------------------------
 bool CMainApplication::SetupStereoRenderTargets()
 {
-	if ( !m_pHMD )
+	if ( !hmd_info_valid )
 		return false;
 
-	m_pHMD->GetRecommendedRenderTargetSize( &m_nRenderWidth, &m_nRenderHeight );
+	m_nRenderWidth = hmd_info.render_width;
+	m_nRenderHeight = hmd_info.render_height;
+
+	if( m_unSceneMultiviewProgramID != 0 )
+	{
+		m_bMultiview = CreateMultiviewFrameBuffer( m_nRenderWidth, m_nRenderHeight, multiviewDesc );
+		if( m_bMultiview )
+		{
+			// The eyes are only resolve targets in this case
+			CreateResolveFrameBuffer( m_nRenderWidth, m_nRenderHeight, leftEyeDesc );
+			CreateResolveFrameBuffer( m_nRenderWidth, m_nRenderHeight, rightEyeDesc );
+			dprintf( "Using single-pass multiview stereo rendering\n" );
+			return true;
+		}
+
+		dprintf( "Multiview render target is incomplete, falling back to two-pass stereo rendering\n" );
+		glDeleteTextures( 1, &multiviewDesc.m_nDepthTextureId );
+		glDeleteTextures( 1, &multiviewDesc.m_nRenderTextureId );
+		glDeleteFramebuffers( 1, &multiviewDesc.m_nRenderFramebufferId );
+		glDeleteFramebuffers( 2, multiviewDesc.m_nLayerFramebufferId );
+		multiviewDesc = {};
+	}
 
 	CreateFrameBuffer( m_nRenderWidth, m_nRenderHeight, leftEyeDesc );
 	CreateFrameBuffer( m_nRenderWidth, m_nRenderHeight, rightEyeDesc );
@@ -2290,12 +4799,32 @@ bool CMainApplication::SetupStereoRenderTargets()
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Deletes everything created by SetupStereoRenderTargets.
+//-----------------------------------------------------------------------------
+void CMainApplication::DeleteStereoRenderTargets()
+{
+	DeleteFrameBuffer( leftEyeDesc );
+	DeleteFrameBuffer( rightEyeDesc );
+
+	if( m_bMultiview )
+	{
+		glDeleteTextures( 1, &multiviewDesc.m_nDepthTextureId );
+		glDeleteTextures( 1, &multiviewDesc.m_nRenderTextureId );
+		glDeleteFramebuffers( 1, &multiviewDesc.m_nRenderFramebufferId );
+		glDeleteFramebuffers( 2, multiviewDesc.m_nLayerFramebufferId );
+		multiviewDesc = {};
+		m_bMultiview = false;
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
 void CMainApplication::SetupCompanionWindow()
 {
-	if ( !m_pHMD )
+	if ( !hmd_info_valid )
 		return;
 
 	std::vector<VertexDataWindow> vVerts;
@@ -2347,6 +4876,12 @@ void CMainApplication::SetupCompanionWindow()
 //-----------------------------------------------------------------------------
 void CMainApplication::RenderStereoTargets()
 {
+	if( m_bMultiview )
+	{
+		RenderStereoTargetsMultiview();
+		return;
+	}
+
 	glClearColor( 0.0f, 0.0f, 0.0f, 1.0f );
 	glEnable( GL_MULTISAMPLE );
 
@@ -2395,20 +4930,44 @@ void CMainApplication::RenderStereoTargets()
 
 
 //-----------------------------------------------------------------------------
-// Purpose: Renders a scene with respect to nEye.
+// Purpose: Renders both eyes into the layered multiview target with a single
+//          draw and resolves each layer into the eye textures.
 //-----------------------------------------------------------------------------
-void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
+void CMainApplication::RenderStereoTargetsMultiview()
 {
-	if(!src_window_id && !mpv_file)
-		return;
-	
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glEnable(GL_DEPTH_TEST);
+	glClearColor( 0.0f, 0.0f, 0.0f, 1.0f );
+	glEnable( GL_MULTISAMPLE );
 
-	glUseProgram( m_unSceneProgramID );
-	glUniformMatrix4fv( m_nSceneMatrixLocation, 1, GL_FALSE, glm::value_ptr(GetCurrentViewProjectionMatrix( nEye )));
+	glBindFramebuffer( GL_FRAMEBUFFER, multiviewDesc.m_nRenderFramebufferId );
+	glViewport(0, 0, m_nRenderWidth, m_nRenderHeight );
+	RenderSceneMultiview();
+	glBindFramebuffer( GL_FRAMEBUFFER, 0 );
 
-	float m[2];
+	glDisable( GL_MULTISAMPLE );
+
+	const GLuint resolveFramebuffers[2] = { leftEyeDesc.m_nResolveFramebufferId, rightEyeDesc.m_nResolveFramebufferId };
+	for( int nLayer = 0; nLayer < 2; ++nLayer )
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, multiviewDesc.m_nLayerFramebufferId[nLayer] );
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFramebuffers[nLayer] );
+
+		glBlitFramebuffer( 0, 0, m_nRenderWidth, m_nRenderHeight, 0, 0, m_nRenderWidth, m_nRenderHeight, 
+			GL_COLOR_BUFFER_BIT,
+			GL_LINEAR );
+	}
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Gets the texture offset/scale and cursor location used when
+//          rendering the scene for nEye.
+//-----------------------------------------------------------------------------
+void CMainApplication::GetSceneEyeParams( vr::Hmd_Eye nEye, float &texture_offset, float &texture_scale, float cursor[2] )
+{
+	float *m = cursor;
 	m[0] = mouse_x / (float)window_width;
 	m[1] = mouse_y / (float)window_height;
 
@@ -2429,8 +4988,8 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
 			offset = 0.0f;
 			scale = 1.0f;
 		}
-		glUniform1fv(m_nSceneTextureOffsetXLocation, 1, &offset);
-		glUniform1fv(m_nSceneTextureScaleXLocation, 1, &scale);
+		texture_offset = offset;
+		texture_scale = scale;
 
 		if(view_mode == ViewMode::RIGHT_LEFT)
 			m[0] += offset;
@@ -2445,8 +5004,8 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
 			offset = 0.0f;
 			scale = 1.0f;
 		}
-		glUniform1fv(m_nSceneTextureOffsetXLocation, 1, &offset);
-		glUniform1fv(m_nSceneTextureScaleXLocation, 1, &scale);
+		texture_offset = offset;
+		texture_scale = scale;
 
 		if(view_mode == ViewMode::LEFT_RIGHT)
 			m[0] += offset;
@@ -2460,15 +5019,147 @@ void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
 
 	m[0] += (-cursor_offset_x * arrow_drawn_scale_x) / (float)window_width;
 	m[1] += (-cursor_offset_y * arrow_drawn_scale_y) / (float)window_height;
+}
 
-	glUniform2fv(m_nCursorLocation, 1, &m[0]);
 
-	glBindVertexArray( m_unSceneVAO );
+//-----------------------------------------------------------------------------
+// Purpose: Gets the texture the scene shows and the part of it that has the
+//          image in it, in texture coordinates.
+//-----------------------------------------------------------------------------
+void CMainApplication::GetSceneTexture( GLuint &texture, float bounds[2] )
+{
+	bounds[0] = 1.0f;
+	bounds[1] = 1.0f;
+	if( !mpv_file )
+	{
+		texture = window_texture_get_opengl_texture_id(&window_texture);
+		return;
+	}
+
+	texture = mpv_front_frame.m_nTextureId;
+	if( mpv_front_frame.m_pTarget )
+	{
+		bounds[0] = (float)mpv_front_frame.m_nWidth / (float)mpv_front_frame.m_nBucketWidth;
+		bounds[1] = (float)mpv_front_frame.m_nHeight / (float)mpv_front_frame.m_nBucketHeight;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Renders a scene with respect to nEye.
+//-----------------------------------------------------------------------------
+void CMainApplication::RenderScene( vr::Hmd_Eye nEye )
+{
+	if(!src_window_id && !mpv_file && !render_bench)
+		return;
+	
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	float offset = 0.0f;
+	float scale = 1.0f;
+	float m[2];
+	GetSceneEyeParams( nEye, offset, scale, m );
+	GLuint scene_texture = 0;
+	float texture_bounds[2];
+	GetSceneTexture( scene_texture, texture_bounds );
+
+	if( UseProjectionPass() )
+	{
+		// The mesh space z axis is flipped in the scene vertex shader
+		glm::mat4 matrix = GetCurrentViewProjectionMatrix( nEye ) * glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, 1.0f, -1.0f));
+		glm::mat4 inverse_matrix = glm::inverse(matrix);
+
+		glDisable(GL_DEPTH_TEST);
+		glUseProgram( m_unProjectionProgramID );
+		glUniformMatrix4fv( m_projectionLocations.m_nInverseMatrixLocation, 1, GL_FALSE, glm::value_ptr(inverse_matrix) );
+		glUniform1fv( m_projectionLocations.m_nTextureOffsetXLocation, 1, &offset );
+		glUniform1fv( m_projectionLocations.m_nTextureScaleXLocation, 1, &scale );
+		glUniform2fv( m_projectionLocations.m_nTextureBoundsLocation, 1, texture_bounds );
+		glUniform2fv( m_projectionLocations.m_nCursorLocation, 1, &m[0] );
+		glUniform2fv( m_projectionLocations.m_nArrowSizeLocation, 1, &cursor_scale_uniform[0] );
+		glBindVertexArray( m_unProjectionVAO );
+	}
+	else
+	{
+		glEnable(GL_DEPTH_TEST);
+		glUseProgram( m_unSceneProgramID );
+		glUniformMatrix4fv( m_nSceneMatrixLocation, 1, GL_FALSE, glm::value_ptr(GetCurrentViewProjectionMatrix( nEye )));
+		glUniform1fv(m_nSceneTextureOffsetXLocation, 1, &offset);
+		glUniform1fv(m_nSceneTextureScaleXLocation, 1, &scale);
+		glUniform2fv(m_nSceneTextureBoundsLocation, 1, texture_bounds);
+		glUniform2fv(m_nCursorLocation, 1, &m[0]);
+		glBindVertexArray( m_unSceneVAO );
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, scene_texture);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, mpv_file ? 0 : arrow_image_texture_id);
+	glDrawArrays( GL_TRIANGLES, 0, UseProjectionPass() ? 3 : m_uiVertcount );
+	++draw_call_count;
+
+	glBindVertexArray( 0 );
+	glActiveTexture(GL_TEXTURE0);
+	glUseProgram( 0 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Renders the scene for both eyes at once. gl_ViewID_OVR picks the
+//          per-eye values out of the uniform arrays.
+//-----------------------------------------------------------------------------
+void CMainApplication::RenderSceneMultiview()
+{
+	if(!src_window_id && !mpv_file && !render_bench)
+		return;
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	glm::mat4 matrices[2] = { GetCurrentViewProjectionMatrix( vr::Eye_Left ), GetCurrentViewProjectionMatrix( vr::Eye_Right ) };
+	float offsets[2] = { 0.0f, 0.0f };
+	float scale = 1.0f;
+	float cursors[4];
+	GetSceneEyeParams( vr::Eye_Left, offsets[0], scale, &cursors[0] );
+	GetSceneEyeParams( vr::Eye_Right, offsets[1], scale, &cursors[2] );
+	GLuint scene_texture = 0;
+	float texture_bounds[2];
+	GetSceneTexture( scene_texture, texture_bounds );
+
+	if( UseProjectionPass() )
+	{
+		// The mesh space z axis is flipped in the scene vertex shader
+		const glm::mat4 flip_z = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, 1.0f, -1.0f));
+		glm::mat4 inverse_matrices[2] = { glm::inverse(matrices[0] * flip_z), glm::inverse(matrices[1] * flip_z) };
+
+		glDisable(GL_DEPTH_TEST);
+		glUseProgram( m_unProjectionMultiviewProgramID );
+		glUniformMatrix4fv( m_projectionMultiviewLocations.m_nInverseMatrixLocation, 2, GL_FALSE, glm::value_ptr(inverse_matrices[0]) );
+		glUniform1fv( m_projectionMultiviewLocations.m_nTextureOffsetXLocation, 2, offsets );
+		glUniform1fv( m_projectionMultiviewLocations.m_nTextureScaleXLocation, 1, &scale );
+		glUniform2fv( m_projectionMultiviewLocations.m_nTextureBoundsLocation, 1, texture_bounds );
+		glUniform2fv( m_projectionMultiviewLocations.m_nCursorLocation, 2, cursors );
+		glUniform2fv( m_projectionMultiviewLocations.m_nArrowSizeLocation, 1, &cursor_scale_uniform[0] );
+		glBindVertexArray( m_unProjectionVAO );
+	}
+	else
+	{
+		glEnable(GL_DEPTH_TEST);
+		glUseProgram( m_unSceneMultiviewProgramID );
+		glUniformMatrix4fv( m_nMultiviewMatrixLocation, 2, GL_FALSE, glm::value_ptr(matrices[0]) );
+		glUniform1fv( m_nMultiviewTextureOffsetXLocation, 2, offsets );
+		glUniform1fv( m_nMultiviewTextureScaleXLocation, 1, &scale );
+		glUniform2fv( m_nMultiviewTextureBoundsLocation, 1, texture_bounds );
+		glUniform2fv( m_nMultiviewCursorLocation, 2, cursors );
+		glUniform2fv( m_nMultiviewArrowSizeLocation, 1, &cursor_scale_uniform[0] );
+		glBindVertexArray( m_unSceneVAO );
+	}
+
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, mpv_file ? mpvDesc.m_nResolveTextureId :  window_texture_get_opengl_texture_id(&window_texture));
+	glBindTexture(GL_TEXTURE_2D, scene_texture);
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, mpv_file ? 0 : arrow_image_texture_id);
-	glDrawArrays( GL_TRIANGLES, 0, m_uiVertcount );
+	glDrawArrays( GL_TRIANGLES, 0, UseProjectionPass() ? 3 : m_uiVertcount );
+	++draw_call_count;
 
 	glBindVertexArray( 0 );
 	glActiveTexture(GL_TEXTURE0);
@@ -2513,16 +5204,16 @@ void CMainApplication::RenderCompanionWindow()
 //-----------------------------------------------------------------------------
 glm::mat4 CMainApplication::GetHMDMatrixProjectionEye( vr::Hmd_Eye nEye )
 {
-	if ( !m_pHMD )
+	if ( !hmd_info_valid )
 		return glm::mat4(1.0f);
 
-	vr::HmdMatrix44_t mat = m_pHMD->GetProjectionMatrix( nEye, m_fNearClip, m_fFarClip );
+	const float (&mat)[4][4] = hmd_info.projection[nEye];
 
 	return glm::mat4(
-		mat.m[0][0], mat.m[1][0], mat.m[2][0], mat.m[3][0],
-		mat.m[0][1], mat.m[1][1], mat.m[2][1], mat.m[3][1], 
-		mat.m[0][2], mat.m[1][2], mat.m[2][2], mat.m[3][2], 
-		mat.m[0][3], mat.m[1][3], mat.m[2][3], mat.m[3][3]
+		mat[0][0], mat[1][0], mat[2][0], mat[3][0],
+		mat[0][1], mat[1][1], mat[2][1], mat[3][1], 
+		mat[0][2], mat[1][2], mat[2][2], mat[3][2], 
+		mat[0][3], mat[1][3], mat[2][3], mat[3][3]
 	);
 }
 
@@ -2532,10 +5223,11 @@ glm::mat4 CMainApplication::GetHMDMatrixProjectionEye( vr::Hmd_Eye nEye )
 //-----------------------------------------------------------------------------
 glm::mat4 CMainApplication::GetHMDMatrixPoseEye( vr::Hmd_Eye nEye )
 {
-	if ( !m_pHMD )
+	if ( !hmd_info_valid )
 		return glm::mat4(1.0f);
 
-	vr::HmdMatrix34_t matEyeRight = m_pHMD->GetEyeToHeadTransform( nEye );
+	vr::HmdMatrix34_t matEyeRight;
+	memcpy( matEyeRight.m, hmd_info.eye_to_head[nEye], sizeof( matEyeRight.m ) );
 	glm::mat4 matrixObj(
 		matEyeRight.m[0][0], matEyeRight.m[1][0], matEyeRight.m[2][0], 0.0, 
 		matEyeRight.m[0][1], matEyeRight.m[1][1], matEyeRight.m[2][1], 0.0,
@@ -2553,6 +5245,9 @@ glm::mat4 CMainApplication::GetHMDMatrixPoseEye( vr::Hmd_Eye nEye )
 //-----------------------------------------------------------------------------
 glm::mat4 CMainApplication::GetCurrentViewProjectionMatrix( vr::Hmd_Eye nEye )
 {
+	if( overlay_scene_pass )
+		return overlay_scene_matrix[nEye];
+
 	glm::mat4 matMVP;
 	//glm::mat4 pp;
 	//memcpy(&pp[0], m_mat4HMDPose.get(), sizeof(m_mat4HMDPose));
@@ -2583,20 +5278,30 @@ glm::mat4 CMainApplication::GetCurrentViewProjectionMatrix( vr::Hmd_Eye nEye )
 //-----------------------------------------------------------------------------
 void CMainApplication::UpdateHMDMatrixPose()
 {
-	if ( !m_pHMD )
-		return;
-
-	vr::VRCompositor()->WaitGetPoses(m_rTrackedDevicePose, vr::k_unMaxTrackedDeviceCount, NULL, 0 );
+	if ( is_replaying() )
+	{
+		replay_poses( device_classes );
+	}
+	else
+	{
+		// The latest prediction of the pose thread, this never waits for the compositor
+		PoseSample pose_sample;
+		if ( !pose_sampler.get_latest( pose_sample ) )
+			return;
+		memcpy( m_rTrackedDevicePose, pose_sample.poses, sizeof( m_rTrackedDevicePose ) );
+
+		if ( trace_writer.is_open() )
+			record_poses( device_classes );
+	}
 
 	m_iValidPoseCount = 0;
-	m_strPoseClasses = "";
 	for ( int nDevice = 0; nDevice < (int)vr::k_unMaxTrackedDeviceCount; ++nDevice )
 	{
 		if ( m_rTrackedDevicePose[nDevice].bPoseIsValid )
 		{
 			m_iValidPoseCount++;
 			m_rmat4DevicePose[nDevice] = ConvertSteamVRMatrixToMatrix4( m_rTrackedDevicePose[nDevice].mDeviceToAbsoluteTracking );
-			switch (m_pHMD->GetTrackedDeviceClass(nDevice))
+			switch (device_classes[nDevice])
 			{
 			case vr::TrackedDeviceClass_Controller:        m_rDevClassChar[nDevice] = 'C'; break;
 			case vr::TrackedDeviceClass_HMD: {
@@ -2616,7 +5321,6 @@ void CMainApplication::UpdateHMDMatrixPose()
 			case vr::TrackedDeviceClass_TrackingReference: m_rDevClassChar[nDevice] = 'T'; break;
 			default:                                       m_rDevClassChar[nDevice] = '?'; break;
 			}
-			m_strPoseClasses += m_rDevClassChar[nDevice];
 		}
 	}
 
@@ -2642,30 +5346,20 @@ glm::mat4 CMainApplication::ConvertSteamVRMatrixToMatrix4( const vr::HmdMatrix34
 
 CMainApplication *pMainApplication;
 
-void reset_position(int signum)
-{
-	printf("ok\n");
-	if(pMainApplication)
-		pMainApplication->ResetRotation();
-}
-
-void quit(int signum) {
-	if(pMainApplication)
-		pMainApplication->bQuit = true;
-}
-
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
 int main(int argc, char *argv[])
 {
-	pMainApplication = new CMainApplication( argc, argv );
+	startup_trace_init();
 
-	signal(SIGUSR1, reset_position);
-	signal(SIGUSR2, reset_position);
+	// Blocked before any thread is started, since threads inherit the mask. Otherwise the signals could be
+	// delivered to a thread instead of the signalfd
+	sigset_t signal_mask;
+	get_event_loop_signals(signal_mask);
+	pthread_sigmask(SIG_BLOCK, &signal_mask, nullptr);
 
-	signal(SIGINT, quit);
-	signal(SIGTERM, quit);
+	pMainApplication = new CMainApplication( argc, argv );
 
 	if (!pMainApplication->BInit())
 	{
@@ -2676,7 +5370,7 @@ int main(int argc, char *argv[])
 	pMainApplication->RunMainLoop();
 	pMainApplication->Shutdown();
 
-	if(pMainApplication->exit_code == 0)
+	if(pMainApplication->exit_code == 0 && !pMainApplication->is_replaying() && !pMainApplication->is_render_benchmark() && !pMainApplication->is_latency_probe())
 		pMainApplication->save_config();
 
 	return pMainApplication->exit_code;
@@ -0,0 +1,373 @@
+#include "../include/metrics.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class MetricType : uint8_t {
+    COUNTER = 0,
+    GAUGE = 1,
+    HISTOGRAM = 2
+};
+
+struct Metric {
+    MetricType type;
+    std::string name;
+    std::string help;
+};
+
+struct MetricsCounter : Metric {
+    std::atomic<uint64_t> value{0};
+};
+
+struct MetricsGauge : Metric {
+    std::atomic<double> value{0.0};
+};
+
+struct MetricsHistogram : Metric {
+    std::vector<double> bounds;
+    // One more bucket than |bounds|, for +Inf. Not cumulative, the cumulative counts are calculated when the metrics are written
+    std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+    std::atomic<double> sum{0.0};
+};
+
+static std::mutex metrics_mutex;
+static std::vector<std::unique_ptr<Metric>> metrics;
+// Metrics whose name is already used by a metric of another type. They can be updated but are not published
+static std::vector<std::unique_ptr<Metric>> unpublished_metrics;
+
+static Metric* find_metric(const char *name) {
+    for(auto &metric : metrics) {
+        if(metric->name == name)
+            return metric.get();
+    }
+    return nullptr;
+}
+
+// Never returns null, so that callers don't have to check
+template <typename T>
+static T* register_metric(const char *name, const char *help, MetricType type, bool &created) {
+    Metric *existing_metric = find_metric(name);
+    if(existing_metric && existing_metric->type == type) {
+        created = false;
+        return static_cast<T*>(existing_metric);
+    }
+
+    T *metric = new T();
+    metric->type = type;
+    metric->name = name;
+    metric->help = help;
+    if(existing_metric) {
+        fprintf(stderr, "Error: metric %s is already registered with a different type\n", name);
+        unpublished_metrics.emplace_back(metric);
+    } else {
+        metrics.emplace_back(metric);
+    }
+    created = true;
+    return metric;
+}
+
+MetricsCounter* metrics_counter(const char *name, const char *help) {
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    bool created;
+    return register_metric<MetricsCounter>(name, help, MetricType::COUNTER, created);
+}
+
+MetricsGauge* metrics_gauge(const char *name, const char *help) {
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    bool created;
+    return register_metric<MetricsGauge>(name, help, MetricType::GAUGE, created);
+}
+
+MetricsHistogram* metrics_histogram(const char *name, const char *help, const double *bounds, int num_bounds) {
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    bool created;
+    MetricsHistogram *histogram = register_metric<MetricsHistogram>(name, help, MetricType::HISTOGRAM, created);
+    if(created) {
+        histogram->bounds.assign(bounds, bounds + num_bounds);
+        histogram->buckets.reset(new std::atomic<uint64_t>[num_bounds + 1]);
+        for(int i = 0; i < num_bounds + 1; ++i) {
+            histogram->buckets[i] = 0;
+        }
+    }
+    return histogram;
+}
+
+MetricsHistogram* metrics_latency_histogram(const char *name, const char *help) {
+    static const double bounds[] = { 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0 };
+    return metrics_histogram(name, help, bounds, sizeof(bounds) / sizeof(bounds[0]));
+}
+
+void metrics_counter_add(MetricsCounter *counter, uint64_t value) {
+    counter->value.fetch_add(value, std::memory_order_relaxed);
+}
+
+void metrics_gauge_set(MetricsGauge *gauge, double value) {
+    gauge->value.store(value, std::memory_order_relaxed);
+}
+
+void metrics_histogram_observe(MetricsHistogram *histogram, double value) {
+    size_t bucket = 0;
+    while(bucket < histogram->bounds.size() && value > histogram->bounds[bucket]) {
+        ++bucket;
+    }
+    histogram->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    double sum = histogram->sum.load(std::memory_order_relaxed);
+    while(!histogram->sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {}
+}
+
+double metrics_time_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 0.000000001;
+}
+
+static void append_format(std::string &str, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void append_format(std::string &str, const char *fmt, ...) {
+    char buffer[512];
+    va_list args;
+    va_start(args, fmt);
+    const int size = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
+    if(size > 0)
+        str.append(buffer, std::min((size_t)size, sizeof(buffer) - 1));
+}
+
+static void write_prometheus_text(std::string &output) {
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    for(const auto &metric : metrics) {
+        append_format(output, "# HELP %s %s\n", metric->name.c_str(), metric->help.c_str());
+        switch(metric->type) {
+            case MetricType::COUNTER: {
+                const MetricsCounter *counter = static_cast<const MetricsCounter*>(metric.get());
+                append_format(output, "# TYPE %s counter\n%s %llu\n", metric->name.c_str(), metric->name.c_str(), (unsigned long long)counter->value.load());
+                break;
+            }
+            case MetricType::GAUGE: {
+                const MetricsGauge *gauge = static_cast<const MetricsGauge*>(metric.get());
+                append_format(output, "# TYPE %s gauge\n%s %.17g\n", metric->name.c_str(), metric->name.c_str(), gauge->value.load());
+                break;
+            }
+            case MetricType::HISTOGRAM: {
+                const MetricsHistogram *histogram = static_cast<const MetricsHistogram*>(metric.get());
+                append_format(output, "# TYPE %s histogram\n", metric->name.c_str());
+                uint64_t cumulative_count = 0;
+                for(size_t i = 0; i < histogram->bounds.size(); ++i) {
+                    cumulative_count += histogram->buckets[i].load();
+                    append_format(output, "%s_bucket{le=\"%g\"} %llu\n", metric->name.c_str(), histogram->bounds[i], (unsigned long long)cumulative_count);
+                }
+                cumulative_count += histogram->buckets[histogram->bounds.size()].load();
+                append_format(output, "%s_bucket{le=\"+Inf\"} %llu\n", metric->name.c_str(), (unsigned long long)cumulative_count);
+                append_format(output, "%s_sum %.17g\n", metric->name.c_str(), histogram->sum.load());
+                append_format(output, "%s_count %llu\n", metric->name.c_str(), (unsigned long long)cumulative_count);
+                break;
+            }
+        }
+    }
+}
+
+template <typename T>
+static void append_value(std::string &output, T value) {
+    output.append((const char*)&value, sizeof(value));
+}
+
+/*
+    Binary snapshot, all values are little endian:
+        u32 magic "VRMS", u32 version (1), f64 time (metrics_time_seconds), u32 number of metrics
+    followed by each metric:
+        u8 type (0 counter, 1 gauge, 2 histogram), u16 name length, name (not null terminated)
+        counter: u64 value
+        gauge: f64 value
+        histogram: u32 number of buckets including +Inf, for each bucket f64 upper bound (+Inf for the last one)
+                   and u64 cumulative count, then f64 sum
+*/
+static void write_snapshot(std::string &output) {
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    append_value<uint32_t>(output, 0x534D5256); // "VRMS"
+    append_value<uint32_t>(output, 1);
+    append_value<double>(output, metrics_time_seconds());
+    append_value<uint32_t>(output, metrics.size());
+    for(const auto &metric : metrics) {
+        append_value<uint8_t>(output, (uint8_t)metric->type);
+        append_value<uint16_t>(output, metric->name.size());
+        output.append(metric->name);
+        switch(metric->type) {
+            case MetricType::COUNTER:
+                append_value<uint64_t>(output, static_cast<const MetricsCounter*>(metric.get())->value.load());
+                break;
+            case MetricType::GAUGE:
+                append_value<double>(output, static_cast<const MetricsGauge*>(metric.get())->value.load());
+                break;
+            case MetricType::HISTOGRAM: {
+                const MetricsHistogram *histogram = static_cast<const MetricsHistogram*>(metric.get());
+                append_value<uint32_t>(output, histogram->bounds.size() + 1);
+                uint64_t cumulative_count = 0;
+                for(size_t i = 0; i < histogram->bounds.size() + 1; ++i) {
+                    cumulative_count += histogram->buckets[i].load();
+                    append_value<double>(output, i < histogram->bounds.size() ? histogram->bounds[i] : INFINITY);
+                    append_value<uint64_t>(output, cumulative_count);
+                }
+                append_value<double>(output, histogram->sum.load());
+                break;
+            }
+        }
+    }
+}
+
+static std::thread metrics_server_thread;
+static int metrics_server_fd = -1;
+static int metrics_server_stop_fds[2] = { -1, -1 };
+
+// A request has to be read and answered within this time from when it was accepted. The server
+// handles one client at a time, so a slow client would otherwise hold up every other scraper
+static const double metrics_request_timeout_seconds = 2.0;
+
+// Waits for |events| on |fd| until |deadline| (in the metrics_time_seconds clock). Returns false on timeout or error
+static bool poll_until(int fd, short events, double deadline) {
+    const double remaining_seconds = deadline - metrics_time_seconds();
+    if(remaining_seconds <= 0.0)
+        return false;
+    struct pollfd poll_fd = { fd, events, 0 };
+    return poll(&poll_fd, 1, (int)ceil(remaining_seconds * 1000.0)) > 0;
+}
+
+// A scraper that disconnects early shouldn't kill the process with SIGPIPE
+static bool send_all(int fd, const char *data, size_t size, double deadline) {
+    while(size > 0) {
+        if(!poll_until(fd, POLLOUT, deadline))
+            return false;
+        const ssize_t bytes_written = send(fd, data, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(bytes_written == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+            continue;
+        if(bytes_written <= 0)
+            return false;
+        data += bytes_written;
+        size -= bytes_written;
+    }
+    return true;
+}
+
+static void metrics_server_handle_client(int client_fd, double deadline) {
+    // Only the request line is needed. A client that doesn't send it before the deadline is dropped
+    char request[1024];
+    size_t request_size = 0;
+    while(request_size < sizeof(request) - 1 && !memchr(request, '\n', request_size)) {
+        if(!poll_until(client_fd, POLLIN, deadline))
+            return;
+        const ssize_t bytes_read = read(client_fd, request + request_size, sizeof(request) - 1 - request_size);
+        if(bytes_read == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+            continue;
+        if(bytes_read <= 0)
+            return;
+        request_size += bytes_read;
+    }
+    request[request_size] = '\0';
+
+    std::string body;
+    const char *status = "200 OK";
+    const char *content_type = "text/plain; version=0.0.4";
+    if(strncmp(request, "GET /metrics ", 13) == 0) {
+        write_prometheus_text(body);
+    } else if(strncmp(request, "GET /snapshot ", 14) == 0) {
+        write_snapshot(body);
+        content_type = "application/octet-stream";
+    } else {
+        status = "404 Not Found";
+        body = "Not found, use /metrics or /snapshot\n";
+        content_type = "text/plain";
+    }
+
+    std::string response;
+    append_format(response, "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", status, content_type, body.size());
+    response += body;
+    send_all(client_fd, response.data(), response.size(), deadline);
+}
+
+static void metrics_server_run() {
+    while(true) {
+        struct pollfd poll_fds[2] = {
+            { metrics_server_fd, POLLIN, 0 },
+            { metrics_server_stop_fds[0], POLLIN, 0 }
+        };
+        if(poll(poll_fds, 2, -1) == -1) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        if(poll_fds[1].revents)
+            break;
+
+        const int client_fd = accept4(metrics_server_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if(client_fd == -1)
+            continue;
+        metrics_server_handle_client(client_fd, metrics_time_seconds() + metrics_request_timeout_seconds);
+        close(client_fd);
+    }
+}
+
+int metrics_server_start(int port) {
+    if(metrics_server_fd != -1)
+        return 0;
+
+    metrics_server_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if(metrics_server_fd == -1) {
+        fprintf(stderr, "Error: failed to create metrics socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    const int reuse_addr = 1;
+    setsockopt(metrics_server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse_addr, sizeof(reuse_addr));
+
+    // Only for local scrapers
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(metrics_server_fd, (const struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(metrics_server_fd, 8) == -1) {
+        fprintf(stderr, "Error: failed to listen for metrics on 127.0.0.1:%d: %s\n", port, strerror(errno));
+        close(metrics_server_fd);
+        metrics_server_fd = -1;
+        return 1;
+    }
+
+    if(pipe2(metrics_server_stop_fds, O_CLOEXEC) == -1) {
+        fprintf(stderr, "Error: failed to create metrics server pipe: %s\n", strerror(errno));
+        close(metrics_server_fd);
+        metrics_server_fd = -1;
+        return 1;
+    }
+
+    metrics_server_thread = std::thread(metrics_server_run);
+    return 0;
+}
+
+void metrics_server_stop(void) {
+    if(metrics_server_fd == -1)
+        return;
+
+    close(metrics_server_stop_fds[1]);
+    metrics_server_thread.join();
+    close(metrics_server_stop_fds[0]);
+    close(metrics_server_fd);
+    metrics_server_stop_fds[0] = -1;
+    metrics_server_stop_fds[1] = -1;
+    metrics_server_fd = -1;
+}
@@ -1,93 +1,211 @@
 #include "../include/mpv.hpp"
+#include "../include/startup_trace.hpp"
+#include "../include/notification.hpp"
+#include "../include/metrics.h"
 #include <mpv/client.h>
 #include <mpv/render_gl.h>
+#include <SDL.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
-#include <signal.h>
-#include <sys/wait.h>
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/statvfs.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+// libmpv is loaded at runtime instead of being linked, so that window capture doesn't have to load
+// libmpv and all of its dependencies (ffmpeg, libass, ...) when --video isn't used
+#define LIBMPV_FUNCTIONS(X) \
+    X(mpv_create) \
+    X(mpv_initialize) \
+    X(mpv_destroy) \
+    X(mpv_set_option_string) \
+    X(mpv_command_async) \
+    X(mpv_observe_property) \
+    X(mpv_get_property) \
+    X(mpv_get_property_string) \
+    X(mpv_free) \
+    X(mpv_free_node_contents) \
+    X(mpv_set_property_async) \
+    X(mpv_set_wakeup_callback) \
+    X(mpv_wait_event) \
+    X(mpv_error_string) \
+    X(mpv_render_context_create) \
+    X(mpv_render_context_free) \
+    X(mpv_render_context_render) \
+    X(mpv_render_context_set_update_callback) \
+    X(mpv_render_context_update) \
+    X(mpv_render_context_get_info) \
+    X(mpv_render_context_report_swap) \
+    X(mpv_get_time_us)
+
+#define LIBMPV_DECLARE_FUNCTION(name) decltype(&::name) name = nullptr;
+static struct {
+    void *handle = nullptr;
+    LIBMPV_FUNCTIONS(LIBMPV_DECLARE_FUNCTION)
+} libmpv;
+#undef LIBMPV_DECLARE_FUNCTION
+
+static bool libmpv_load() {
+    if(libmpv.handle)
+        return true;
 
-static bool exec_program_daemonized(const char **args) {
-    /* 1 argument */
-    if(args[0] == nullptr)
-        return false;
+    StartupTraceScope trace_scope("load libmpv");
+
+    const char *sonames[] = { "libmpv.so.2", "libmpv.so.1", "libmpv.so" };
+    for(const char *soname : sonames) {
+        libmpv.handle = dlopen(soname, RTLD_NOW | RTLD_LOCAL);
+        if(libmpv.handle)
+            break;
+    }
 
-    pid_t pid = vfork();
-    if(pid == -1) {
-        perror("Failed to vfork");
+    if(!libmpv.handle) {
+        fprintf(stderr, "Error: failed to load libmpv (tried libmpv.so.2, libmpv.so.1 and libmpv.so): %s\n", dlerror());
+        fprintf(stderr, "Error: libmpv needs to be installed to use the --video option\n");
         return false;
-    } else if(pid == 0) { /* child */
-        setsid();
-        signal(SIGHUP, SIG_IGN);
-
-        // Daemonize child to make the parent the init process which will reap the zombie child
-        pid_t second_child = vfork();
-        if(second_child == 0) { // child
-            execvp(args[0], (char* const*)args);
-            perror("execvp");
-            _exit(127);
-        } else if(second_child != -1) {
-            // TODO:
-            _exit(0);
-        }
-    } else { /* parent */
-        waitpid(pid, nullptr, 0); 
     }
 
-    return true;
-}
+    #define LIBMPV_LOAD_FUNCTION(name) \
+        libmpv.name = (decltype(libmpv.name))dlsym(libmpv.handle, #name); \
+        if(!libmpv.name) { \
+            fprintf(stderr, "Error: libmpv is missing the function %s, your libmpv is too old\n", #name); \
+            dlclose(libmpv.handle); \
+            libmpv.handle = nullptr; \
+            return false; \
+        }
+    LIBMPV_FUNCTIONS(LIBMPV_LOAD_FUNCTION)
+    #undef LIBMPV_LOAD_FUNCTION
 
-static void show_notification(const char *title, const char *msg, const char *urgency) {
-    const char *args[] = { "notify-send", "-a", "vr-video-player", "-t", "10000", "-u", urgency, "--", title, msg, NULL };
-    exec_program_daemonized(args);
+    return true;
 }
 
 static void* get_proc_address_mpv(void*, const char *name) {
     return SDL_GL_GetProcAddress(name);
 }
 
+struct MpvMetrics {
+    MetricsGauge *cache_bytes = metrics_gauge("vrvp_mpv_cache_ahead_bytes", "Bytes of the video that have been read ahead of the playback position");
+    MetricsGauge *cache_seconds = metrics_gauge("vrvp_mpv_cache_ahead_seconds", "Seconds of the video that have been read ahead of the playback position");
+    MetricsGauge *cache_input_rate = metrics_gauge("vrvp_mpv_cache_input_bytes_per_second", "Rate the demuxer cache is being filled at");
+    MetricsCounter *cache_underruns = metrics_counter("vrvp_mpv_cache_underruns_total", "Times playback paused because the demuxer cache ran empty");
+    MetricsGauge *dropped_frames = metrics_gauge("vrvp_mpv_dropped_frames", "Video frames dropped by the decoder and the video output in the current file");
+    MetricsHistogram *seek_latency = metrics_latency_histogram("vrvp_mpv_seek_latency_seconds", "Time from a seek request to the first video frame after it");
+};
+
+static MpvMetrics& get_metrics() {
+    static MpvMetrics metrics;
+    return metrics;
+}
+
+static int64_t get_monotonic_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
+}
+
+// reply_userdata of the seek commands, the replies of the other commands aren't used
+static const uint64_t SEEK_REPLY_USERDATA = 1;
+
 static void on_mpv_events(void *ctx) {
     Mpv *mpv = (Mpv*)ctx;
-    SDL_Event event;
-    event.type = mpv->wakeup_on_mpv_events;
-    SDL_PushEvent(&event);
+    mpv->wakeup(Mpv::WAKEUP_EVENTS);
 }
 
 static void on_mpv_render_update(void *ctx) {
     Mpv *mpv = (Mpv*)ctx;
-    SDL_Event event;
-    event.type = mpv->wakeup_on_mpv_render_update;
-    SDL_PushEvent(&event);
+    mpv->wakeup(Mpv::WAKEUP_RENDER_UPDATE);
 }
 
 Mpv::~Mpv() {
     destroy();
+    if(wakeup_fd != -1)
+        close(wakeup_fd);
+}
+
+bool Mpv::create_wakeup_fd() {
+    if(wakeup_fd != -1)
+        return true;
+
+    wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wakeup_fd == -1) {
+        fprintf(stderr, "Error: eventfd failed: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void Mpv::wakeup(uint32_t reason) {
+    // Only the first wakeup before the main thread handles them is timed and written to the fd
+    if(pending_wakeups.load() == 0)
+        wakeup_time_us = get_monotonic_time_us();
+    if(pending_wakeups.fetch_or(reason) != 0)
+        return;
+
+    const uint64_t value = 1;
+    ssize_t written = write(wakeup_fd, &value, sizeof(value));
+    (void)written;
 }
 
 bool Mpv::create(bool use_system_mpv_config) {
-    if(created)
+    if(created || mpv)
         return false;
 
-    mpv = mpv_create();
+    if(!libmpv_load())
+        return false;
+
+    mpv = libmpv.mpv_create();
     if(!mpv) {
         fprintf(stderr, "Error: mpv_create failed\n");
         return false;
     }
 
     if(use_system_mpv_config) {
-        mpv_set_option_string(mpv, "config", "yes");
-        mpv_set_option_string(mpv, "load-scripts", "yes");
+        libmpv.mpv_set_option_string(mpv, "config", "yes");
+        libmpv.mpv_set_option_string(mpv, "load-scripts", "yes");
     }
 
-    if(mpv_initialize(mpv) < 0) {
+    if(libmpv.mpv_initialize(mpv) < 0) {
         fprintf(stderr, "Error: mpv_initialize failed\n");
-        mpv_destroy(mpv);
+        libmpv.mpv_destroy(mpv);
         mpv = nullptr;
         return false;
     }
 
     //mpv_request_log_messages(mpv, "debug");
 
+    libmpv.mpv_set_option_string(mpv, "vd-lavc-dr", "yes");
+    libmpv.mpv_set_option_string(mpv, "vo", "libmpv");
+    libmpv.mpv_set_option_string(mpv, "hwdec", "auto");
+    libmpv.mpv_set_option_string(mpv, "profile", "gpu-hq");
+    libmpv.mpv_set_option_string(mpv, "gpu-api", "opengl");
+    libmpv.mpv_set_option_string(mpv, "audio-channels", "stereo");
+    // Open (and start buffering) the next playlist entry while the current one is still playing
+    libmpv.mpv_set_option_string(mpv, "prefetch-playlist", "yes");
+    // Stay alive between playlist entries and at the end of the playlist, the end of the playlist is detected with idle-active
+    libmpv.mpv_set_option_string(mpv, "idle", "yes");
+    libmpv.mpv_observe_property(mpv, 0, "idle-active", MPV_FORMAT_FLAG);
+
+    if(cache_settings.mode == MpvCacheSettings::Mode::DISABLED) {
+        libmpv.mpv_set_option_string(mpv, "cache", "no");
+    } else {
+        // The size is set per file in |configure_cache|, when the bitrate is known
+        libmpv.mpv_set_option_string(mpv, "cache", "yes");
+        if(cache_settings.on_disk)
+            libmpv.mpv_set_option_string(mpv, "cache-on-disk", "yes");
+        libmpv.mpv_observe_property(mpv, 0, "paused-for-cache", MPV_FORMAT_FLAG);
+    }
+    return true;
+}
+
+bool Mpv::create_render_context() {
+    if(created || !mpv)
+        return false;
+
     mpv_opengl_init_params gl_init_params;
     memset(&gl_init_params, 0, sizeof(gl_init_params));
     gl_init_params.get_proc_address = get_proc_address_mpv;
@@ -98,55 +216,47 @@ bool Mpv::create(bool use_system_mpv_config) {
         { MPV_RENDER_PARAM_API_TYPE, (void*)MPV_RENDER_API_TYPE_OPENGL },
         { MPV_RENDER_PARAM_OPENGL_INIT_PARAMS, &gl_init_params },
         { MPV_RENDER_PARAM_ADVANCED_CONTROL, &advanced_control },
-        //{ MPV_RENDER_PARAM_BLOCK_FOR_TARGET_TIME, 0 }, // TODO: Manually sync after this
         { MPV_RENDER_PARAM_INVALID, 0 }
     };
 
-    mpv_set_option_string(mpv, "vd-lavc-dr", "yes");
-    mpv_set_option_string(mpv, "vo", "libmpv");
-    mpv_set_option_string(mpv, "hwdec", "auto");
-    mpv_set_option_string(mpv, "profile", "gpu-hq");
-    mpv_set_option_string(mpv, "gpu-api", "opengl");
-    mpv_set_option_string(mpv, "audio-channels", "stereo");
-
-    if(mpv_render_context_create(&mpv_gl, mpv, params) < 0) {
+    if(libmpv.mpv_render_context_create(&mpv_gl, mpv, params) < 0) {
         fprintf(stderr, "Error: mpv_render_context_create failed\n");
-        mpv_destroy(mpv);
+        libmpv.mpv_destroy(mpv);
         mpv = nullptr;
         mpv_gl = nullptr;
         return false;
     }
 
-    wakeup_on_mpv_render_update = SDL_RegisterEvents(1);
-    wakeup_on_mpv_events = SDL_RegisterEvents(1);
-    if(wakeup_on_mpv_render_update == (uint32_t)-1 || wakeup_on_mpv_events == (uint32_t)-1) {
-        fprintf(stderr, "Error: SDL_RegisterEvents failed\n");
-        // TODO: Remove registered events?
-        wakeup_on_mpv_render_update = -1;
-        wakeup_on_mpv_events = -1;
-        mpv_render_context_free(mpv_gl);
-        mpv_destroy(mpv);
+    if(wakeup_fd == -1) {
+        fprintf(stderr, "Error: create_wakeup_fd has to be called before create_render_context\n");
+        libmpv.mpv_render_context_free(mpv_gl);
+        libmpv.mpv_destroy(mpv);
         mpv = nullptr;
         mpv_gl = nullptr;
         return false;
     }
 
-    mpv_set_wakeup_callback(mpv, on_mpv_events, this);
-    mpv_render_context_set_update_callback(mpv_gl, on_mpv_render_update, this);
+    libmpv.mpv_set_wakeup_callback(mpv, on_mpv_events, this);
+    libmpv.mpv_render_context_set_update_callback(mpv_gl, on_mpv_render_update, this);
 
     created = true;
     return true;
 }
 
 bool Mpv::destroy() {
-    if(!created)
+    if(!created && !mpv)
         return true;
 
+    keyframe_index.save();
+    log_seek_latency_percentiles();
+
     if(mpv_gl)
-        mpv_render_context_free(mpv_gl);
+        libmpv.mpv_render_context_free(mpv_gl);
     if(mpv)
-        mpv_destroy(mpv);
+        libmpv.mpv_destroy(mpv);
 
+    mpv_gl = nullptr;
+    mpv = nullptr;
     created = false;
     return true;
 }
@@ -155,12 +265,37 @@ bool Mpv::load_file(const char *path) {
     if(!created)
         return false;
 
-    const char *cmd[] = { "loadfile", path, nullptr };
-    mpv_command_async(mpv, 0, cmd);
+    const char *cmd[] = { "loadfile", path, "replace", nullptr };
+    libmpv.mpv_command_async(mpv, 0, cmd);
     return true;
 }
 
-void Mpv::on_event(SDL_Event &event, bool *render_update, int64_t *width, int64_t *height, bool *quit, int *error) {
+bool Mpv::append_file(const char *path) {
+    if(!created)
+        return false;
+
+    const char *cmd[] = { "loadfile", path, "append", nullptr };
+    libmpv.mpv_command_async(mpv, 0, cmd);
+    return true;
+}
+
+void Mpv::playlist_next() {
+    if(!created)
+        return;
+
+    const char *cmd[] = { "playlist-next", nullptr };
+    libmpv.mpv_command_async(mpv, 0, cmd);
+}
+
+void Mpv::playlist_prev() {
+    if(!created)
+        return;
+
+    const char *cmd[] = { "playlist-prev", nullptr };
+    libmpv.mpv_command_async(mpv, 0, cmd);
+}
+
+void Mpv::process_wakeups(bool *render_update, int64_t *width, int64_t *height, bool *quit, int *error, bool *file_ended) {
     if(render_update)
         *render_update = false;
 
@@ -176,20 +311,41 @@ void Mpv::on_event(SDL_Event &event, bool *render_update, int64_t *width, int64_
     if(error)
         *error = 0;
 
+    if(file_ended)
+        *file_ended = false;
+
+    wakeup_latency_ms = 0.0;
     if(!created)
         return;
 
-    if(event.type == wakeup_on_mpv_render_update) {
-        uint64_t flags = mpv_render_context_update(mpv_gl);
+    uint64_t value = 0;
+    ssize_t bytes_read = read(wakeup_fd, &value, sizeof(value));
+    (void)bytes_read;
+    const uint32_t wakeups = pending_wakeups.exchange(0);
+    if(wakeups == 0)
+        return;
+    wakeup_latency_ms = std::max((int64_t)0, get_monotonic_time_us() - wakeup_time_us.load()) / 1000.0;
+
+    if(wakeups & WAKEUP_RENDER_UPDATE) {
+        uint64_t flags = libmpv.mpv_render_context_update(mpv_gl);
         if(flags & MPV_RENDER_UPDATE_FRAME) {
             if(render_update)
                 *render_update = true;
+
+            if(seek_awaiting_frame) {
+                seek_awaiting_frame = false;
+                const double seek_latency_ms = (libmpv.mpv_get_time_us(mpv) - seek_request_time_us) / 1000.0;
+                seek_latencies_ms.push_back(seek_latency_ms);
+                metrics_histogram_observe(get_metrics().seek_latency, seek_latency_ms / 1000.0);
+                if(seek_latencies_ms.size() % 10 == 0)
+                    log_seek_latency_percentiles();
+            }
         }
     }
 
-    if(event.type == wakeup_on_mpv_events) {
+    if(wakeups & WAKEUP_EVENTS) {
         while(true) {
-            mpv_event *mp_event = mpv_wait_event(mpv, 0);
+            mpv_event *mp_event = libmpv.mpv_wait_event(mpv, 0);
             if(mp_event->event_id == MPV_EVENT_NONE)
                 break;
             
@@ -200,28 +356,84 @@ void Mpv::on_event(SDL_Event &event, bool *render_update, int64_t *width, int64_
                 //printf("mpv event: %s\n", mpv_event_name(mp_event->event_id));
             }
 
+            if(mp_event->event_id == MPV_EVENT_START_FILE)
+                file_started = true;
+
+            if(mp_event->event_id == MPV_EVENT_FILE_LOADED) {
+                char *path = libmpv.mpv_get_property_string(mpv, "path");
+                if(path) {
+                    keyframe_index.open(path);
+                    libmpv.mpv_free(path);
+                }
+                configure_cache();
+            }
+
+            // A seek that mpv rejects (an unseekable stream for example) never restarts playback
+            if(mp_event->event_id == MPV_EVENT_COMMAND_REPLY && mp_event->reply_userdata == SEEK_REPLY_USERDATA && mp_event->error < 0 && seek_in_flight) {
+                fprintf(stderr, "Warning: mpv seek failed: %s\n", libmpv.mpv_error_string(mp_event->error));
+                seek_in_flight = false;
+                seek_learn_keyframe = false;
+                if(seek_pending)
+                    issue_seek();
+            }
+
+            if(mp_event->event_id == MPV_EVENT_PLAYBACK_RESTART && seek_in_flight) {
+                seek_in_flight = false;
+                // A keyframe seek always lands on a keyframe
+                if(seek_learn_keyframe) {
+                    double position = 0.0;
+                    if(libmpv.mpv_get_property(mpv, "time-pos", MPV_FORMAT_DOUBLE, &position) >= 0)
+                        keyframe_index.add(position);
+                }
+
+                if(seek_pending)
+                    issue_seek();
+                else
+                    seek_awaiting_frame = true;
+            }
+
             if(mp_event->event_id == MPV_EVENT_END_FILE) {
                 mpv_event_end_file *msg = (mpv_event_end_file*)mp_event->data;
-                if(msg->reason == MPV_END_FILE_REASON_ERROR) {
-                    show_notification("vr video player mpv video error", mpv_error_string(msg->error), "critical");
-                    if(quit) {
-                        *quit = true;
-                        *error = -1;
-                    }
+                last_file_failed = msg->reason == MPV_END_FILE_REASON_ERROR;
+                keyframe_index.save();
+                seek_in_flight = false;
+                seek_pending = false;
+                seek_awaiting_frame = false;
+                if(msg->reason == MPV_END_FILE_REASON_ERROR)
+                    show_notification("vr video player mpv video error", libmpv.mpv_error_string(msg->error), "critical");
+                if(file_ended && msg->reason != MPV_END_FILE_REASON_QUIT)
+                    *file_ended = true;
+            }
+
+            // mpv goes idle when there is nothing left in the playlist to play
+            if(mp_event->event_id == MPV_EVENT_PROPERTY_CHANGE) {
+                mpv_event_property *property = (mpv_event_property*)mp_event->data;
+                if(strcmp(property->name, "paused-for-cache") == 0 && property->format == MPV_FORMAT_FLAG && *(int*)property->data) {
+                    ++cache_underruns;
+                    metrics_counter_add(get_metrics().cache_underruns, 1);
+                    fprintf(stderr, "mpv cache: playback paused while waiting for data (%lld underruns)\n", (long long)cache_underruns);
                 }
-                if(msg->reason == MPV_END_FILE_REASON_EOF) {
-                    show_notification("vr video player", "the video ended", "low");
-                    if(quit)
-                        *quit = true;
+
+                if(strcmp(property->name, "idle-active") == 0 && property->format == MPV_FORMAT_FLAG && *(int*)property->data && file_started) {
+                    if(last_file_failed) {
+                        if(quit) {
+                            *quit = true;
+                            *error = -1;
+                        }
+                    } else {
+                        show_notification("vr video player", "the video ended", "low");
+                        if(quit)
+                            *quit = true;
+                    }
                 }
             }
 
             if(mp_event->event_id == MPV_EVENT_VIDEO_RECONFIG) {
                 int64_t new_width = 0;
-                mpv_get_property(mpv, "width", MPV_FORMAT_INT64, &new_width);
+                libmpv.mpv_get_property(mpv, "width", MPV_FORMAT_INT64, &new_width);
 
                 int64_t new_height = 0;
-                mpv_get_property(mpv, "height", MPV_FORMAT_INT64, &new_height);
+                libmpv.mpv_get_property(mpv, "height", MPV_FORMAT_INT64, &new_height);
                 
                 if(width)
                     *width = new_width;
@@ -233,24 +445,295 @@ void Mpv::on_event(SDL_Event &event, bool *render_update, int64_t *width, int64_
     }
 }
 
+static int64_t get_mem_available_bytes() {
+    FILE *file = fopen("/proc/meminfo", "rb");
+    if(!file)
+        return 0;
+
+    int64_t mem_available_kb = 0;
+    char line[256];
+    while(fgets(line, sizeof(line), file)) {
+        long long value = 0;
+        if(sscanf(line, "MemAvailable: %lld kB", &value) == 1) {
+            mem_available_kb = value;
+            break;
+        }
+    }
+
+    fclose(file);
+    return mem_available_kb * 1024;
+}
+
+// Free space where mpv stores its on-disk cache by default (~~cache/)
+static int64_t get_disk_cache_free_bytes() {
+    std::string cache_dir;
+    const char *xdg_cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if(xdg_cache_home && xdg_cache_home[0] != '\0')
+        cache_dir = xdg_cache_home;
+    else if(home)
+        cache_dir = std::string(home) + "/.cache";
+    else
+        return 0;
+
+    struct statvfs st;
+    if(statvfs(cache_dir.c_str(), &st) != 0)
+        return 0;
+    return (int64_t)st.f_bavail * (int64_t)st.f_frsize;
+}
+
+bool mpv_cache_settings_parse_size(const char *str, MpvCacheSettings &settings) {
+    if(strcmp(str, "auto") == 0) {
+        settings.mode = MpvCacheSettings::Mode::AUTO;
+        return true;
+    }
+
+    if(strcmp(str, "no") == 0) {
+        settings.mode = MpvCacheSettings::Mode::DISABLED;
+        return true;
+    }
+
+    char *endptr = nullptr;
+    const long long size_mib = strtoll(str, &endptr, 10);
+    if(endptr == str || *endptr != '\0' || size_mib <= 0)
+        return false;
+
+    settings.mode = MpvCacheSettings::Mode::FIXED;
+    settings.size_mib = size_mib;
+    return true;
+}
+
+void Mpv::configure_cache() {
+    if(cache_settings.mode == MpvCacheSettings::Mode::DISABLED)
+        return;
+
+    const int64_t mib = 1024 * 1024;
+    // How far ahead of the playhead to read, if there is enough memory (or disk space) for it
+    const double readahead_secs = cache_settings.on_disk ? 600.0 : 120.0;
+
+    int64_t file_size = 0;
+    double duration = 0.0;
+    libmpv.mpv_get_property(mpv, "file-size", MPV_FORMAT_INT64, &file_size);
+    libmpv.mpv_get_property(mpv, "duration", MPV_FORMAT_DOUBLE, &duration);
+    const double bytes_per_second = file_size > 0 && duration > 0.0 ? file_size / duration : 0.0;
+
+    int64_t max_bytes = 0;
+    if(cache_settings.mode == MpvCacheSettings::Mode::FIXED) {
+        max_bytes = cache_settings.size_mib * mib;
+    } else {
+        // Streams without a known size get a fixed amount
+        const int64_t wanted_bytes = bytes_per_second > 0.0 ? (int64_t)(bytes_per_second * readahead_secs) : 512 * mib;
+        // Leave most of the memory (or disk) for everything else
+        const int64_t available_bytes = (cache_settings.on_disk ? get_disk_cache_free_bytes() : get_mem_available_bytes()) / 4;
+        max_bytes = std::max(64 * mib, wanted_bytes);
+        if(available_bytes > 0)
+            max_bytes = std::min(max_bytes, available_bytes);
+    }
+
+    // Keep a bit of already played data around so that short backwards seeks don't have to read from the file again
+    const int64_t max_back_bytes = max_bytes / 4;
+    char max_bytes_str[32];
+    char max_back_bytes_str[32];
+    char readahead_secs_str[32];
+    snprintf(max_bytes_str, sizeof(max_bytes_str), "%lld", (long long)max_bytes);
+    snprintf(max_back_bytes_str, sizeof(max_back_bytes_str), "%lld", (long long)max_back_bytes);
+    snprintf(readahead_secs_str, sizeof(readahead_secs_str), "%f", readahead_secs);
+    set_property("demuxer-max-bytes", max_bytes_str);
+    set_property("demuxer-max-back-bytes", max_back_bytes_str);
+    set_property("cache-secs", readahead_secs_str);
+
+    fprintf(stderr, "mpv cache: %lld MiB ahead and %lld MiB behind the playhead (%s, %.1f Mbit/s)\n",
+        (long long)(max_bytes / mib), (long long)(max_back_bytes / mib), cache_settings.on_disk ? "on disk" : "in memory", bytes_per_second * 8.0 / 1000000.0);
+}
+
+void Mpv::update_cache_stats() {
+    if(!created || cache_settings.mode == MpvCacheSettings::Mode::DISABLED)
+        return;
+
+    const int64_t now_us = libmpv.mpv_get_time_us(mpv);
+    if(now_us - cache_stats_time_us < 10 * 1000000LL)
+        return;
+    cache_stats_time_us = now_us;
+
+    mpv_node node;
+    if(libmpv.mpv_get_property(mpv, "demuxer-cache-state", MPV_FORMAT_NODE, &node) < 0)
+        return;
+
+    if(node.format == MPV_FORMAT_NODE_MAP) {
+        for(int i = 0; i < node.u.list->num; ++i) {
+            const char *key = node.u.list->keys[i];
+            const mpv_node &value = node.u.list->values[i];
+            if(strcmp(key, "fw-bytes") == 0 && value.format == MPV_FORMAT_INT64)
+                cache_fill_bytes = value.u.int64;
+            else if(strcmp(key, "cache-duration") == 0 && value.format == MPV_FORMAT_DOUBLE)
+                cache_duration_secs = value.u.double_;
+            else if(strcmp(key, "raw-input-rate") == 0 && value.format == MPV_FORMAT_INT64)
+                cache_input_bytes_per_second = value.u.int64;
+        }
+    }
+    libmpv.mpv_free_node_contents(&node);
+
+    MpvMetrics &metrics = get_metrics();
+    metrics_gauge_set(metrics.cache_bytes, cache_fill_bytes);
+    metrics_gauge_set(metrics.cache_seconds, cache_duration_secs);
+    metrics_gauge_set(metrics.cache_input_rate, cache_input_bytes_per_second);
+
+    fprintf(stderr, "mpv cache: %.1f MiB (%.1f s) ahead, reading at %.1f MiB/s, %lld underruns\n",
+        cache_fill_bytes / (1024.0 * 1024.0), cache_duration_secs, cache_input_bytes_per_second / (1024.0 * 1024.0), (long long)cache_underruns);
+}
+
 void Mpv::seek(double seconds) {
     if(!created)
         return;
 
-    char seconds_str[128];
-    snprintf(seconds_str, sizeof(seconds_str), "%f", seconds);
+    // Seeks requested while a seek is in progress are added to the target of the pending seek,
+    // which is sent when the current seek has finished. Holding down an arrow key doesn't queue
+    // up seeks that each have to finish before the next one starts
+    if(!seek_in_flight && !seek_pending) {
+        if(libmpv.mpv_get_property(mpv, "time-pos", MPV_FORMAT_DOUBLE, &seek_target) < 0)
+            return;
+        seek_request_time_us = libmpv.mpv_get_time_us(mpv);
+        seek_awaiting_frame = false;
+    }
+
+    seek_target = std::max(0.0, seek_target + seconds);
+    double duration = 0.0;
+    if(libmpv.mpv_get_property(mpv, "duration", MPV_FORMAT_DOUBLE, &duration) >= 0 && duration > 1.0)
+        seek_target = std::min(seek_target, duration - 1.0);
+
+    seek_pending = true;
+    if(!seek_in_flight)
+        issue_seek();
+}
+
+void Mpv::issue_seek() {
+    const char *flags = "absolute+exact";
+    seek_learn_keyframe = false;
+
+    if(seek_mode == MpvSeekMode::KEYFRAME) {
+        // A known keyframe can be seeked to exactly without decoding any frames before the target.
+        // The time is rounded up to the precision it's sent with: a target that is even slightly before the
+        // keyframe would make mpv decode the whole previous group of pictures.
+        // Otherwise let mpv find a keyframe and remember where it landed
+        double keyframe = 0.0;
+        if(keyframe_index.find_nearest(seek_target, 2.0, keyframe)) {
+            seek_target = std::ceil(keyframe * 1000000.0) / 1000000.0;
+        } else {
+            flags = "absolute+keyframes";
+            seek_learn_keyframe = true;
+        }
+    }
+
+    char target_str[128];
+    snprintf(target_str, sizeof(target_str), "%.6f", seek_target);
 
-    const char *cmd[] = { "seek", seconds_str, nullptr };
-    mpv_command_async(mpv, 0, cmd);
+    const char *cmd[] = { "seek", target_str, flags, nullptr };
+    seek_pending = false;
+    seek_in_flight = libmpv.mpv_command_async(mpv, SEEK_REPLY_USERDATA, cmd) >= 0;
+}
+
+void Mpv::log_seek_latency_percentiles() {
+    if(seek_latencies_ms.empty())
+        return;
+
+    std::vector<double> sorted_latencies = seek_latencies_ms;
+    std::sort(sorted_latencies.begin(), sorted_latencies.end());
+    auto percentile = [&sorted_latencies](double p) {
+        return sorted_latencies[std::min(sorted_latencies.size() - 1, (size_t)(p * sorted_latencies.size()))];
+    };
+
+    fprintf(stderr, "Seek to first frame latency: p50 %.1f ms, p90 %.1f ms, p99 %.1f ms (%zu seeks, %s mode, %zu known keyframes)\n",
+        percentile(0.5), percentile(0.9), percentile(0.99), sorted_latencies.size(),
+        seek_mode == MpvSeekMode::KEYFRAME ? "keyframe" : "exact", keyframe_index.size());
 }
 
 void Mpv::toggle_pause() {
+    set_paused(!paused);
+}
+
+void Mpv::set_paused(bool pause) {
     if(!created)
         return;
 
-    paused = !paused;
+    paused = pause;
     int pause_value = paused ? 1 : 0;
-    mpv_set_property_async(mpv, 0, "pause", MPV_FORMAT_FLAG, &pause_value);
+    libmpv.mpv_set_property_async(mpv, 0, "pause", MPV_FORMAT_FLAG, &pause_value);
+}
+
+bool Mpv::get_paused() {
+    int pause_value = 0;
+    if(created)
+        libmpv.mpv_get_property(mpv, "pause", MPV_FORMAT_FLAG, &pause_value);
+    return pause_value != 0;
+}
+
+double Mpv::get_position() {
+    double position = -1.0;
+    if(created)
+        libmpv.mpv_get_property(mpv, "time-pos", MPV_FORMAT_DOUBLE, &position);
+    return position;
+}
+
+double Mpv::get_duration() {
+    double duration = -1.0;
+    if(created)
+        libmpv.mpv_get_property(mpv, "duration", MPV_FORMAT_DOUBLE, &duration);
+    return duration;
+}
+
+bool Mpv::next_frame_due(int64_t next_vsync_time_us, int64_t vsync_interval_us) {
+    if(!created)
+        return false;
+
+    mpv_render_frame_info frame_info;
+    memset(&frame_info, 0, sizeof(frame_info));
+    if(libmpv.mpv_render_context_get_info(mpv_gl, { MPV_RENDER_PARAM_NEXT_FRAME_INFO, &frame_info }) < 0)
+        return true;
+
+    next_frame_target_time_us = (frame_info.flags & MPV_RENDER_FRAME_INFO_PRESENT) ? frame_info.target_time : 0;
+
+    // Nothing new to show or a redraw of the current frame (for example after a seek while paused), render immediately
+    if(!(frame_info.flags & MPV_RENDER_FRAME_INFO_PRESENT) || (frame_info.flags & MPV_RENDER_FRAME_INFO_REDRAW))
+        return true;
+
+    if(frame_info.target_time <= 0 || next_vsync_time_us <= 0)
+        return true;
+
+    // Render the frame in time for the vsync that is closest to the time mpv wants it to be displayed
+    return frame_info.target_time < next_vsync_time_us + vsync_interval_us / 2;
+}
+
+int64_t Mpv::get_time_us() {
+    if(!mpv)
+        return 0;
+    return libmpv.mpv_get_time_us(mpv);
+}
+
+int64_t Mpv::get_dropped_frame_count() {
+    if(!created)
+        return 0;
+
+    // vo-drop-frame-count is a deprecated alias of frame-drop-count, so it isn't added
+    int64_t vo_dropped = 0;
+    libmpv.mpv_get_property(mpv, "frame-drop-count", MPV_FORMAT_INT64, &vo_dropped);
+
+    int64_t decoder_dropped = 0;
+    libmpv.mpv_get_property(mpv, "decoder-frame-drop-count", MPV_FORMAT_INT64, &decoder_dropped);
+
+    metrics_gauge_set(get_metrics().dropped_frames, decoder_dropped + vo_dropped);
+    return decoder_dropped + vo_dropped;
+}
+
+void Mpv::report_swap() {
+    if(!created)
+        return;
+    libmpv.mpv_render_context_report_swap(mpv_gl);
+}
+
+void Mpv::set_property(const char *name, const char *value) {
+    if(!created)
+        return;
+    libmpv.mpv_set_property_async(mpv, 0, name, MPV_FORMAT_STRING, &value);
 }
 
 void Mpv::draw(unsigned int framebuffer_id, int width, int height) {
@@ -265,14 +748,18 @@ void Mpv::draw(unsigned int framebuffer_id, int width, int height) {
 
     int flip_y = 0;
     int shit = 1;
+    // The frame is scheduled against the headset vsync by the caller (see |next_frame_due|),
+    // so mpv shouldn't wait for the frame's target time itself
+    int block_for_target_time = 0;
 
     mpv_render_param params[] = {
         { MPV_RENDER_PARAM_OPENGL_FBO, &fbo },
         { MPV_RENDER_PARAM_FLIP_Y, &flip_y },
+        { MPV_RENDER_PARAM_BLOCK_FOR_TARGET_TIME, &block_for_target_time },
         //{ MPV_RENDER_PARAM_SKIP_RENDERING, &shit },
         { MPV_RENDER_PARAM_INVALID, 0 }
     };
 
-    int res = mpv_render_context_render(mpv_gl, params);
+    int res = libmpv.mpv_render_context_render(mpv_gl, params);
     //fprintf(stderr, "draw mpv: %d\n", res);
 }
@@ -0,0 +1,141 @@
+#include "../include/mpv_quality.hpp"
+#include "../include/mpv.hpp"
+#include <stdio.h>
+
+struct MpvQualityOption {
+    const char *name;
+    const char *value;
+};
+
+struct MpvQualityTier {
+    const char *name;
+    MpvQualityOption options[7];
+};
+
+// Every tier sets the same options so that any tier can be applied after any other tier
+static const MpvQualityTier quality_tiers[] = {
+    { "low", {
+        { "scale", "bilinear" },
+        { "cscale", "bilinear" },
+        { "dscale", "bilinear" },
+        { "deband", "no" },
+        { "sigmoid-upscaling", "no" },
+        { "correct-downscaling", "no" },
+        { "linear-downscaling", "no" }
+    }},
+    { "medium", {
+        { "scale", "spline36" },
+        { "cscale", "bilinear" },
+        { "dscale", "mitchell" },
+        { "deband", "no" },
+        { "sigmoid-upscaling", "no" },
+        { "correct-downscaling", "yes" },
+        { "linear-downscaling", "no" }
+    }},
+    // Same as profile=gpu-hq
+    { "high", {
+        { "scale", "spline36" },
+        { "cscale", "spline36" },
+        { "dscale", "mitchell" },
+        { "deband", "yes" },
+        { "sigmoid-upscaling", "yes" },
+        { "correct-downscaling", "yes" },
+        { "linear-downscaling", "yes" }
+    }}
+};
+
+static const int num_quality_tiers = sizeof(quality_tiers) / sizeof(quality_tiers[0]);
+static_assert(num_quality_tiers <= 8, "MpvQualityGovernor::tier_cost_ms is too small");
+
+static const int window_size = 30;
+// Fraction of the frame budget
+static const double overloaded_threshold = 0.8;
+static const double underloaded_threshold = 0.45;
+static const int bad_windows_to_step_down = 2;
+static const int good_windows_to_step_up = 10;
+
+// mpv is created with profile=gpu-hq, which is the highest tier
+MpvQualityGovernor::MpvQualityGovernor() : tier(num_quality_tiers - 1) {}
+
+bool MpvQualityGovernor::add_sample(double gpu_time_ms) {
+    window_gpu_time_sum_ms += gpu_time_ms;
+    ++window_num_samples;
+    return window_num_samples >= window_size;
+}
+
+bool MpvQualityGovernor::update(Mpv &mpv, int64_t dropped_frames, double frame_budget_ms) {
+    if(window_num_samples == 0)
+        return false;
+
+    const double average_gpu_time_ms = window_gpu_time_sum_ms / window_num_samples;
+    const int64_t window_dropped_frames = window_dropped_frames_start == -1 ? 0 : dropped_frames - window_dropped_frames_start;
+    window_gpu_time_sum_ms = 0.0;
+    window_num_samples = 0;
+    window_dropped_frames_start = dropped_frames;
+
+    if(frame_budget_ms <= 0.0)
+        return false;
+
+    if(average_gpu_time_ms > frame_budget_ms * overloaded_threshold || window_dropped_frames > 0) {
+        num_good_windows = 0;
+        ++num_bad_windows;
+        if(num_bad_windows >= bad_windows_to_step_down && tier > 0) {
+            tier_cost_ms[tier] = average_gpu_time_ms;
+            fprintf(stderr, "mpv quality: %.2f ms gpu time per frame with a budget of %.2f ms and %lld dropped frames, ", average_gpu_time_ms, frame_budget_ms, (long long)window_dropped_frames);
+            set_tier(mpv, tier - 1);
+            return true;
+        }
+    } else if(average_gpu_time_ms < frame_budget_ms * underloaded_threshold) {
+        num_bad_windows = 0;
+        ++num_good_windows;
+        // Don't go back to a tier that was too expensive, unless it was because of something temporary
+        // (such as a seek). Requiring twice as many good windows makes sure it's not retried too often
+        const int next_tier = tier + 1;
+        const bool next_tier_too_expensive = next_tier < num_quality_tiers && tier_cost_ms[next_tier] > frame_budget_ms * overloaded_threshold;
+        const int good_windows_needed = next_tier_too_expensive ? good_windows_to_step_up * 2 : good_windows_to_step_up;
+        if(num_good_windows >= good_windows_needed && next_tier < num_quality_tiers) {
+            fprintf(stderr, "mpv quality: %.2f ms gpu time per frame with a budget of %.2f ms, ", average_gpu_time_ms, frame_budget_ms);
+            set_tier(mpv, next_tier);
+            return true;
+        }
+    } else {
+        // In between the thresholds, keep the current tier
+        num_bad_windows = 0;
+        num_good_windows = 0;
+    }
+
+    return false;
+}
+
+void MpvQualityGovernor::reset() {
+    window_gpu_time_sum_ms = 0.0;
+    window_num_samples = 0;
+    window_dropped_frames_start = -1;
+    num_bad_windows = 0;
+    num_good_windows = 0;
+    for(double &cost : tier_cost_ms) {
+        cost = 0.0;
+    }
+}
+
+int MpvQualityGovernor::get_num_tiers() const {
+    return num_quality_tiers;
+}
+
+const char* MpvQualityGovernor::get_tier_name() const {
+    return quality_tiers[tier].name;
+}
+
+void MpvQualityGovernor::set_tier(Mpv &mpv, int new_tier) {
+    const char *prev_tier_name = get_tier_name();
+    tier = new_tier;
+    ++transition_count;
+    num_bad_windows = 0;
+    num_good_windows = 0;
+
+    for(const MpvQualityOption &option : quality_tiers[new_tier].options) {
+        mpv.set_property(option.name, option.value);
+    }
+
+    fprintf(stderr, "changing quality from %s to %s (%lld transitions)\n", prev_tier_name, get_tier_name(), (long long)transition_count.load());
+}
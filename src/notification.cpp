@@ -0,0 +1,165 @@
+#include "../include/notification.hpp"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+// A message is a 16-bit size followed by "title\0msg\0urgency\0". Messages are at most PIPE_BUF
+// bytes so that a write is atomic and a full pipe fails the write instead of writing part of it
+static const size_t max_message_size = PIPE_BUF;
+
+static int notification_pipe_fd = -1;
+static pid_t notification_helper_pid = -1;
+
+static bool read_all(int fd, void *data, size_t size) {
+    char *p = (char*)data;
+    while(size > 0) {
+        const ssize_t bytes_read = read(fd, p, size);
+        if(bytes_read == -1 && errno == EINTR)
+            continue;
+        if(bytes_read <= 0)
+            return false;
+        p += bytes_read;
+        size -= bytes_read;
+    }
+    return true;
+}
+
+static void notification_helper_run_notify_send(const char *title, const char *msg, const char *urgency) {
+    const char *args[] = { "notify-send", "-a", "vr-video-player", "-t", "10000", "-u", urgency, "--", title, msg, NULL };
+
+    // The signals the main process reads from a signalfd are blocked, and the mask is inherited through exec
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t signal_mask;
+    sigemptyset(&signal_mask);
+    posix_spawnattr_setsigmask(&attr, &signal_mask);
+    sigset_t default_signals;
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGINT);
+    posix_spawnattr_setsigdefault(&attr, &default_signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid = -1;
+    const int result = posix_spawnp(&pid, args[0], nullptr, &attr, (char* const*)args, environ);
+    posix_spawnattr_destroy(&attr);
+    if(result != 0) {
+        fprintf(stderr, "Error: failed to run notify-send: %s\n", strerror(result));
+        return;
+    }
+    waitpid(pid, nullptr, 0);
+}
+
+static void notification_helper_main(int read_fd) {
+    // Ctrl+C in the terminal is sent to the whole process group. The helper exits when the main process closes the pipe instead
+    signal(SIGINT, SIG_IGN);
+    sigset_t signal_mask;
+    sigemptyset(&signal_mask);
+    sigprocmask(SIG_SETMASK, &signal_mask, nullptr);
+
+    char message[max_message_size];
+    while(true) {
+        uint16_t size = 0;
+        if(!read_all(read_fd, &size, sizeof(size)) || size > sizeof(message) - sizeof(size) || !read_all(read_fd, message, size))
+            break;
+
+        // title, msg and urgency, all null terminated
+        const char *fields[3];
+        size_t offset = 0;
+        int num_fields = 0;
+        while(num_fields < 3 && offset < size) {
+            fields[num_fields++] = message + offset;
+            const char *end = (const char*)memchr(message + offset, '\0', size - offset);
+            if(!end)
+                break;
+            offset = end - message + 1;
+        }
+
+        if(num_fields == 3 && offset == size)
+            notification_helper_run_notify_send(fields[0], fields[1], fields[2]);
+    }
+    _exit(0);
+}
+
+bool notification_helper_start() {
+    if(notification_helper_pid != -1)
+        return true;
+
+    int fds[2];
+    if(pipe2(fds, O_CLOEXEC) == -1) {
+        fprintf(stderr, "Error: failed to create notification pipe: %s\n", strerror(errno));
+        return false;
+    }
+
+    const pid_t pid = fork();
+    if(pid == -1) {
+        fprintf(stderr, "Error: failed to start notification helper: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    } else if(pid == 0) { /* child */
+        close(fds[1]);
+        notification_helper_main(fds[0]);
+    }
+
+    close(fds[0]);
+    // A helper that died should make writes fail with EPIPE instead of killing the process
+    signal(SIGPIPE, SIG_IGN);
+    // The render thread should never wait for the helper
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+    notification_pipe_fd = fds[1];
+    notification_helper_pid = pid;
+    return true;
+}
+
+void notification_helper_stop() {
+    if(notification_pipe_fd != -1) {
+        close(notification_pipe_fd);
+        notification_pipe_fd = -1;
+    }
+
+    if(notification_helper_pid != -1) {
+        waitpid(notification_helper_pid, nullptr, 0);
+        notification_helper_pid = -1;
+    }
+}
+
+void show_notification(const char *title, const char *msg, const char *urgency) {
+    if(notification_pipe_fd == -1)
+        return;
+
+    char message[max_message_size];
+    const size_t title_size = strlen(title) + 1;
+    const size_t urgency_size = strlen(urgency) + 1;
+    if(title_size + urgency_size + 1 + sizeof(uint16_t) > sizeof(message))
+        return;
+    const size_t max_msg_size = sizeof(message) - sizeof(uint16_t) - title_size - urgency_size - 1;
+
+    // Long messages are truncated to fit in a single atomic write
+    size_t msg_size = strlen(msg);
+    if(msg_size > max_msg_size)
+        msg_size = max_msg_size;
+
+    const uint16_t size = title_size + msg_size + 1 + urgency_size;
+    char *p = message;
+    memcpy(p, &size, sizeof(size));
+    p += sizeof(size);
+    memcpy(p, title, title_size);
+    p += title_size;
+    memcpy(p, msg, msg_size);
+    p += msg_size;
+    *p++ = '\0';
+    memcpy(p, urgency, urgency_size);
+    p += urgency_size;
+
+    if(write(notification_pipe_fd, message, p - message) == -1 && errno == EAGAIN)
+        fprintf(stderr, "Warning: notification helper is busy, dropped notification: %s\n", title);
+}
@@ -0,0 +1,68 @@
+#include "../include/pose_sampler.hpp"
+#include <time.h>
+
+// Samples per headset frame. The prediction is at most this fraction of a frame old when it's used
+static const int samples_per_frame = 4;
+
+static int64_t get_monotonic_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
+}
+
+PoseSampler::~PoseSampler() {
+    stop();
+}
+
+bool PoseSampler::start(vr::IVRSystem *vr_system, vr::ETrackingUniverseOrigin tracking_origin) {
+    if(running || !vr_system)
+        return false;
+
+    this->vr_system = vr_system;
+    this->tracking_origin = tracking_origin;
+    // These don't change while the headset is connected, so they're read once instead of every sample
+    const float display_frequency = vr_system->GetFloatTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_DisplayFrequency_Float);
+    frame_duration_seconds = 1.0f / (display_frequency > 0.0f ? display_frequency : 90.0f);
+    vsync_to_photons_seconds = vr_system->GetFloatTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd, vr::Prop_SecondsFromVsyncToPhotons_Float);
+
+    running = true;
+    thread = std::thread([this]{ run(); });
+    return true;
+}
+
+void PoseSampler::stop() {
+    running = false;
+    if(thread.joinable())
+        thread.join();
+}
+
+void PoseSampler::run() {
+    const int64_t sample_interval_ns = (int64_t)(frame_duration_seconds * 1000000000.0) / samples_per_frame;
+    struct timespec next_sample_time;
+    clock_gettime(CLOCK_MONOTONIC, &next_sample_time);
+
+    PoseSample sample;
+    while(running) {
+        // The next frame is shown at the next vsync. Without vsync timing it's predicted a frame ahead
+        float seconds_since_last_vsync = 0.0f;
+        uint64_t frame_counter = 0;
+        float seconds_until_vsync = frame_duration_seconds;
+        if(vr_system->GetTimeSinceLastVsync(&seconds_since_last_vsync, &frame_counter)) {
+            seconds_until_vsync = frame_duration_seconds - seconds_since_last_vsync;
+            if(seconds_until_vsync < 0.0f)
+                seconds_until_vsync = 0.0f;
+        }
+
+        sample.predicted_seconds = seconds_until_vsync + vsync_to_photons_seconds;
+        sample.sample_time_us = get_monotonic_time_us();
+        vr_system->GetDeviceToAbsoluteTrackingPose(tracking_origin, sample.predicted_seconds, sample.poses, vr::k_unMaxTrackedDeviceCount);
+        latest_sample.store(sample);
+
+        next_sample_time.tv_nsec += sample_interval_ns;
+        while(next_sample_time.tv_nsec >= 1000000000L) {
+            next_sample_time.tv_nsec -= 1000000000L;
+            ++next_sample_time.tv_sec;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_sample_time, nullptr);
+    }
+}
@@ -0,0 +1,135 @@
+#include "../include/program_cache.hpp"
+#include "../include/config.hpp"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static const char cache_magic[8] = { 'V', 'R', 'V', 'P', 'P', 'B', '0', '1' };
+
+struct ProgramCacheHeader {
+    char magic[8];
+    uint64_t key;
+    uint32_t binary_format;
+    uint32_t binary_size;
+};
+
+static uint64_t fnv1a_hash(uint64_t hash, const char *str) {
+    if(!str)
+        str = "";
+    // Include the null terminator so that "ab"+"c" and "a"+"bc" hash differently
+    const unsigned char *p = (const unsigned char*)str;
+    do {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    } while(*p++);
+    return hash;
+}
+
+static uint64_t program_cache_key(const char *vertex_source, const char *fragment_source) {
+    uint64_t hash = 14695981039346656037ULL;
+    hash = fnv1a_hash(hash, vertex_source);
+    hash = fnv1a_hash(hash, fragment_source);
+    hash = fnv1a_hash(hash, (const char*)glGetString(GL_VENDOR));
+    hash = fnv1a_hash(hash, (const char*)glGetString(GL_RENDERER));
+    hash = fnv1a_hash(hash, (const char*)glGetString(GL_VERSION));
+    return hash;
+}
+
+static std::string program_cache_get_path(const char *name) {
+    return get_config_dir() + "/shader-cache/" + name + ".bin";
+}
+
+bool program_cache_supported() {
+    if(!GLEW_ARB_get_program_binary)
+        return false;
+
+    GLint num_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    return num_formats > 0;
+}
+
+GLuint program_cache_load(const char *name, const char *vertex_source, const char *fragment_source) {
+    if(!program_cache_supported())
+        return 0;
+
+    const std::string path = program_cache_get_path(name);
+    std::string file_content;
+    if(!file_get_content(path.c_str(), file_content))
+        return 0;
+
+    ProgramCacheHeader header;
+    if(file_content.size() < sizeof(header))
+        return 0;
+
+    memcpy(&header, file_content.data(), sizeof(header));
+    if(memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.key != program_cache_key(vertex_source, fragment_source)
+        || (size_t)header.binary_size != file_content.size() - sizeof(header))
+    {
+        fprintf(stderr, "Shader cache for %s is outdated, recompiling\n", name);
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.binary_format, file_content.data() + sizeof(header), header.binary_size);
+
+    GLint link_status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+    if(link_status != GL_TRUE) {
+        fprintf(stderr, "Shader cache for %s was rejected by the driver, recompiling\n", name);
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+void program_cache_save(const char *name, GLuint program, const char *vertex_source, const char *fragment_source) {
+    if(!program_cache_supported())
+        return;
+
+    GLint binary_size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binary_size);
+    if(binary_size <= 0)
+        return;
+
+    std::vector<char> binary(binary_size);
+    GLenum binary_format = 0;
+    GLsizei binary_length = 0;
+    glGetProgramBinary(program, binary_size, &binary_length, &binary_format, binary.data());
+    if(binary_length <= 0)
+        return;
+
+    ProgramCacheHeader header;
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.key = program_cache_key(vertex_source, fragment_source);
+    header.binary_format = binary_format;
+    header.binary_size = binary_length;
+
+    const std::string path = program_cache_get_path(name);
+    char dir_tmp[PATH_MAX];
+    snprintf(dir_tmp, sizeof(dir_tmp), "%s", path.c_str());
+    char *dir = dirname(dir_tmp);
+    if(create_directory_recursive(dir) != 0) {
+        fprintf(stderr, "Warning: Failed to create shader cache directory: %s\n", dir);
+        return;
+    }
+
+    // Write to a temporary file and rename it so that a crash never leaves a truncated cache entry
+    const std::string tmp_path = path + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if(!file) {
+        fprintf(stderr, "Warning: Failed to create shader cache file: %s\n", tmp_path.c_str());
+        return;
+    }
+
+    bool success = fwrite(&header, 1, sizeof(header), file) == sizeof(header)
+        && fwrite(binary.data(), 1, binary_length, file) == (size_t)binary_length;
+    success = fclose(file) == 0 && success;
+
+    if(!success || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        fprintf(stderr, "Warning: Failed to write shader cache file: %s\n", path.c_str());
+        remove(tmp_path.c_str());
+    }
+}
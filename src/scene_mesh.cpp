@@ -0,0 +1,234 @@
+#include "../include/scene_mesh.hpp"
+#include <math.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/constants.hpp>
+
+static void add_vertex(float x, float y, float z, float u, float v, std::vector<float> &vertdata) {
+    vertdata.push_back(x);
+    vertdata.push_back(y);
+    vertdata.push_back(z);
+    vertdata.push_back(u);
+    vertdata.push_back(v);
+}
+
+void scene_mesh_add_sphere(std::vector<float> &vertdata, const glm::mat4 &mat, double width_ratio, double zoom) {
+    long columns = 32;
+    long rows = 32;
+    double angle_x = 3.14;
+    double radius_height = 1.0;
+    double radius = radius_height * width_ratio * 0.5;
+
+    for(long row = 0; row < rows; ++row) {
+        for(long column = 0; column < columns; ++column) {
+            double offset_angle = 0.0;//angle_x*0.5;
+
+            double y_sin1 = sin((double)row / (double)rows * 3.14);
+            double y_sin2 = sin((double)(row + 1) / (double)rows * 3.14);
+
+            double z1 = sin(offset_angle + (double)column / (double)columns * angle_x) * radius;
+            double z2 = sin(offset_angle + (double)(column + 1) / (double)columns * angle_x) * radius;
+            double z3 = z1;
+
+            double z4 = z3;
+            double z5 = z2;
+            double z6 = z2;
+
+            z1 *= y_sin1;
+            z2 *= y_sin1;
+            z3 *= y_sin2;
+            z4 *= y_sin2;
+            z5 *= y_sin2;
+            z6 *= y_sin1;
+
+            double x1 = -cos(offset_angle + (double)column / (double)columns * angle_x) * radius;
+            double x2 = -cos(offset_angle + (double)(column + 1) / (double)columns * angle_x) * radius;
+            double x3 = x1;
+
+            double x4 = x3;
+            double x5 = x2;
+            double x6 = x2;
+
+            x1 *= y_sin1;
+            x2 *= y_sin1;
+            x3 *= y_sin2;
+            x4 *= y_sin2;
+            x5 *= y_sin2;
+            x6 *= y_sin1;
+
+            double y1 = cos((double)row / (double)rows * 3.14) * radius_height;
+            double y2 = y1;
+            double y3 = cos((double)(row + 1) / (double)rows * 3.14) * radius_height;
+
+            double y4 = y3;
+            double y5 = y3;
+            double y6 = y1;
+
+            glm::vec4 v1 = mat * glm::vec4(x1, y1, z1 + zoom, 1.0);
+            glm::vec4 v2 = mat * glm::vec4(x2, y2, z2 + zoom, 1.0);
+            glm::vec4 v3 = mat * glm::vec4(x3, y3, z3 + zoom, 1.0);
+            glm::vec4 v4 = mat * glm::vec4(x4, y4, z4 + zoom, 1.0);
+            glm::vec4 v5 = mat * glm::vec4(x5, y5, z5 + zoom, 1.0);
+            glm::vec4 v6 = mat * glm::vec4(x6, y6, z6 + zoom, 1.0);
+
+            add_vertex(v1.x, v1.y, v1.z, 1.0 - (double)column / (double)columns,         (double)row / (double)rows, vertdata);
+            add_vertex(v2.x, v2.y, v2.z, 1.0 - (double)(column + 1) / (double)columns,   (double)row / (double)rows, vertdata);
+            add_vertex(v3.x, v3.y, v3.z, 1.0 - (double)column / (double)columns,         (double)(row + 1) / (double)rows, vertdata);
+
+            add_vertex(v4.x, v4.y, v4.z, 1.0 - (double)column / (double)columns,         (double)(row + 1) / (double)rows, vertdata);
+            add_vertex(v5.x, v5.y, v5.z, 1.0 - (double)(column + 1) / (double)columns,   (double)(row + 1) / (double)rows, vertdata);
+            add_vertex(v6.x, v6.y, v6.z, 1.0 - (double)(column + 1) / (double)columns,   (double)row / (double)rows, vertdata);
+        }
+    }
+}
+
+void scene_mesh_add_cylinder(std::vector<float> &vertdata, double width_ratio, double zoom) {
+    long columns = 64;
+    double angle_start = -0.8;
+    double angle_end = 0.8;
+    double height = 1.5;
+    double angle_len = angle_end - angle_start;
+
+    double width_start = sin(angle_start);
+    double width_end = sin(angle_start + angle_len);
+    double target_radius = height * width_ratio;
+    double radius = 2.0 * (target_radius / (width_end - width_start));
+
+    for(long column = 0; column < columns; ++column) {
+        double t1 = ((double)column / (double)columns);
+        double t2 = (((double)column + 1) / (double)columns);
+
+        double x1 = sin(angle_start + t1 * angle_len) * radius;
+        double y1 = cos(angle_start + t1 * angle_len) * radius * 0.6;
+        double x2 = sin(angle_start + t2 * angle_len) * radius;
+        double y2 = cos(angle_start + t2 * angle_len) * radius * 0.6;
+
+        //     2     n
+        // 1  /|   / |    m
+        // | / | /   |  / |
+        // |/  2     n/   |
+        // 1              m
+
+        add_vertex(x1, height, zoom + y1, 1 - t1, 0, vertdata);
+        add_vertex(x2, height, zoom + y2, 1 - t2, 0, vertdata);
+        add_vertex(x1, -height, zoom + y1, 1 - t1, 1, vertdata);
+
+        add_vertex(x1, -height, zoom + y1, 1 - t1, 1, vertdata);
+        add_vertex(x2, height, zoom + y2, 1 - t2, 0, vertdata);
+        add_vertex(x2, -height, zoom + y2, 1 - t2, 1, vertdata);
+    }
+}
+
+void scene_mesh_add_flat(std::vector<float> &vertdata, double width_ratio, double zoom, bool stretch) {
+    double height = 0.5;
+    double width = height * (stretch ? 1.0 : 0.5) * width_ratio;
+    add_vertex(-width,  height, zoom, 1.0, 0.0, vertdata);
+    add_vertex(width,   height, zoom, 0.0, 0.0, vertdata);
+    add_vertex(-width, -height, zoom, 1.0, 1.0, vertdata);
+
+    add_vertex(-width, -height, zoom, 1.0, 1.0, vertdata);
+    add_vertex(width,  -height, zoom, 0.0, 1.0, vertdata);
+    add_vertex(width,   height, zoom, 0.0, 0.0, vertdata);
+}
+
+void scene_mesh_add_sphere360(std::vector<float> &vertdata, double texture_border_x, double texture_border_y, double texture_zoom) {
+    const double px = texture_border_x;
+    const double py = texture_border_y;
+    const double hz = texture_zoom;
+
+    double width = 1.0 - px * 2.0;
+    double height = 1.0 - py * 2.0;
+
+    double texture_width = width / 3.0;
+    double texture_height = height * 0.5;
+
+    for(int i = 0; i < 3; ++i) {
+        size_t plane_vertices_start = vertdata.size();
+        create_segmented_plane(vertdata, 1.0f, 1.0f, 1.0f, texture_width, texture_height - hz, texture_width * (2 - i) + px, py + hz, 32, 32);
+        size_t plane_vertices_end = vertdata.size();
+        size_t num_vertex_data = (plane_vertices_end - plane_vertices_start) / 5;
+
+        plane_normalize_depth(&vertdata[plane_vertices_start], num_vertex_data, 1.0f);
+        vertices_rotate(&vertdata[plane_vertices_start], num_vertex_data, -glm::half_pi<float>() + i * glm::half_pi<float>(), glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+
+    for(int i = 0; i < 3; ++i) {
+        size_t plane_vertices_start = vertdata.size();
+        create_segmented_plane(vertdata, 1.0f, 1.0f, 1.0f, texture_width, texture_height - hz, px + texture_width * i, 0.5f, 32, 32);
+        size_t plane_vertices_end = vertdata.size();
+        size_t num_vertex_data = (plane_vertices_end - plane_vertices_start) / 5;
+
+        plane_normalize_depth(&vertdata[plane_vertices_start], num_vertex_data, 1.0f);
+        vertices_rotate(&vertdata[plane_vertices_start], num_vertex_data, -glm::half_pi<float>(), glm::vec3(0.0f, 0.0f, 1.0f));
+        vertices_rotate(&vertdata[plane_vertices_start], num_vertex_data, -glm::half_pi<float>() - i * glm::half_pi<float>(), glm::vec3(1.0f, 0.0f, 0.0f));
+    }
+}
+
+void create_segmented_plane(std::vector<float> &vertdata, float width, float height, float depth, float texture_width, float texture_height, float texture_offset_x, float texture_offset_y, int num_columns, int num_rows) {
+    float segment_width = width / (float)num_columns;
+    float segment_height = height / (float)num_rows;
+    float segment_texture_width = texture_width / (float)num_columns;
+    float segment_texture_height = texture_height / (float)num_rows;
+
+    for(int y = 0; y < num_rows; ++y) {
+        float segment_height_offset = height - segment_height * 2.0f * (float)y;
+        float segment_texture_height_offset = segment_texture_height * (float)y;
+        for(int x = 0; x < num_columns; ++x) {
+            float segment_width_offset = width - segment_width * 2.0f * (float)x;
+            float segment_texture_width_offset = segment_texture_width * (float)x;
+
+            add_vertex(segment_width_offset, segment_height_offset, depth, segment_texture_width_offset + texture_offset_x, segment_texture_height_offset + texture_offset_y, vertdata);
+            add_vertex(segment_width_offset - segment_width*2.0f, segment_height_offset, depth, segment_texture_width_offset + texture_offset_x + segment_texture_width, segment_texture_height_offset + texture_offset_y, vertdata);
+            add_vertex(segment_width_offset - segment_width*2.0f, segment_height_offset - segment_height*2.0f, depth, segment_texture_width_offset + texture_offset_x + segment_texture_width, segment_texture_height_offset + texture_offset_y + segment_texture_height, vertdata);
+
+            add_vertex(segment_width_offset - segment_width*2.0f, segment_height_offset - segment_height*2.0f, depth, segment_texture_width_offset + texture_offset_x + segment_texture_width, segment_texture_height_offset + texture_offset_y + segment_texture_height, vertdata);
+            add_vertex(segment_width_offset, segment_height_offset - segment_height*2.0f, depth, segment_texture_width_offset + texture_offset_x, segment_texture_height_offset + texture_offset_y + segment_texture_height, vertdata);
+            add_vertex(segment_width_offset, segment_height_offset, depth, segment_texture_width_offset + texture_offset_x, segment_texture_height_offset + texture_offset_y, vertdata);
+        }
+    }
+}
+
+static glm::vec3 vertex_get_center(glm::mat3 vertex) {
+    return glm::vec3(
+        (vertex[0].x + vertex[1].x + vertex[2].x) / 3.0f,
+        (vertex[0].y + vertex[1].y + vertex[2].y) / 3.0f,
+        (vertex[0].z + vertex[1].z + vertex[2].z) / 3.0f
+    );
+}
+
+void plane_normalize_depth(float *vertices, size_t num_vertices, float depth) {
+    for(size_t i = 0; i < num_vertices; ++i) {
+        float *vertex_data = &vertices[i * 5];
+        float dist = sqrtf(vertex_data[0]*vertex_data[0] + vertex_data[1]*vertex_data[1] + vertex_data[2]*vertex_data[2]);
+        vertex_data[0] = vertex_data[0]/dist * depth;
+        vertex_data[1] = vertex_data[1]/dist * depth;
+        vertex_data[2] = vertex_data[2]/dist * depth;
+    }
+}
+
+void vertices_rotate(float *vertices, size_t num_vertices, float angle, glm::vec3 rotation_axis) {
+    for(size_t i = 0; i < num_vertices - 2; i += 3) {
+        float *vertex_data1 = &vertices[(i + 0) * 5];
+        float *vertex_data2 = &vertices[(i + 1) * 5];
+        float *vertex_data3 = &vertices[(i + 2) * 5];
+        glm::quat quatRot = glm::angleAxis(angle, rotation_axis);
+        glm::mat4x4 matRot = glm::mat4_cast(quatRot);
+        glm::vec3 &vec1 = *(glm::vec3*)vertex_data1;
+        glm::vec3 &vec2 = *(glm::vec3*)vertex_data2;
+        glm::vec3 &vec3 = *(glm::vec3*)vertex_data3;
+        glm::vec3 center = vertex_get_center(glm::mat3(vec1, vec2, vec3));
+
+        vec1 -= center;
+        vec2 -= center;
+        vec3 -= center;
+
+        glm::mat4 tran = glm::translate(matRot, center);
+
+        glm::vec4 out1 = tran * glm::vec4(vec1.x, vec1.y, vec1.z, 1.0f);
+        glm::vec4 out2 = tran * glm::vec4(vec2.x, vec2.y, vec2.z, 1.0f);
+        glm::vec4 out3 = tran * glm::vec4(vec3.x, vec3.y, vec3.z, 1.0f);
+        vec1 = glm::vec3(out1.x, out1.y, out1.z);
+        vec2 = glm::vec3(out2.x, out2.y, out2.z);
+        vec3 = glm::vec3(out3.x, out3.y, out3.z);
+    }
+}
@@ -0,0 +1,213 @@
+#include "../include/session_trace.hpp"
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char trace_magic[8] = { 'V', 'R', 'V', 'P', 'T', 'R', 'C', 'E' };
+static const uint32_t trace_version = 1;
+static const uint64_t padding_zeros = 0;
+
+static int64_t get_monotonic_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
+}
+
+static size_t align_record_size(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+SessionTraceWriter::~SessionTraceWriter() {
+    close();
+}
+
+bool SessionTraceWriter::open(const char *filepath, uint64_t src_window_id, uint32_t x_event_size, const SessionTraceHmdInfo &hmd_info) {
+    if(file)
+        return false;
+
+    file = fopen(filepath, "wb");
+    if(!file) {
+        fprintf(stderr, "Error: failed to open %s for recording: %s\n", filepath, strerror(errno));
+        return false;
+    }
+    // The records of a frame are small, they shouldn't cause a write syscall each
+    setvbuf(file, nullptr, _IOFBF, 1024 * 1024);
+
+    this->filepath = filepath;
+    start_time_us = get_monotonic_time_us();
+    frame_index = 0;
+    write_failed = false;
+
+    SessionTraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, trace_magic, sizeof(trace_magic));
+    header.version = trace_version;
+    header.x_event_size = x_event_size;
+    header.src_window_id = src_window_id;
+    header.start_time_us = start_time_us;
+    header.hmd_info = hmd_info;
+    if(fwrite(&header, 1, sizeof(header), file) != sizeof(header))
+        write_failed = true;
+    return true;
+}
+
+bool SessionTraceWriter::close() {
+    if(!file)
+        return true;
+
+    if(fclose(file) != 0)
+        write_failed = true;
+    file = nullptr;
+
+    if(write_failed)
+        fprintf(stderr, "Error: failed to write the trace to %s, it's incomplete\n", filepath.c_str());
+    return !write_failed;
+}
+
+void SessionTraceWriter::end_frame(uint32_t flags) {
+    SessionTraceFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.frame_index = frame_index++;
+    frame.flags = flags;
+    write(SessionTraceRecordType::FRAME, &frame, sizeof(frame));
+}
+
+void SessionTraceWriter::write(SessionTraceRecordType type, const void *data, size_t size, const void *extra_data, size_t extra_size) {
+    if(!file || write_failed)
+        return;
+
+    SessionTraceRecordHeader record_header;
+    record_header.type = type;
+    record_header.size = size + extra_size;
+    record_header.time_us = get_monotonic_time_us() - start_time_us;
+
+    const size_t padding = align_record_size(record_header.size) - record_header.size;
+    if(fwrite(&record_header, 1, sizeof(record_header), file) != sizeof(record_header)
+        || fwrite(data, 1, size, file) != size
+        || (extra_size > 0 && fwrite(extra_data, 1, extra_size, file) != extra_size)
+        || fwrite(&padding_zeros, 1, padding, file) != padding)
+    {
+        write_failed = true;
+    }
+}
+
+SessionTraceReader::~SessionTraceReader() {
+    close();
+}
+
+bool SessionTraceReader::open(const char *filepath, uint32_t x_event_size) {
+    if(data)
+        return false;
+
+    const int fd = ::open(filepath, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        fprintf(stderr, "Error: failed to open trace %s: %s\n", filepath, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(SessionTraceHeader)) {
+        fprintf(stderr, "Error: %s is not a vr-video-player trace\n", filepath);
+        ::close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(mapping == MAP_FAILED) {
+        fprintf(stderr, "Error: failed to map trace %s: %s\n", filepath, strerror(errno));
+        return false;
+    }
+    // Replay reads the trace from start to end
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+
+    data = (const uint8_t*)mapping;
+    data_size = st.st_size;
+    header = (const SessionTraceHeader*)data;
+    if(memcmp(header->magic, trace_magic, sizeof(trace_magic)) != 0 || header->version != trace_version) {
+        fprintf(stderr, "Error: %s is not a vr-video-player trace or was recorded by a different version\n", filepath);
+        close();
+        return false;
+    }
+
+    if(header->x_event_size != x_event_size) {
+        fprintf(stderr, "Error: %s was recorded on a different type of machine\n", filepath);
+        close();
+        return false;
+    }
+
+    // A recording that was interrupted (the player crashed) ends with a partial record, which is ignored
+    num_frames = 0;
+    size_t offset = sizeof(SessionTraceHeader);
+    while(offset + sizeof(SessionTraceRecordHeader) <= data_size) {
+        const SessionTraceRecordHeader *record_header = (const SessionTraceRecordHeader*)(data + offset);
+        const size_t record_size = sizeof(SessionTraceRecordHeader) + align_record_size(record_header->size);
+        if(offset + record_size > data_size)
+            break;
+        if(record_header->type == SessionTraceRecordType::FRAME)
+            ++num_frames;
+        offset += record_size;
+    }
+    records_end = offset;
+
+    next_offset = sizeof(SessionTraceHeader);
+    frame_records.clear();
+    return true;
+}
+
+void SessionTraceReader::close() {
+    if(!data)
+        return;
+
+    munmap((void*)data, data_size);
+    data = nullptr;
+    data_size = 0;
+    records_end = 0;
+    header = nullptr;
+    next_offset = 0;
+    num_frames = 0;
+    frame_records.clear();
+}
+
+bool SessionTraceReader::next_frame(SessionTraceFrame &frame, int64_t &time_us) {
+    frame_records.clear();
+
+    // The records of a frame that wasn't finished when the recording stopped are ignored
+    while(next_offset < records_end) {
+        const SessionTraceRecordHeader *record_header = (const SessionTraceRecordHeader*)(data + next_offset);
+        next_offset += sizeof(SessionTraceRecordHeader) + align_record_size(record_header->size);
+        if(record_header->type != SessionTraceRecordType::FRAME) {
+            frame_records.push_back(record_header);
+            continue;
+        }
+
+        if(record_header->size != sizeof(SessionTraceFrame)) {
+            frame_records.clear();
+            continue;
+        }
+
+        memcpy(&frame, record_header + 1, sizeof(frame));
+        time_us = record_header->time_us;
+        return true;
+    }
+
+    frame_records.clear();
+    return false;
+}
+
+const void* SessionTraceReader::take(SessionTraceRecordType type, size_t &size) {
+    for(const SessionTraceRecordHeader *&record_header : frame_records) {
+        if(record_header && record_header->type == type) {
+            const void *record_data = record_header + 1;
+            size = record_header->size;
+            record_header = nullptr;
+            return record_data;
+        }
+    }
+    size = 0;
+    return nullptr;
+}
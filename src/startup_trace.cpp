@@ -0,0 +1,117 @@
+#include "../include/startup_trace.hpp"
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <mutex>
+#include <vector>
+
+struct StartupTraceEvent {
+    const char *name;
+    int64_t start_us;
+    int64_t duration_us; // -1 for instant events
+    long thread_id;
+};
+
+struct StartupTraceThread {
+    long thread_id;
+    const char *name;
+};
+
+static int64_t trace_epoch_us = 0;
+static std::mutex trace_mutex;
+static std::vector<StartupTraceEvent> trace_events;
+static std::vector<StartupTraceThread> trace_threads;
+
+static int64_t get_monotonic_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000LL;
+}
+
+static long get_thread_id() {
+    return syscall(SYS_gettid);
+}
+
+// Event names are string literals, but escape them anyways in case that changes
+static void write_json_string(FILE *file, const char *str) {
+    fputc('"', file);
+    for(const char *p = str; *p; ++p) {
+        if(*p == '"' || *p == '\\')
+            fputc('\\', file);
+        if((unsigned char)*p >= 0x20)
+            fputc(*p, file);
+    }
+    fputc('"', file);
+}
+
+void startup_trace_init() {
+    trace_epoch_us = get_monotonic_time_us();
+    startup_trace_set_thread_name("main");
+}
+
+int64_t startup_trace_now_us() {
+    return get_monotonic_time_us() - trace_epoch_us;
+}
+
+double startup_trace_elapsed_ms() {
+    return startup_trace_now_us() / 1000.0;
+}
+
+void startup_trace_add(const char *name, int64_t start_us) {
+    const int64_t end_us = startup_trace_now_us();
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_events.push_back({ name, start_us, end_us - start_us, get_thread_id() });
+}
+
+void startup_trace_mark(const char *name) {
+    const int64_t now_us = startup_trace_now_us();
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_events.push_back({ name, now_us, -1, get_thread_id() });
+}
+
+void startup_trace_set_thread_name(const char *name) {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_threads.push_back({ get_thread_id(), name });
+}
+
+bool startup_trace_write(const char *filepath) {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+
+    FILE *file = fopen(filepath, "wb");
+    if(!file) {
+        perror(filepath);
+        return false;
+    }
+
+    const long pid = getpid();
+    bool first = true;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    for(const StartupTraceThread &thread : trace_threads) {
+        fprintf(file, "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":", first ? "" : ",", pid, thread.thread_id);
+        write_json_string(file, thread.name);
+        fprintf(file, "}}");
+        first = false;
+    }
+
+    for(const StartupTraceEvent &event : trace_events) {
+        fprintf(file, "%s\n{\"name\":", first ? "" : ",");
+        write_json_string(file, event.name);
+        if(event.duration_us >= 0)
+            fprintf(file, ",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld", (long long)event.start_us, (long long)event.duration_us);
+        else
+            fprintf(file, ",\"ph\":\"i\",\"s\":\"p\",\"ts\":%lld", (long long)event.start_us);
+        fprintf(file, ",\"pid\":%ld,\"tid\":%ld}", pid, event.thread_id);
+        first = false;
+    }
+
+    fprintf(file, "\n]}\n");
+
+    bool success = !ferror(file);
+    if(fclose(file) != 0)
+        success = false;
+    if(!success)
+        fprintf(stderr, "Error: failed to write startup trace to %s\n", filepath);
+    return success;
+}
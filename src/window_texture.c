@@ -1,6 +1,23 @@
 #include "../include/window_texture.h"
+#include "../include/metrics.h"
 #include <X11/extensions/Xcomposite.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static MetricsCounter *rebinds_metric = NULL;
+static MetricsCounter *rebind_failures_metric = NULL;
+static MetricsCounter *x_round_trips_metric = NULL;
+static MetricsHistogram *x_round_trip_time_metric = NULL;
+
+static void window_texture_init_metrics(void) {
+    if(rebinds_metric)
+        return;
+    rebinds_metric = metrics_counter("vrvp_capture_rebinds_total", "Times the captured window pixmap was bound to the texture again, after the window was mapped or resized");
+    rebind_failures_metric = metrics_counter("vrvp_capture_rebind_failures_total", "Failed captured window pixmap binds");
+    x_round_trips_metric = metrics_counter("vrvp_x_round_trips_total", "Blocking requests to the X server");
+    x_round_trip_time_metric = metrics_latency_histogram("vrvp_x_round_trip_seconds", "Time spent waiting for replies from the X server");
+}
 
 static int x11_supports_composite_named_window_pixmap(Display *display) {
     int extension_major;
@@ -29,6 +46,41 @@ int window_texture_init(WindowTexture *window_texture, Display *display, Window
     return window_texture_on_resize(window_texture);
 }
 
+int window_texture_init_placeholder(WindowTexture *window_texture, int width, int height) {
+    window_texture->display = NULL;
+    window_texture->window = None;
+    window_texture->pixmap = None;
+    window_texture->glx_pixmap = None;
+    window_texture->texture_id = 0;
+    window_texture->redirected = 0;
+
+    if(width <= 0 || height <= 0)
+        return 1;
+
+    unsigned char *pixels = malloc((size_t)width * height * 3);
+    if(!pixels)
+        return 1;
+    memset(pixels, 128, (size_t)width * height * 3);
+
+    glGenTextures(1, &window_texture->texture_id);
+    if(window_texture->texture_id == 0) {
+        free(pixels);
+        return 1;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, window_texture->texture_id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    free(pixels);
+    return 0;
+}
+
 static void window_texture_cleanup(WindowTexture *self, int delete_texture) {
     if(delete_texture && self->texture_id) {
         glDeleteTextures(1, &self->texture_id);
@@ -55,7 +107,18 @@ void window_texture_deinit(WindowTexture *self) {
     window_texture_cleanup(self, 1);
 }
 
+static int window_texture_bind(WindowTexture *self);
+
 int window_texture_on_resize(WindowTexture *self) {
+    window_texture_init_metrics();
+    metrics_counter_add(rebinds_metric, 1);
+    const int result = window_texture_bind(self);
+    if(result != 0)
+        metrics_counter_add(rebind_failures_metric, 1);
+    return result;
+}
+
+static int window_texture_bind(WindowTexture *self) {
     window_texture_cleanup(self, 0);
 
     int result = 0;
@@ -86,7 +149,11 @@ int window_texture_on_resize(WindowTexture *self) {
     };
 
     XWindowAttributes attr;
-    if (!XGetWindowAttributes(self->display, self->window, &attr)) {
+    const double request_start = metrics_time_seconds();
+    const Status got_attributes = XGetWindowAttributes(self->display, self->window, &attr);
+    metrics_counter_add(x_round_trips_metric, 1);
+    metrics_histogram_observe(x_round_trip_time_metric, metrics_time_seconds() - request_start);
+    if (!got_attributes) {
         fprintf(stderr, "Failed to get window attributes\n");
         return 1;
     }
@@ -174,6 +241,17 @@ int window_texture_on_resize(WindowTexture *self) {
     return result;
 }
 
+int window_texture_refresh(WindowTexture *self) {
+    if(!self->glx_pixmap)
+        return 1;
+
+    glBindTexture(GL_TEXTURE_2D, self->texture_id);
+    glXReleaseTexImageEXT(self->display, self->glx_pixmap, GLX_FRONT_EXT);
+    glXBindTexImageEXT(self->display, self->glx_pixmap, GLX_FRONT_EXT, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return 0;
+}
+
 GLuint window_texture_get_opengl_texture_id(WindowTexture *self) {
     return self->texture_id;
 }
@@ -0,0 +1,88 @@
+// Runs the notification helper with a fake notify-send on PATH that writes its arguments to a file,
+// and checks that every notification reaches it with the expected arguments. This stands in for the
+// notification bus, which isn't available where the tests run.
+#include "../include/notification.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+static bool write_file(const std::string &path, const std::string &data) {
+    std::ofstream file(path);
+    file << data;
+    return (bool)file;
+}
+
+static std::string read_file(const std::string &path) {
+    std::ifstream file(path);
+    std::stringstream data;
+    data << file.rdbuf();
+    return data.str();
+}
+
+// The lines the fake notify-send writes for one call
+static std::string expected_call(const std::string &title, const std::string &msg, const std::string &urgency) {
+    return "notify-send -a vr-video-player -t 10000 -u " + urgency + " -- " + title + "\n" + msg + "\nend\n";
+}
+
+int main() {
+    char dir_template[] = "/tmp/notification_test.XXXXXX";
+    const char *dir = mkdtemp(dir_template);
+    if(!dir) {
+        perror("Error: mkdtemp");
+        return 1;
+    }
+    const std::string log_path = std::string(dir) + "/calls";
+    const std::string script_path = std::string(dir) + "/notify-send";
+
+    // The message is on its own line, so that the truncated message below can be compared as a whole
+    const std::string script =
+        "#!/bin/sh\n"
+        "{ printf 'notify-send %s %s %s %s %s %s %s %s\\n' \"$1\" \"$2\" \"$3\" \"$4\" \"$5\" \"$6\" \"$7\" \"$8\"; printf '%s\\n' \"$9\" end; } >> \"$NOTIFY_SEND_LOG\"\n";
+    if(!write_file(script_path, script) || chmod(script_path.c_str(), 0755) != 0) {
+        fprintf(stderr, "Error: failed to create %s\n", script_path.c_str());
+        return 1;
+    }
+
+    const char *path = getenv("PATH");
+    setenv("PATH", (std::string(dir) + ":" + (path ? path : "/usr/bin:/bin")).c_str(), 1);
+    setenv("NOTIFY_SEND_LOG", log_path.c_str(), 1);
+
+    if(!notification_helper_start()) {
+        fprintf(stderr, "Error: failed to start the notification helper\n");
+        return 1;
+    }
+
+    const std::string long_msg(PIPE_BUF * 2, 'x');
+    show_notification("vr-video-player", "Failed to load video.mp4", "critical");
+    show_notification("title with spaces", "", "low");
+    show_notification("long", long_msg.c_str(), "normal");
+    notification_helper_stop();
+    // Notifications after stop are dropped
+    show_notification("dropped", "dropped", "normal");
+
+    // The message is truncated so that the whole notification is a single atomic write of at most PIPE_BUF bytes
+    const size_t truncated_msg_size = PIPE_BUF - 2 - strlen("long") - 1 - strlen("normal") - 1 - 1;
+    const std::string expected =
+        expected_call("vr-video-player", "Failed to load video.mp4", "critical") +
+        expected_call("title with spaces", "", "low") +
+        expected_call("long", long_msg.substr(0, truncated_msg_size), "normal");
+    const std::string calls = read_file(log_path);
+
+    unlink(log_path.c_str());
+    unlink(script_path.c_str());
+    rmdir(dir);
+
+    if(calls != expected) {
+        fprintf(stderr, "Error: notify-send was called with:\n%s\nexpected:\n%s\n", calls.c_str(), expected.c_str());
+        return 1;
+    }
+    printf("notification_test: 3 notifications delivered, the long message truncated to %zu bytes\n", truncated_msg_size);
+    return 0;
+}
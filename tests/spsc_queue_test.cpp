@@ -0,0 +1,72 @@
+// Passes numbered items from a producer thread to a consumer thread through a small SpscQueue, so
+// that the queue wraps around many times and is often full and empty. Build and run it with
+// ./build.sh test, which compiles it with ThreadSanitizer.
+#include "../include/spsc_queue.hpp"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+
+struct Item {
+    uint64_t sequence;
+    // Not trivially copyable, like the commands sent to the mpv thread
+    std::string payload;
+};
+
+static const uint64_t num_items = 200000;
+
+int main() {
+    SpscQueue<Item, 8> queue;
+    uint64_t producer_full_count = 0;
+    bool size_invalid = false;
+    // Set by the consumer when it gives up, so that the producer doesn't wait for space forever
+    std::atomic<bool> stop{false};
+
+    std::thread producer([&]{
+        for(uint64_t i = 0; i < num_items && !stop; ) {
+            if(queue.size_for_producer() > queue.capacity())
+                size_invalid = true;
+            if(queue.push({ i, std::to_string(i) })) {
+                ++i;
+            } else {
+                ++producer_full_count;
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    uint64_t expected = 0;
+    bool ok = true;
+    while(expected < num_items && ok) {
+        Item item;
+        if(!queue.pop(item)) {
+            std::this_thread::yield();
+            continue;
+        }
+        if(item.sequence != expected || item.payload != std::to_string(expected)) {
+            fprintf(stderr, "Error: expected item %llu, got %llu (%s)\n", (unsigned long long)expected, (unsigned long long)item.sequence, item.payload.c_str());
+            ok = false;
+            stop = true;
+        }
+        ++expected;
+    }
+    producer.join();
+
+    if(size_invalid) {
+        fprintf(stderr, "Error: size_for_producer returned more than the capacity\n");
+        ok = false;
+    }
+
+    Item item;
+    if(ok && queue.pop(item)) {
+        fprintf(stderr, "Error: the queue has items left after the last one\n");
+        ok = false;
+    }
+
+    if(!ok)
+        return 1;
+    printf("spsc_queue_test: %llu items in order, the queue was full %llu times\n", (unsigned long long)num_items, (unsigned long long)producer_full_count);
+    return 0;
+}